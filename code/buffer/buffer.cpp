@@ -80,18 +80,18 @@ void Buffer::Append(const Buffer& buff){
     Append(buff.Peek(), buff.ReadableBytes());
 }
 
-ssize_t Buffer::ReadFd(int fd, int* saveErron){
+ssize_t Buffer::ReadFd(int fd, int* saveErron, size_t limit){
     char buff[65535];     // 在栈上开辟65536的空间
     /* iovec 是一个结构体 
         *iov_base记录buffer地址
         iov_len表示buffer大小 */
     struct iovec iov[2];
-    const size_t writable = WritableBytes();
-    // 分散读，保证数据全部读完
+    const size_t writable = std::min(WritableBytes(), limit);
+    // 分散读，保证数据全部读完 至多读limit字节
     iov[0].iov_base = BeginPtr_() + writePos_;
     iov[0].iov_len = writable;
     iov[1].iov_base = buff;
-    iov[1].iov_len = sizeof(buff);
+    iov[1].iov_len = std::min(sizeof(buff), limit - writable);
 
     // 将数据从fd读到分散的内存块中，即分散读
     const ssize_t len = readv(fd, iov, 2);
@@ -100,7 +100,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErron){
     }else if(static_cast<size_t>(len) <= writable){
         writePos_ += len;   // 内存充足 改变下标位置
     }else{
-        writePos_ = buffer_.size();
+        writePos_ += writable;
         Append(buff, len - writable);
     }
     return len;
@@ -2,6 +2,8 @@
 #define BUFFER_H
 
 #include <cstring>
+#include <cstdint>
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <atomic>
@@ -46,7 +48,7 @@ public:
     void Append(const Buffer& buff);
 
     // 主要函数 上面函数多被这两个调用
-    ssize_t ReadFd(int fd, int* Errno);     // 从外部向缓冲区内部读入
+    ssize_t ReadFd(int fd, int* Errno, size_t limit = SIZE_MAX);     // 从外部向缓冲区内部读入 至多limit字节
     ssize_t WriteFd(int fd, int* Errno);    // 从外部写入缓冲区
 
 public:
@@ -0,0 +1,180 @@
+#include "charscan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHARSCAN_X86
+#endif
+
+namespace {
+
+bool IsTchar(unsigned char ch) {
+    if((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) return true;
+    for(const char* p = "!#$%&'*+-.^_`|~"; *p; p++) {
+        if(ch == static_cast<unsigned char>(*p)) return true;
+    }
+    return false;
+}
+
+/* member为标量查表 lo/hi为AVX2的半字节表: 字符c(<0x80)属于字符集 当且仅当 lo[c & 15] & hi[c >> 4] 非0
+   high表示0x80以上的字符是否属于字符集(各字符集对0x80以上一视同仁) */
+struct Tables {
+    Tables() {
+        for(int set = 0; set < CharScan::SET_COUNT; set++) {
+            for(int c = 0; c < 256; c++) {
+                bool in = false;
+                switch(set) {
+                case CharScan::EOL:         in = (c == '\r' || c == '\n'); break;
+                case CharScan::NOT_TOKEN:   in = !IsTchar(c); break;
+                case CharScan::NOT_TARGET:  in = (c <= ' ' || c == 0x7f); break;
+                case CharScan::NOT_VALUE:   in = ((c < ' ' && c != '\t') || c == 0x7f); break;
+                case CharScan::URL_ESCAPE:  in = (c == '%' || c == '+'); break;
+                }
+                member[set][c] = in;
+            }
+            for(int l = 0; l < 16; l++) {
+                lo[set][l] = 0;
+                for(int h = 0; h < 8; h++) {
+                    if(member[set][h << 4 | l]) lo[set][l] |= 1 << h;
+                }
+            }
+            high[set] = member[set][0x80];
+        }
+        for(int h = 0; h < 16; h++) {
+            hi[h] = h < 8 ? 1 << h : 0;
+        }
+    }
+
+    bool member[CharScan::SET_COUNT][256];
+    unsigned char lo[CharScan::SET_COUNT][16];
+    unsigned char hi[16];
+    bool high[CharScan::SET_COUNT];
+};
+
+const Tables TABLES;
+
+const char* FindScalar(const char* p, const char* end, CharScan::CHAR_SET set) {
+    const bool* member = TABLES.member[set];
+    for(; p < end; p++) {
+        if(member[static_cast<unsigned char>(*p)]) return p;
+    }
+    return end;
+}
+
+#ifdef CHARSCAN_X86
+// pcmpestri的区间 每两个字节为一个闭区间 NOT_TOKEN的"{\xff"多含了'|'和'~' 命中后查表排除
+struct Ranges {
+    char chars[17];
+    int len;
+};
+
+const Ranges RANGES[CharScan::SET_COUNT] = {
+    {"\r\r\n\n", 4},
+    {"\x00 \"\"(),,//:@[]{\xff", 16},
+    {"\x00 \x7f\x7f", 4},
+    {"\x00\x08\x0a\x1f\x7f\x7f", 6},
+    {"%%++", 4},
+};
+
+__attribute__((target("sse4.2")))
+const char* FindSse42(const char* p, const char* end, CharScan::CHAR_SET set) {
+    const __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i*>(RANGES[set].chars));
+    const int len = RANGES[set].len;
+    while(end - p >= 16) {
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int idx = _mm_cmpestri(ranges, len, b, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx == 16) {
+            p += 16;
+        } else if(TABLES.member[set][static_cast<unsigned char>(p[idx])]) {
+            return p + idx;
+        } else {
+            p += idx + 1;
+        }
+    }
+    return FindScalar(p, end, set);
+}
+
+// AVX2的第i位为1表示p[i]属于字符集 半字节查表对16字节的每一半独立进行
+__attribute__((target("avx2"), always_inline))
+inline unsigned Avx2Mask(const char* p, __m256i lo, __m256i hi, bool high) {
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(b, nibble));
+    __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(b, 4), nibble));
+    unsigned mask = ~static_cast<unsigned>(_mm256_movemask_epi8(
+                        _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256())));
+    return high ? mask | static_cast<unsigned>(_mm256_movemask_epi8(b)) : mask;
+}
+
+__attribute__((target("avx2"), always_inline))
+inline unsigned Avx2Mask16(const char* p, __m128i lo, __m128i hi, bool high) {
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(b, nibble));
+    __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(b, 4), nibble));
+    unsigned mask = ~static_cast<unsigned>(_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128()))) & 0xffff;
+    return high ? mask | static_cast<unsigned>(_mm_movemask_epi8(b)) : mask;
+}
+
+/* 不足32字节的尾部从end往回重叠取一块 已扫描过的字节移出掩码
+   尾部不交给FindSse42: 它是非VEX编码的SSE指令 紧跟在AVX指令后执行有状态切换的惩罚 */
+__attribute__((target("avx2")))
+const char* FindAvx2(const char* p, const char* end, CharScan::CHAR_SET set) {
+    const __m128i lo16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(TABLES.lo[set]));
+    const __m128i hi16 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(TABLES.hi));
+    const bool high = TABLES.high[set];
+    if(end - p >= 32) {
+        const __m256i lo = _mm256_broadcastsi128_si256(lo16);
+        const __m256i hi = _mm256_broadcastsi128_si256(hi16);
+        while(end - p >= 32) {
+            unsigned mask = Avx2Mask(p, lo, hi, high);
+            if(mask) return p + __builtin_ctz(mask);
+            p += 32;
+        }
+        if(p == end) return end;
+        unsigned mask = Avx2Mask(end - 32, lo, hi, high) >> (32 - (end - p));
+        return mask ? p + __builtin_ctz(mask) : end;
+    }
+    if(end - p >= 16) {
+        unsigned mask = Avx2Mask16(p, lo16, hi16, high);
+        if(mask) return p + __builtin_ctz(mask);
+        mask = Avx2Mask16(end - 16, lo16, hi16, high) >> (16 - (end - p - 16));
+        return mask ? p + 16 + __builtin_ctz(mask) : end;
+    }
+    return FindScalar(p, end, set);
+}
+#endif
+
+}
+
+CharScan::ISA CharScan::Detect() {
+#ifdef CHARSCAN_X86
+    __builtin_cpu_init();               // 静态初始化时调用 需先初始化CPU信息
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) return ISA_AVX2;
+    if(__builtin_cpu_supports("sse4.2")) return ISA_SSE42;
+#endif
+    return ISA_SCALAR;
+}
+
+bool CharScan::SetIsa(ISA isa) {
+    if(isa > Detect()) return false;
+    switch(isa) {
+#ifdef CHARSCAN_X86
+    case ISA_AVX2:  find_ = FindAvx2; break;
+    case ISA_SSE42: find_ = FindSse42; break;
+#endif
+    default:        find_ = FindScalar; break;
+    }
+    isa_ = isa;
+    return true;
+}
+
+bool CharScan::Has(char ch, CHAR_SET set) {
+    return TABLES.member[set][static_cast<unsigned char>(ch)];
+}
+
+CharScan::FindFunc CharScan::find_ = FindScalar;
+CharScan::ISA CharScan::isa_ = CharScan::ISA_SCALAR;
+
+namespace {
+const bool SELECTED = CharScan::SetIsa(CharScan::Detect());     // 在TABLES之后初始化
+}
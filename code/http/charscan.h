@@ -0,0 +1,42 @@
+#ifndef CHARSCAN_H
+#define CHARSCAN_H
+
+#include <stddef.h>
+
+/* HTTP解析和URL解码用的字符类批量扫描 一次比较16/32字节 找出第一个属于某字符集的字符
+   启动时按CPU选择实现: AVX2(半字节查表) > SSE4.2(pcmpestri区间比较) > 标量查表
+   SSE4.2的区间最多8个 只能表示字符集的超集 命中后再查表确认 */
+class CharScan {
+public:
+    enum CHAR_SET {
+        EOL,            // CR LF
+        NOT_TOKEN,      // 方法名和字段名(token)之外的字符
+        NOT_TARGET,     // 请求路径之外的字符: 控制字符和空格
+        NOT_VALUE,      // 字段值之外的字符: 除HTAB外的控制字符
+        URL_ESCAPE,     // URL编码中需要解码的字符: '%' '+'
+        SET_COUNT,
+    };
+
+    enum ISA {
+        ISA_SCALAR,
+        ISA_SSE42,
+        ISA_AVX2,
+    };
+
+    // 返回[p, end)中第一个属于set的字符 没有返回end
+    static const char* Find(const char* p, const char* end, CHAR_SET set) {
+        return find_(p, end, set);
+    }
+    static bool Has(char ch, CHAR_SET set);
+
+    static ISA Isa() { return isa_; }
+    static ISA Detect();                // CPU支持的最好实现
+    static bool SetIsa(ISA isa);        // 测试和基准用 CPU不支持时返回false
+
+private:
+    typedef const char* (*FindFunc)(const char* p, const char* end, CHAR_SET set);
+    static FindFunc find_;
+    static ISA isa_;
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "compresscache.h"
+#include <chrono>
+#include <zlib.h>
+
+#include "../log/log.h"
+using namespace std;
+
+namespace {
+
+long long NowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool IsFile(const string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+StrView Trim(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    while(end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return StrView(p, end - p);
+}
+
+// q=0 q=0.0 q=0.000 为不接受
+bool QZero(const char* p, const char* end) {
+    while(p < end) {
+        const char* semi = static_cast<const char*>(memchr(p, ';', end - p));
+        StrView param = Trim(p, semi ? semi : end);
+        if(param.size() >= 2 && StrView(param.data(), 2).EqualsNoCase("q=")) {
+            const char* v = param.data() + 2;
+            const char* vend = param.data() + param.size();
+            while(v < vend && (*v == '0' || *v == '.')) v++;
+            return v == vend;
+        }
+        p = semi ? semi + 1 : end;
+    }
+    return false;
+}
+
+}
+
+CompressCache::CompressCache(): bytes_(0), capacity_(DEFAULT_CAPACITY), stop_(false),
+    hits_(0), precompressed_(0), misses_(0), compressed_(0), skipped_(0) {
+    worker_ = thread(&CompressCache::Work_, this);
+}
+
+CompressCache::~CompressCache() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    worker_.join();
+}
+
+CompressCache* CompressCache::Instance() {
+    static CompressCache cache;
+    return &cache;
+}
+
+/* gzip, deflate, br;q=1.0, *;q=0 不认识的编码忽略 "*"代表没有单独列出的编码 */
+unsigned CompressCache::Accepted(StrView acceptEncoding) {
+    unsigned yes = 0, listed = 0;
+    bool star = false;
+    const char* p = acceptEncoding.data();
+    const char* end = p + acceptEncoding.size();
+    while(p < end) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        const char* elemEnd = comma ? comma : end;
+        const char* semi = static_cast<const char*>(memchr(p, ';', elemEnd - p));
+        StrView name = Trim(p, semi ? semi : elemEnd);
+        bool accepted = !semi || !QZero(semi + 1, elemEnd);
+        unsigned bit = 0;
+        if(name.EqualsNoCase("gzip") || name.EqualsNoCase("x-gzip")) { bit = GZIP; }
+        else if(name.EqualsNoCase("br")) { bit = BR; }
+        else if(name == "*") { star = accepted; }
+        listed |= bit;
+        if(accepted) yes |= bit;
+        p = comma ? comma + 1 : end;
+    }
+    if(star) yes |= (GZIP | BR) & ~listed;
+    return yes;
+}
+
+bool CompressCache::Compressible(const string& type) {
+    return type.compare(0, 5, "text/") == 0 || type == "application/xhtml+xml" || type == "application/rtf";
+}
+
+const char* CompressCache::Select(const FileCache::FilePtr& file, unsigned accept, FileCache::FilePtr& variant) {
+    long long now = NowMs();
+    const string& path = file->path;
+    bool hasBr, hasGz, check;
+    vector<FileCache::FilePtr> dropped;
+    {
+        lock_guard<mutex> locker(mtx_);
+        Entry& e = *Find_(*file, dropped);
+        check = now - e.checkedMs >= FileCache::REVALIDATE_MS;
+        if(check) e.checkedMs = now;
+        hasBr = e.hasBr;
+        hasGz = e.hasGz;
+    }
+    // 隔一段时间才查找一次.br .gz 锁外stat
+    if(check) {
+        hasBr = IsFile(path + ".br");
+        hasGz = IsFile(path + ".gz");
+        lock_guard<mutex> locker(mtx_);
+        auto it = index_.find(path);
+        if(it != index_.end() && FileCache::SameFile(it->second->st, file->st)) {
+            it->second->hasBr = hasBr;
+            it->second->hasGz = hasGz;
+        }
+    }
+    FileCache* files = FileCache::Instance();
+    thread_local string sibling;                // 复用内存
+    if((accept & BR) && hasBr && files->Get(sibling.assign(path).append(".br"), variant) == 200
+       && variant->st.st_mtime >= file->st.st_mtime) {
+        precompressed_.fetch_add(1, memory_order_relaxed);
+        return "br";
+    }
+    if((accept & GZIP) && hasGz && files->Get(sibling.assign(path).append(".gz"), variant) == 200
+       && variant->st.st_mtime >= file->st.st_mtime) {
+        precompressed_.fetch_add(1, memory_order_relaxed);
+        return "gzip";
+    }
+    variant.reset();
+    if(!(accept & GZIP)) return nullptr;
+
+    lock_guard<mutex> locker(mtx_);
+    Entry& e = *Find_(*file, dropped);
+    if(e.state == Entry::DONE) {
+        variant = e.gzip;
+        hits_.fetch_add(1, memory_order_relaxed);
+        return "gzip";
+    }
+    if(e.state == Entry::NONE && file->size >= MIN_SIZE && file->size <= MAX_SIZE
+       && capacity_ > 0 && queue_.size() < MAX_QUEUE) {
+        e.state = Entry::PENDING;
+        queue_.push_back(file);
+        cond_.notify_one();
+    }
+    if(e.state != Entry::SKIPPED) misses_.fetch_add(1, memory_order_relaxed);
+    return nullptr;
+}
+
+// 取file的条目移到头部 没有时新建 原文件变了时重置
+CompressCache::LruList::iterator CompressCache::Find_(const FileCache::File& file, vector<FileCache::FilePtr>& dropped) {
+    auto it = index_.find(file.path);
+    if(it != index_.end()) {
+        lru_.splice(lru_.begin(), lru_, it->second);
+        Entry& e = *it->second;
+        if(!FileCache::SameFile(e.st, file.st)) {
+            if(e.gzip) {
+                bytes_ -= e.gzip->size;
+                dropped.push_back(move(e.gzip));
+            }
+            e.st = file.st;
+            e.checkedMs = 0;
+            e.state = Entry::NONE;
+        }
+        return it->second;
+    }
+    Trim_(dropped);
+    lru_.push_front(Entry());
+    Entry& e = lru_.front();
+    e.path = file.path;
+    e.st = file.st;
+    e.hasBr = e.hasGz = false;
+    e.checkedMs = 0;
+    e.state = Entry::NONE;
+    index_.emplace(file.path, lru_.begin());
+    return lru_.begin();
+}
+
+void CompressCache::Trim_(vector<FileCache::FilePtr>& dropped) {
+    while((bytes_ > capacity_ || lru_.size() >= MAX_ENTRIES) && !lru_.empty()) {
+        Entry& victim = lru_.back();
+        if(victim.gzip) {
+            bytes_ -= victim.gzip->size;
+            dropped.push_back(move(victim.gzip));
+        }
+        index_.erase(victim.path);
+        lru_.pop_back();
+    }
+}
+
+/* 后台线程: 逐个压缩队列中的文件 压缩期间原文件可能已变 放入前再确认条目
+   省不了多少或比容量还大的标记为SKIPPED 原文件不变就不再尝试 */
+void CompressCache::Work_() {
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return stop_ || !queue_.empty(); });
+        if(stop_) break;
+        FileCache::FilePtr src = move(queue_.front());
+        queue_.pop_front();
+        locker.unlock();
+        FileCache::FilePtr gzip = Deflate_(*src);
+        vector<FileCache::FilePtr> dropped;
+        locker.lock();
+        auto it = index_.find(src->path);
+        if(it != index_.end() && it->second->state == Entry::PENDING && FileCache::SameFile(it->second->st, src->st)) {
+            Entry& e = *it->second;
+            if(gzip && gzip->size <= capacity_) {
+                LOG_DEBUG("Compressed %s: %zu -> %zu", src->path.c_str(), src->size, gzip->size);
+                e.state = Entry::DONE;
+                e.gzip = move(gzip);
+                bytes_ += e.gzip->size;
+                compressed_.fetch_add(1, memory_order_relaxed);
+                Trim_(dropped);
+            } else {
+                e.state = Entry::SKIPPED;
+                skipped_.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        locker.unlock();
+        dropped.clear();
+        src.reset();
+        gzip.reset();
+        locker.lock();
+    }
+}
+
+FileCache::FilePtr CompressCache::Deflate_(const FileCache::File& src) {
+    z_stream zs = {};
+    // windowBits加16输出gzip格式
+    if(deflateInit2(&zs, LEVEL, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nullptr;
+    }
+    size_t bound = deflateBound(&zs, src.size);
+    char* out = new char[bound];
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data));
+    zs.avail_in = src.size;
+    zs.next_out = reinterpret_cast<Bytef*>(out);
+    zs.avail_out = bound;
+    int ret = deflate(&zs, Z_FINISH);
+    size_t len = zs.total_out;
+    deflateEnd(&zs);
+    if(ret != Z_STREAM_END || len > src.size - src.size / 8) {
+        delete[] out;
+        return nullptr;
+    }
+    shared_ptr<FileCache::File> f = make_shared<FileCache::File>();
+    char* data = new char[len];
+    memcpy(data, out, len);
+    delete[] out;
+    f->path = src.path;
+    f->data = data;
+    f->size = len;
+    f->st = src.st;
+    f->contentType = src.contentType;
+    f->contentLength = to_string(len);
+    f->etag = src.etag.substr(0, src.etag.size() - 1) + "-gz\"";      // 不同编码的表示 强标签须不同
+    f->lastModified = src.lastModified;
+    f->BuildHeaders();
+    return f;
+}
+
+void CompressCache::SetCapacity(size_t bytes) {
+    vector<FileCache::FilePtr> dropped;
+    lock_guard<mutex> locker(mtx_);
+    capacity_ = bytes;
+    Trim_(dropped);
+}
+
+void CompressCache::Clear() {
+    LruList dropped;
+    lock_guard<mutex> locker(mtx_);
+    index_.clear();
+    lru_.swap(dropped);
+    bytes_ = 0;
+}
+
+CompressCache::Stats CompressCache::GetStats() const {
+    lock_guard<mutex> locker(mtx_);
+    return {hits_.load(), precompressed_.load(), misses_.load(), compressed_.load(), skipped_.load(),
+            lru_.size(), bytes_, capacity_};
+}
@@ -0,0 +1,90 @@
+#ifndef COMPRESS_CACHE_H
+#define COMPRESS_CACHE_H
+
+#include <string>
+#include <list>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+
+#include "strview.h"
+#include "filecache.h"
+
+/* 静态文件的压缩版本 只对文本类的可压缩类型协商
+   磁盘上有同名的.br .gz文件(不比原文件旧)时直接经文件缓存发送 否则第一次请求时交给后台线程用gzip压缩一次
+   压缩完成前照常发送原文件 请求路径上从不压缩 压缩结果按字节数LRU淘汰 原文件变了(文件缓存换了条目)时作废 */
+class CompressCache {
+public:
+    enum ENCODING {
+        GZIP = 1,
+        BR = 2,
+    };
+
+    struct Stats {
+        unsigned long long hits;                // 发送后台压缩的结果
+        unsigned long long precompressed;       // 发送磁盘上的.br .gz
+        unsigned long long misses;              // 接受gzip但还没有压缩好
+        unsigned long long compressed;
+        unsigned long long skipped;             // 压缩后省不了多少 不再尝试
+        size_t entries;
+        size_t bytes;                           // 压缩结果的字节数
+        size_t capacity;
+    };
+
+    static CompressCache* Instance();
+
+    static unsigned Accepted(StrView acceptEncoding);      // Accept-Encoding中接受的编码 q=0为不接受
+    static bool Compressible(const std::string& type);     // 按Content-Type
+
+    /* 从accept中选出file的压缩版本 有则设置variant并返回"br"或"gzip" 没有返回nullptr
+       file须为可压缩的类型 没有gzip版本时放入后台队列 */
+    const char* Select(const FileCache::FilePtr& file, unsigned accept, FileCache::FilePtr& variant);
+    void SetCapacity(size_t bytes);             // 压缩结果总字节数上限 0为不在后台压缩
+    void Clear();
+    Stats GetStats() const;
+
+    static const size_t DEFAULT_CAPACITY = 32UL << 20;
+    static const size_t MIN_SIZE = 256;                 // 更小的文件压缩省不了几个字节
+    static const size_t MAX_SIZE = 8UL << 20;           // 更大的只用预压缩的文件
+    static const size_t MAX_ENTRIES = 4096;             // 包括还没有或不值得压缩的文件
+    static const size_t MAX_QUEUE = 64;                 // 队列满时不排队 之后的请求再放入
+    static const int LEVEL = 9;                         // 只压缩一次 用最高的压缩级别
+
+private:
+    CompressCache();
+    ~CompressCache();
+
+    struct Entry {
+        enum STATE { NONE, PENDING, DONE, SKIPPED };
+        std::string path;
+        struct stat st;                         // 原文件 与请求的文件不同时条目作废
+        bool hasBr, hasGz;                      // 磁盘上的.br .gz
+        long long checkedMs;                    // 上次查找.br .gz的时间
+        STATE state;
+        FileCache::FilePtr gzip;                // 后台压缩的结果
+    };
+    typedef std::list<Entry> LruList;           // 头部为最近使用
+
+    static FileCache::FilePtr Deflate_(const FileCache::File& src);     // 压缩后不到原大小的7/8返回空
+    void Work_();
+    // 以下持有锁 换下的压缩结果放入dropped 在锁外释放
+    LruList::iterator Find_(const FileCache::File& file, std::vector<FileCache::FilePtr>& dropped);
+    void Trim_(std::vector<FileCache::FilePtr>& dropped);
+
+    mutable std::mutex mtx_;
+    std::condition_variable cond_;
+    std::unordered_map<std::string, LruList::iterator> index_;
+    LruList lru_;
+    size_t bytes_;
+    size_t capacity_;
+    std::deque<FileCache::FilePtr> queue_;      // 待压缩的原文件
+    bool stop_;
+    std::thread worker_;
+    std::atomic<unsigned long long> hits_, precompressed_, misses_, compressed_, skipped_;
+};
+
+#endif
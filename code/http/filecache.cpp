@@ -0,0 +1,195 @@
+#include "filecache.h"
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "httpresponse.h"
+using namespace std;
+
+namespace {
+
+long long NowMs() {
+    return chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+FileCache::File::~File() {
+    if(mapped) {
+        munmap(const_cast<char*>(data), size);
+    } else {
+        delete[] data;
+    }
+    if(fd >= 0) close(fd);
+}
+
+bool FileCache::SameFile(const struct stat& a, const struct stat& b) {
+    return a.st_ino == b.st_ino && a.st_dev == b.st_dev && a.st_size == b.st_size
+        && a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+
+void FileCache::File::BuildHeaders() {
+    typeHeader = "Content-type: " + contentType + "\r\n";
+    validatorHeaders = "ETag: " + etag + "\r\nLast-Modified: " + lastModified + "\r\n";
+}
+
+FileCache::FileCache(): bytes_(0), capacity_(DEFAULT_CAPACITY), hits_(0), misses_(0), evictions_(0) {}
+
+FileCache* FileCache::Instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+int FileCache::Get(const string& path, FilePtr& file) {
+    long long now = NowMs();
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = index_.find(path);
+        if(it != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, it->second);
+            file = *it->second;
+        } else {
+            file.reset();
+        }
+    }
+    if(file && now - file->checkedMs.load(memory_order_relaxed) < REVALIDATE_MS) {
+        hits_.fetch_add(1, memory_order_relaxed);
+        return 200;
+    }
+
+    // 没有或需要确认 锁外stat和加载 并发的加载各自完成 后放入的替换先放入的
+    struct stat st;
+    int code = 200;
+    if(stat(path.c_str(), &st) < 0 || S_ISDIR(st.st_mode)) {
+        code = 404;
+    } else if(!(st.st_mode & S_IROTH)) {
+        code = 403;
+    } else if(file && SameFile(file->st, st)) {
+        file->checkedMs.store(now, memory_order_relaxed);
+        hits_.fetch_add(1, memory_order_relaxed);
+        return 200;
+    }
+    vector<FilePtr> dropped;
+    if(code != 200) {
+        if(file) {
+            lock_guard<mutex> locker(mtx_);
+            Remove_(file, dropped);
+        }
+        file.reset();
+        return code;
+    }
+    misses_.fetch_add(1, memory_order_relaxed);
+    code = Load_(path, st, file);
+    lock_guard<mutex> locker(mtx_);
+    if(code == 200 && file->size <= capacity_ / MAX_FILE_SHARE) {
+        Insert_(file, dropped);
+    }
+    return code;
+}
+
+int FileCache::Load_(const string& path, const struct stat& st, FilePtr& file) {
+    file.reset();
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) return 404;
+    shared_ptr<File> f = make_shared<File>();
+    f->path = path;
+    f->st = st;
+    f->size = st.st_size;
+    f->contentType = HttpResponse::FileType(path);
+    f->contentLength = to_string(f->size);
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), "\"%llx-%llx-%llx\"", (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+                     (unsigned long long)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec);
+    f->etag.assign(buf, n);
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    f->lastModified.assign(buf, strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm));
+    f->BuildHeaders();
+    if(f->size > 0 && f->size <= SMALL_FILE) {
+        char* buf = new char[f->size];
+        size_t got = 0;
+        ssize_t n;
+        while(got < f->size && (n = read(fd, buf + got, f->size - got)) > 0) got += n;
+        f->data = buf;
+        if(got < f->size) {         // stat之后被截短
+            close(fd);
+            return 404;
+        }
+    } else if(f->size > 0) {
+        // MAP_PRIVATE 建立一个写入时拷贝的私有映射
+        void* mmRet = mmap(0, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mmRet == MAP_FAILED) {
+            close(fd);
+            return 404;
+        }
+        f->data = static_cast<char*>(mmRet);
+        f->mapped = true;
+    }
+    if(f->size >= SENDFILE_MIN) {
+        f->fd = fd;
+    } else {
+        close(fd);
+    }
+    f->checkedMs.store(NowMs(), memory_order_relaxed);
+    file = move(f);
+    return 200;
+}
+
+void FileCache::Insert_(const FilePtr& file, vector<FilePtr>& dropped) {
+    auto it = index_.find(file->path);
+    if(it != index_.end()) {
+        bytes_ -= (*it->second)->size;
+        dropped.push_back(move(*it->second));
+        lru_.erase(it->second);
+        it->second = lru_.insert(lru_.begin(), file);
+    } else {
+        lru_.push_front(file);
+        index_.emplace(file->path, lru_.begin());
+    }
+    bytes_ += file->size;
+    while(bytes_ > capacity_ && !lru_.empty()) {
+        const FilePtr& victim = lru_.back();
+        bytes_ -= victim->size;
+        index_.erase(victim->path);
+        dropped.push_back(move(lru_.back()));
+        lru_.pop_back();
+        evictions_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void FileCache::Remove_(const FilePtr& file, vector<FilePtr>& dropped) {
+    auto it = index_.find(file->path);
+    if(it == index_.end() || *it->second != file) return;
+    bytes_ -= file->size;
+    dropped.push_back(move(*it->second));
+    lru_.erase(it->second);
+    index_.erase(it);
+}
+
+void FileCache::SetCapacity(size_t bytes) {
+    vector<FilePtr> dropped;
+    lock_guard<mutex> locker(mtx_);
+    capacity_ = bytes;
+    while(bytes_ > capacity_ && !lru_.empty()) {
+        bytes_ -= lru_.back()->size;
+        index_.erase(lru_.back()->path);
+        dropped.push_back(move(lru_.back()));
+        lru_.pop_back();
+        evictions_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void FileCache::Clear() {
+    LruList dropped;
+    lock_guard<mutex> locker(mtx_);
+    index_.clear();
+    lru_.swap(dropped);
+    bytes_ = 0;
+}
+
+FileCache::Stats FileCache::GetStats() const {
+    lock_guard<mutex> locker(mtx_);
+    return {hits_.load(), misses_.load(), evictions_.load(), lru_.size(), bytes_, capacity_};
+}
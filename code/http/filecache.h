@@ -0,0 +1,88 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <sys/stat.h>
+
+/* 进程内共享的静态文件缓存 以完整路径为键 保存文件内容、stat结果和预先生成的Content-Type、Content-Length
+   以及ETag、Last-Modified 小文件复制到堆内存 其余保留内存映射 大文件另外保持打开 供sendfile直接从页缓存发送 按文件总字节数LRU淘汰 条目由shared_ptr计数
+   被淘汰或替换的条目在最后一个使用者(还在发送的响应)放下时才释放内存或解除映射
+   命中时不再stat/open/mmap/munmap 距上次确认超过REVALIDATE_MS时stat一次 文件变了(大小、修改时间、inode)就重新加载 */
+class FileCache {
+public:
+    struct File {
+        File(): data(nullptr), size(0), mapped(false), fd(-1), checkedMs(0) {}
+        ~File();
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+
+        std::string path;
+        const char* data;                       // 文件内容 空文件为nullptr
+        size_t size;
+        bool mapped;                            // data为内存映射 否则为堆内存
+        int fd;                                 // 不小于SENDFILE_MIN的文件保持打开 其余为-1
+        struct stat st;
+        std::string contentType;
+        std::string contentLength;              // size的十进制
+        std::string etag;                       // 强实体标签 由inode、大小、修改时间生成 带引号
+        std::string lastModified;               // HTTP日期
+        // 响应头片段 每个响应直接复制 "Content-type: ...\r\n" 和 "ETag: ...\r\nLast-Modified: ...\r\n"
+        std::string typeHeader;
+        std::string validatorHeaders;
+        mutable std::atomic<long long> checkedMs;   // 上次确认与磁盘一致的时间
+
+        void BuildHeaders();                    // 由类型、实体标签和修改时间生成响应头片段
+    };
+    typedef std::shared_ptr<const File> FilePtr;
+
+    struct Stats {
+        unsigned long long hits;
+        unsigned long long misses;              // 包括过期后的重新加载和不放入缓存的大文件
+        unsigned long long evictions;
+        size_t files;                           // 缓存中的文件数
+        size_t bytes;                           // 缓存中的文件字节数
+        size_t capacity;
+        double HitRatio() const { return hits + misses ? (double)hits / (hits + misses) : 0; }
+    };
+
+    static FileCache* Instance();
+
+    /* 取path处的文件 成功返回200并设置file 不存在、是目录或打不开返回404 其他用户不可读返回403
+       大于容量1/MAX_FILE_SHARE的文件不放入缓存 每次重新映射 */
+    int Get(const std::string& path, FilePtr& file);
+    void SetCapacity(size_t bytes);             // 总字节数上限 0为不缓存
+    void Clear();
+    Stats GetStats() const;
+    static bool SameFile(const struct stat& a, const struct stat& b);      // 大小、修改时间、inode都相同
+
+    static const size_t DEFAULT_CAPACITY = 256UL << 20;
+    static const size_t SMALL_FILE = 16 * 1024;         // 不超过时复制到堆内存 省去映射和缺页
+    static const size_t MAX_FILE_SHARE = 4;
+    static const size_t SENDFILE_MIN = 512 * 1024;      // 缓存中的大文件不超过容量/SENDFILE_MIN个 打开的fd数有上界
+    static const long long REVALIDATE_MS = 1000;
+
+private:
+    FileCache();
+
+    typedef std::list<FilePtr> LruList;         // 头部为最近使用
+
+    static int Load_(const std::string& path, const struct stat& st, FilePtr& file);
+    // 以下持有锁 换下的条目放入dropped 在锁外释放
+    void Insert_(const FilePtr& file, std::vector<FilePtr>& dropped);
+    void Remove_(const FilePtr& file, std::vector<FilePtr>& dropped);
+
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, LruList::iterator> index_;
+    LruList lru_;
+    size_t bytes_;
+    size_t capacity_;
+    std::atomic<unsigned long long> hits_, misses_, evictions_;
+};
+
+#endif
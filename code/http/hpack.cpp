@@ -0,0 +1,268 @@
+#include "hpack.h"
+#include <stdio.h>
+
+namespace {
+
+struct StaticEntry {
+    const char* name;
+    const char* value;
+};
+
+// RFC 7541 附录A 下标从1开始
+const StaticEntry STATIC_TABLE[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+const uint32_t STATIC_COUNT = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+struct HuffCode {
+    uint32_t code;
+    int bits;
+};
+
+// RFC 7541 附录B 第256项为EOS
+const HuffCode HUFF_CODES[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28}, {0xfffffe4, 28}, {0xfffffe5, 28},
+    {0xfffffe6, 28}, {0xfffffe7, 28}, {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28}, {0xfffffed, 28}, {0xfffffee, 28},
+    {0xfffffef, 28}, {0xffffff0, 28}, {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28}, {0xffffff8, 28}, {0xffffff9, 28},
+    {0xffffffa, 28}, {0xffffffb, 28}, {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11}, {0x3fa, 10}, {0x3fb, 10},
+    {0xf9, 8}, {0x7fb, 11}, {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6}, {0x1a, 6}, {0x1b, 6},
+    {0x1c, 6}, {0x1d, 6}, {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10}, {0x1ffa, 13}, {0x21, 6},
+    {0x5d, 7}, {0x5e, 7}, {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7}, {0x67, 7}, {0x68, 7},
+    {0x69, 7}, {0x6a, 7}, {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7}, {0xfc, 8}, {0x73, 7},
+    {0xfd, 8}, {0x1ffb, 13}, {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5}, {0x24, 6}, {0x5, 5},
+    {0x25, 6}, {0x26, 6}, {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5}, {0x2b, 6}, {0x76, 7},
+    {0x2c, 6}, {0x8, 5}, {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15}, {0x7fc, 11}, {0x3ffd, 14},
+    {0x1ffd, 13}, {0xffffffc, 28}, {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23}, {0x3fffd6, 22}, {0x7fffda, 23},
+    {0x7fffdb, 23}, {0x7fffdc, 23}, {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23}, {0xffffee, 24}, {0x7fffe1, 23},
+    {0x7fffe2, 23}, {0x7fffe3, 23}, {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24}, {0x3fffda, 22}, {0x1fffdd, 21},
+    {0xfffe9, 20}, {0x3fffdb, 22}, {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24}, {0x1fffdf, 21}, {0x3fffdf, 22},
+    {0x7fffeb, 23}, {0x7fffec, 23}, {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23}, {0xfffea, 20}, {0x3fffe2, 22},
+    {0x3fffe3, 22}, {0x3fffe4, 22}, {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19}, {0x3fffe7, 22}, {0x7ffff2, 23},
+    {0x3fffe8, 22}, {0x1ffffec, 25}, {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25}, {0x7fff2, 19}, {0x1fffe3, 21},
+    {0x3ffffe6, 26}, {0x7ffffe0, 27}, {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26}, {0xffffffd, 28}, {0x7ffffe3, 27},
+    {0x7ffffe4, 27}, {0x7ffffe5, 27}, {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23}, {0x3fffea, 22}, {0x3fffeb, 22},
+    {0x1ffffee, 25}, {0x1ffffef, 25}, {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26}, {0x7ffffe7, 27}, {0x7ffffe8, 27},
+    {0x7ffffe9, 27}, {0x7ffffea, 27}, {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26}, {0x3fffffff, 30},
+};
+
+/* Huffman码的解码树 逐位下行 next[n][b]: 大于0为内部节点 小于0为叶子-(符号+1) 0为无效
+   根为节点0 不会作为子节点出现 */
+struct HuffTree {
+    HuffTree() {
+        int cnt = 1;
+        memset(next, 0, sizeof(next));
+        for(int sym = 0; sym < 257; sym++) {
+            int node = 0;
+            for(int i = HUFF_CODES[sym].bits - 1; i > 0; i--) {
+                int b = HUFF_CODES[sym].code >> i & 1;
+                if(next[node][b] == 0) next[node][b] = cnt++;
+                node = next[node][b];
+            }
+            next[node][HUFF_CODES[sym].code & 1] = -(sym + 1);
+        }
+    }
+
+    int16_t next[256][2];
+};
+
+const HuffTree HUFF_TREE;
+
+}
+
+HpackDecoder::HpackDecoder(size_t maxTableSize): size_(0), maxSize_(maxTableSize), limit_(maxTableSize) {}
+
+/* 填充只能是不足8位的EOS前缀(全1) 解出EOS视为错误 */
+bool HpackDecoder::HuffmanDecode(const uint8_t* p, size_t len, std::string& out) {
+    int node = 0;
+    int depth = 0;                  // 当前符号已读的位数
+    bool ones = true;               // 当前符号已读的位是否全为1
+    for(size_t i = 0; i < len; i++) {
+        for(int shift = 7; shift >= 0; shift--) {
+            int b = p[i] >> shift & 1;
+            node = HUFF_TREE.next[node][b];
+            depth++;
+            ones = ones && b;
+            if(node < 0) {
+                if(node == -257) return false;
+                out.push_back(static_cast<char>(-node - 1));
+                node = depth = 0;
+                ones = true;
+            }
+        }
+    }
+    return depth < 8 && ones;
+}
+
+bool HpackDecoder::DecodeInt_(const uint8_t*& p, const uint8_t* end, int prefix, uint32_t& value) {
+    if(p == end) return false;
+    uint32_t mask = (1u << prefix) - 1;
+    value = *p++ & mask;
+    if(value < mask) return true;
+    for(int shift = 0; shift <= 28; shift += 7) {
+        if(p == end) return false;
+        uint8_t b = *p++;
+        uint64_t v = value + (static_cast<uint64_t>(b & 0x7f) << shift);
+        if(v > UINT32_MAX) return false;
+        value = static_cast<uint32_t>(v);
+        if(!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+bool HpackDecoder::DecodeString_(const uint8_t*& p, const uint8_t* end, std::string& out) {
+    if(p == end) return false;
+    bool huffman = *p & 0x80;
+    uint32_t len;
+    if(!DecodeInt_(p, end, 7, len) || len > static_cast<size_t>(end - p) || len > MAX_HEADER_LIST) return false;
+    out.clear();
+    if(huffman) {
+        if(!HuffmanDecode(p, len, out)) return false;
+    } else {
+        out.assign(reinterpret_cast<const char*>(p), len);
+    }
+    p += len;
+    return true;
+}
+
+bool HpackDecoder::Lookup_(uint32_t index, std::string* name, std::string* value) const {
+    if(index == 0) return false;
+    if(index <= STATIC_COUNT) {
+        *name = STATIC_TABLE[index - 1].name;
+        if(value) *value = STATIC_TABLE[index - 1].value;
+        return true;
+    }
+    index -= STATIC_COUNT + 1;
+    if(index >= table_.size()) return false;
+    *name = table_[index].name;
+    if(value) *value = table_[index].value;
+    return true;
+}
+
+void HpackDecoder::Evict_(size_t limit) {
+    while(size_ > limit) {
+        size_ -= table_.back().name.size() + table_.back().value.size() + 32;
+        table_.pop_back();
+    }
+}
+
+// 大于表上限的项清空整个表 本身也不加入
+void HpackDecoder::Insert_(const std::string& name, const std::string& value) {
+    size_t entrySize = name.size() + value.size() + 32;
+    if(entrySize > maxSize_) {
+        Evict_(0);
+        return;
+    }
+    Evict_(maxSize_ - entrySize);
+    table_.push_front(Entry{name, value});
+    size_ += entrySize;
+}
+
+/* 首字节的高位决定表示方式: 1 索引 / 01 字面量并加入动态表 / 001 表大小更新 / 0000 0001 字面量不加入动态表
+   表大小更新只能出现在头部块开头 */
+bool HpackDecoder::Decode(const uint8_t* p, size_t len, HeaderList& headers) {
+    const uint8_t* end = p + len;
+    size_t listSize = 0;
+    bool first = true;
+    std::string name, value;
+    while(p < end) {
+        uint8_t b = *p;
+        uint32_t index;
+        if(b & 0x80) {
+            if(!DecodeInt_(p, end, 7, index) || !Lookup_(index, &name, &value)) return false;
+        } else if((b & 0xe0) == 0x20) {
+            if(!first || !DecodeInt_(p, end, 5, index) || index > limit_) return false;
+            maxSize_ = index;
+            Evict_(maxSize_);
+            continue;
+        } else {
+            bool indexing = b & 0x40;
+            if(!DecodeInt_(p, end, indexing ? 6 : 4, index)) return false;
+            if(index ? !Lookup_(index, &name, nullptr) : !DecodeString_(p, end, name)) return false;
+            if(!DecodeString_(p, end, value)) return false;
+            if(indexing) Insert_(name, value);
+        }
+        first = false;
+        listSize += name.size() + value.size() + 32;
+        if(listSize > MAX_HEADER_LIST) return false;
+        headers.emplace_back(name, value);
+    }
+    return true;
+}
+
+void HpackEncoder::EncodeInt(Buffer& out, uint32_t value, int prefix, uint8_t flags) {
+    uint8_t bytes[8];
+    int n = 0;
+    uint32_t mask = (1u << prefix) - 1;
+    if(value < mask) {
+        bytes[n++] = flags | value;
+    } else {
+        bytes[n++] = flags | mask;
+        value -= mask;
+        while(value >= 0x80) {
+            bytes[n++] = 0x80 | (value & 0x7f);
+            value >>= 7;
+        }
+        bytes[n++] = value;
+    }
+    out.Append(bytes, n);
+}
+
+void HpackEncoder::EncodeStatus(Buffer& out, int code) {
+    const int INDEXED[] = {200, 204, 206, 304, 400, 404, 500};
+    for(int i = 0; i < 7; i++) {
+        if(INDEXED[i] == code) {
+            EncodeInt(out, IDX_STATUS + i, 7, 0x80);
+            return;
+        }
+    }
+    char digits[16];
+    int len = snprintf(digits, sizeof(digits), "%d", code);
+    EncodeField(out, IDX_STATUS, nullptr, digits, len);
+}
+
+void HpackEncoder::EncodeField(Buffer& out, int nameIndex, const char* name, const char* value, size_t len) {
+    EncodeInt(out, nameIndex, 4, 0);
+    if(nameIndex == 0) {
+        size_t nameLen = strlen(name);
+        EncodeInt(out, nameLen, 7, 0);
+        out.Append(name, nameLen);
+    }
+    EncodeInt(out, len, 7, 0);
+    out.Append(value, len);
+}
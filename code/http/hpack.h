@@ -0,0 +1,73 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+
+#include "../buffer/buffer.h"
+
+/* HTTP/2的头部压缩(RFC 7541)
+   解码: 静态表 + 动态表 + Huffman 每个连接一个解码器 动态表在该连接所有的头部块之间共享
+   编码只用于响应头: 静态表索引和不索引的字面量 不用Huffman也不维护动态表 对端的表大小设置不影响编码 */
+class HpackDecoder {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> HeaderList;
+
+    explicit HpackDecoder(size_t maxTableSize = DEFAULT_TABLE_SIZE);
+
+    // 解码一个完整的头部块 字段按顺序追加到headers 格式错误或超过上限返回false 应以COMPRESSION_ERROR关闭连接
+    bool Decode(const uint8_t* p, size_t len, HeaderList& headers);
+    size_t TableSize() const { return size_; }          // 动态表当前大小 每项按名字+值+32计
+
+    static bool HuffmanDecode(const uint8_t* p, size_t len, std::string& out);
+
+    static const size_t DEFAULT_TABLE_SIZE = 4096;
+    static const size_t MAX_HEADER_LIST = 65536;        // 一个头部块解码后的上限 同样按名字+值+32计
+
+private:
+    struct Entry {
+        std::string name, value;
+    };
+
+    static bool DecodeInt_(const uint8_t*& p, const uint8_t* end, int prefix, uint32_t& value);
+    static bool DecodeString_(const uint8_t*& p, const uint8_t* end, std::string& out);
+    bool Lookup_(uint32_t index, std::string* name, std::string* value) const;
+    void Insert_(const std::string& name, const std::string& value);
+    void Evict_(size_t limit);                          // 从最旧的项开始淘汰 直到不超过limit
+
+    std::deque<Entry> table_;                           // 动态表 最新的在前
+    size_t size_;
+    size_t maxSize_;                                    // 当前上限 由头部块中的表大小更新设置
+    size_t limit_;                                      // 本端在SETTINGS中允许的上限
+};
+
+class HpackEncoder {
+public:
+    // 编码时用到的静态表下标
+    enum STATIC_INDEX {
+        IDX_AUTHORITY = 1,
+        IDX_METHOD_GET = 2,
+        IDX_PATH = 4,
+        IDX_SCHEME_HTTP = 6,
+        IDX_STATUS = 8,
+        IDX_CACHE_CONTROL = 24,
+        IDX_CONTENT_ENCODING = 26,
+        IDX_CONTENT_LENGTH = 28,
+        IDX_CONTENT_TYPE = 31,
+        IDX_ETAG = 34,
+        IDX_LAST_MODIFIED = 44,
+        IDX_VARY = 59,
+    };
+
+    static void EncodeInt(Buffer& out, uint32_t value, int prefix, uint8_t flags);
+    static void EncodeStatus(Buffer& out, int code);    // 静态表中有的状态码只占一个字节
+    // 不索引的字面量 nameIndex为0时字段名也用字面量
+    static void EncodeField(Buffer& out, int nameIndex, const char* name, const char* value, size_t len);
+    static void EncodeField(Buffer& out, int nameIndex, const std::string& value) {
+        EncodeField(out, nameIndex, nullptr, value.data(), value.size());
+    }
+};
+
+#endif
@@ -0,0 +1,580 @@
+#include "http2conn.h"
+using namespace std;
+
+namespace {
+
+const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t PREFACE_LEN = sizeof(PREFACE) - 1;
+
+uint32_t Read32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+void Write32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// HTTP/1.1连接专用的头部 出现在HTTP/2请求中为格式错误
+bool IsConnectionHeader(const string& name) {
+    return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+        || name == "transfer-encoding" || name == "upgrade";
+}
+
+}
+
+Http2Conn::Http2Conn(const char* srcDir): srcDir_(srcDir), prefaceOk_(false), settingsOk_(false),
+    goawaySent_(false), goawayRecv_(false), lastStreamId_(0), rrLast_(0),
+    peerInitWindow_(DEFAULT_WINDOW), peerMaxFrame_(MAX_FRAME), sendWindow_(DEFAULT_WINDOW),
+    recvWindow_(DEFAULT_WINDOW), recvUnacked_(0), headerStream_(0), headerEndStream_(false), responded_(0) {
+    // 服务器序言: 本端的SETTINGS 其余设置取默认值
+    uint8_t payload[6] = {0, SETTINGS_MAX_CONCURRENT_STREAMS};
+    Write32(payload + 2, MAX_CONCURRENT_STREAMS);
+    WriteFrameHeader_(ctrl_, sizeof(payload), FRAME_SETTINGS, 0, 0);
+    ctrl_.Append(payload, sizeof(payload));
+}
+
+Http2Conn::~Http2Conn() {
+}
+
+int Http2Conn::MatchPreface(const char* p, size_t len) {
+    size_t n = len < PREFACE_LEN ? len : PREFACE_LEN;
+    if(memcmp(p, PREFACE, n) != 0) return -1;
+    return n == PREFACE_LEN ? 1 : 0;
+}
+
+bool Http2Conn::DecodeSettings(StrView value, string& payload) {
+    payload.clear();
+    uint32_t bits = 0;
+    int cnt = 0;
+    for(size_t i = 0; i < value.size(); i++) {
+        char ch = value[i];
+        int v;
+        if(ch >= 'A' && ch <= 'Z') v = ch - 'A';
+        else if(ch >= 'a' && ch <= 'z') v = ch - 'a' + 26;
+        else if(ch >= '0' && ch <= '9') v = ch - '0' + 52;
+        else if(ch == '-' || ch == '+') v = 62;
+        else if(ch == '_' || ch == '/') v = 63;
+        else if(ch == '=') break;
+        else return false;
+        bits = bits << 6 | v;
+        cnt += 6;
+        if(cnt >= 8) {
+            cnt -= 8;
+            payload.push_back(static_cast<char>(bits >> cnt & 0xff));
+        }
+    }
+    return payload.size() % 6 == 0;
+}
+
+void Http2Conn::Upgrade(HttpRequest& request, const string& payload) {
+    if(ERROR_CODE err = ApplySettings_(reinterpret_cast<const uint8_t*>(payload.data()), payload.size())) {
+        ConnError_(err);
+        return;
+    }
+    Stream& s = streams_[1];
+    s = Stream();
+    s.id = lastStreamId_ = 1;
+    s.recvEnd = true;
+    s.headOnly = request.method() == "HEAD";
+    s.sendWindow = peerInitWindow_;
+    s.recvWindow = DEFAULT_WINDOW;
+    Respond_(s, request, HttpRequest::GET_REQUEST);
+}
+
+void Http2Conn::Feed(Buffer& in) {
+    if(!prefaceOk_ && !goawaySent_) {
+        int m = MatchPreface(in.Peek(), in.ReadableBytes());
+        if(m == 0) return;
+        if(m < 0) {
+            ConnError_(ERR_PROTOCOL);
+        } else {
+            in.Retrieve(PREFACE_LEN);
+            prefaceOk_ = true;
+        }
+    }
+    while(!goawaySent_ && in.ReadableBytes() >= 9) {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in.Peek());
+        uint32_t len = p[0] << 16 | p[1] << 8 | p[2];
+        if(len > MAX_FRAME) {
+            ConnError_(ERR_FRAME_SIZE);
+            break;
+        }
+        if(in.ReadableBytes() < 9 + len) break;
+        OnFrame_(p[3], p[4], Read32(p + 5) & 0x7fffffff, p + 9, len);
+        in.Retrieve(9 + len);
+    }
+    if(goawaySent_) in.RetrieveAll();
+}
+
+void Http2Conn::OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len) {
+    // 对端的第一个帧须是SETTINGS 头部块须由连续的CONTINUATION帧接完
+    if(!settingsOk_ && (type != FRAME_SETTINGS || (flags & FLAG_ACK))) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    if(headerStream_ && (type != FRAME_CONTINUATION || id != headerStream_)) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    switch(type) {
+    case FRAME_DATA:        OnData_(flags, id, p, len); break;
+    case FRAME_HEADERS:     OnHeaders_(flags, id, p, len); break;
+    case FRAME_PRIORITY:
+        if(id == 0) ConnError_(ERR_PROTOCOL);
+        else if(len != 5) ResetStream_(id, ERR_FRAME_SIZE);
+        break;
+    case FRAME_RST_STREAM:  OnRstStream_(id, len); break;
+    case FRAME_SETTINGS:    OnSettings_(flags, id, p, len); break;
+    case FRAME_PING:
+        if(id != 0) ConnError_(ERR_PROTOCOL);
+        else if(len != 8) ConnError_(ERR_FRAME_SIZE);
+        else if(!(flags & FLAG_ACK)) {
+            WriteFrameHeader_(ctrl_, 8, FRAME_PING, FLAG_ACK, 0);
+            ctrl_.Append(p, 8);
+        }
+        break;
+    case FRAME_GOAWAY:
+        if(id != 0) ConnError_(ERR_PROTOCOL);
+        else goawayRecv_ = true;
+        break;
+    case FRAME_WINDOW_UPDATE: OnWindowUpdate_(id, p, len); break;
+    case FRAME_CONTINUATION:
+        if(!headerStream_) {
+            ConnError_(ERR_PROTOCOL);
+        } else if(headerBlock_.size() + len > MAX_HEADER_BLOCK) {
+            ConnError_(ERR_ENHANCE_YOUR_CALM);
+        } else {
+            headerBlock_.append(reinterpret_cast<const char*>(p), len);
+            if(flags & FLAG_END_HEADERS) EndHeaders_();
+        }
+        break;
+    case FRAME_PUSH_PROMISE: ConnError_(ERR_PROTOCOL); break;   // 客户端不能推送
+    default: break;                                             // 未知类型的帧忽略
+    }
+}
+
+bool Http2Conn::StripPadding_(uint8_t flags, const uint8_t*& p, uint32_t& len) {
+    if(!(flags & FLAG_PADDED)) return true;
+    if(len < 1 || p[0] >= len) return false;
+    len -= p[0] + 1;
+    p++;
+    return true;
+}
+
+/* 连接级的接收窗口按整个帧(含填充)扣除 已关闭的流上的DATA也要归还 */
+void Http2Conn::OnData_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len) {
+    if(id == 0) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    uint32_t frameLen = len;
+    recvWindow_ -= frameLen;
+    if(recvWindow_ < 0) {
+        ConnError_(ERR_FLOW_CONTROL);
+        return;
+    }
+    recvUnacked_ += frameLen;
+    if(recvUnacked_ >= DEFAULT_WINDOW / 2) {
+        WriteWindowUpdate_(0, recvUnacked_);
+        recvWindow_ += recvUnacked_;
+        recvUnacked_ = 0;
+    }
+    if(!StripPadding_(flags, p, len)) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        if(id > lastStreamId_) ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    Stream& s = it->second;
+    if(s.recvEnd) {
+        if(!s.tooLarge) ResetStream_(id, ERR_STREAM_CLOSED);
+        return;
+    }
+    s.recvWindow -= frameLen;
+    if(s.recvWindow < 0) {
+        ResetStream_(id, ERR_FLOW_CONTROL);
+        return;
+    }
+    if(s.body.size() + len > HttpRequest::MaxBodySize()) {
+        // 不等请求体收完就回413 响应发完后以RST_STREAM(NO_ERROR)结束流
+        s.tooLarge = s.recvEnd = true;
+        s.body.clear();
+        StartResponse_(s);
+        return;
+    }
+    s.body.append(reinterpret_cast<const char*>(p), len);
+    if(flags & FLAG_END_STREAM) {
+        s.recvEnd = true;
+        StartResponse_(s);
+        return;
+    }
+    s.recvUnacked += frameLen;
+    if(s.recvUnacked >= DEFAULT_WINDOW / 2) {
+        WriteWindowUpdate_(id, s.recvUnacked);
+        s.recvWindow += s.recvUnacked;
+        s.recvUnacked = 0;
+    }
+}
+
+void Http2Conn::OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len) {
+    if(id == 0 || id % 2 == 0 || !StripPadding_(flags, p, len)) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    if(flags & FLAG_PRIORITY) {
+        if(len < 5) {
+            ConnError_(ERR_PROTOCOL);
+            return;
+        }
+        p += 5;
+        len -= 5;
+    }
+    if(!streams_.count(id)) {
+        if(id <= lastStreamId_) {               // 已关闭的流
+            ConnError_(ERR_STREAM_CLOSED);
+            return;
+        }
+        lastStreamId_ = id;
+    }
+    headerBlock_.assign(reinterpret_cast<const char*>(p), len);
+    headerStream_ = id;
+    headerEndStream_ = flags & FLAG_END_STREAM;
+    if(flags & FLAG_END_HEADERS) EndHeaders_();
+}
+
+/* 被拒绝或被重置的流的头部块也要解码 保持动态表与对端一致 */
+void Http2Conn::EndHeaders_() {
+    uint32_t id = headerStream_;
+    headerStream_ = 0;
+    HpackDecoder::HeaderList headers;
+    if(!decoder_.Decode(reinterpret_cast<const uint8_t*>(headerBlock_.data()), headerBlock_.size(), headers)) {
+        ConnError_(ERR_COMPRESSION);
+        return;
+    }
+    auto it = streams_.find(id);
+    if(it != streams_.end()) {                  // 请求体之后的尾部字段 忽略其内容
+        Stream& s = it->second;
+        if(s.recvEnd || !headerEndStream_) {
+            if(!s.tooLarge) ResetStream_(id, ERR_PROTOCOL);
+            return;
+        }
+        s.recvEnd = true;
+        StartResponse_(s);
+        return;
+    }
+    if(goawayRecv_ || streams_.size() >= MAX_CONCURRENT_STREAMS) {
+        ResetStream_(id, ERR_REFUSED_STREAM);
+        return;
+    }
+    Stream& s = streams_[id];
+    s = Stream();
+    s.id = id;
+    s.headers.swap(headers);
+    s.sendWindow = peerInitWindow_;
+    s.recvWindow = DEFAULT_WINDOW;
+    s.recvEnd = headerEndStream_;
+    if(s.recvEnd) StartResponse_(s);
+}
+
+void Http2Conn::OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len) {
+    if(id != 0) {
+        ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    if(flags & FLAG_ACK) {
+        if(len != 0) ConnError_(ERR_FRAME_SIZE);
+        return;
+    }
+    if(len % 6 != 0) {
+        ConnError_(ERR_FRAME_SIZE);
+        return;
+    }
+    if(ERROR_CODE err = ApplySettings_(p, len)) {
+        ConnError_(err);
+        return;
+    }
+    settingsOk_ = true;
+    WriteFrameHeader_(ctrl_, 0, FRAME_SETTINGS, FLAG_ACK, 0);
+}
+
+/* 初始窗口的变化按差值作用于所有已打开的流 编码不用动态表 头部表大小和并发数与本端无关 */
+Http2Conn::ERROR_CODE Http2Conn::ApplySettings_(const uint8_t* p, size_t len) {
+    if(len % 6 != 0) return ERR_FRAME_SIZE;
+    for(; len >= 6; p += 6, len -= 6) {
+        uint32_t value = Read32(p + 2);
+        switch(p[0] << 8 | p[1]) {
+        case SETTINGS_ENABLE_PUSH:
+            if(value > 1) return ERR_PROTOCOL;
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+            if(value > MAX_WINDOW) return ERR_FLOW_CONTROL;
+            for(auto& it: streams_) {
+                it.second.sendWindow += static_cast<int64_t>(value) - peerInitWindow_;
+                if(it.second.sendWindow > MAX_WINDOW) return ERR_FLOW_CONTROL;
+            }
+            peerInitWindow_ = value;
+            break;
+        case SETTINGS_MAX_FRAME_SIZE:
+            if(value < MAX_FRAME || value > 0xffffff) return ERR_PROTOCOL;
+            peerMaxFrame_ = value;
+            break;
+        default: break;
+        }
+    }
+    return ERR_NONE;
+}
+
+void Http2Conn::OnWindowUpdate_(uint32_t id, const uint8_t* p, uint32_t len) {
+    if(len != 4) {
+        ConnError_(ERR_FRAME_SIZE);
+        return;
+    }
+    uint32_t inc = Read32(p) & 0x7fffffff;
+    if(id == 0) {
+        sendWindow_ += inc;
+        if(inc == 0) ConnError_(ERR_PROTOCOL);
+        else if(sendWindow_ > MAX_WINDOW) ConnError_(ERR_FLOW_CONTROL);
+        return;
+    }
+    auto it = streams_.find(id);
+    if(it == streams_.end()) {
+        if(id > lastStreamId_) ConnError_(ERR_PROTOCOL);
+        return;
+    }
+    it->second.sendWindow += inc;
+    if(inc == 0) ResetStream_(id, ERR_PROTOCOL);
+    else if(it->second.sendWindow > MAX_WINDOW) ResetStream_(id, ERR_FLOW_CONTROL);
+}
+
+void Http2Conn::OnRstStream_(uint32_t id, uint32_t len) {
+    if(id == 0 || id > lastStreamId_) {
+        ConnError_(ERR_PROTOCOL);
+    } else if(len != 4) {
+        ConnError_(ERR_FRAME_SIZE);
+    } else {
+        CloseStream_(id);
+    }
+}
+
+void Http2Conn::StartResponse_(Stream& s) {
+    if(s.tooLarge) {
+        Respond_(s, request_, HttpRequest::TOO_LARGE_REQUEST);
+        return;
+    }
+    if(!BuildRequest_(s)) {
+        ResetStream_(s.id, ERR_PROTOCOL);
+        return;
+    }
+    request_.Init();
+    HttpRequest::HTTP_CODE ret = request_.parse(reqBuff_);
+    reqBuff_.RetrieveAll();
+    Respond_(s, request_, ret == HttpRequest::NO_REQUEST ? HttpRequest::BAD_REQUEST : ret);
+}
+
+/* 伪头部须在普通头部之前 :method和:path必须有 字段名须为小写 值中不能有CR LF NUL
+   多个cookie字段按"; "合并 请求体的长度以实际收到的为准 */
+bool Http2Conn::BuildRequest_(Stream& s) {
+    const string* method = nullptr;
+    const string* path = nullptr;
+    const string* authority = nullptr;
+    string cookie;
+    bool regular = false;
+    for(auto& field: s.headers) {
+        const string& name = field.first;
+        const string& value = field.second;
+        if(name.empty() || value.find_first_of(string("\r\n\0", 3)) != string::npos) return false;
+        for(char ch: name) {
+            if((ch >= 'A' && ch <= 'Z') || ch == '\r' || ch == '\n' || ch == '\0') return false;
+        }
+        if(name[0] == ':') {
+            if(regular) return false;
+            if(name == ":method") method = &value;
+            else if(name == ":path") path = &value;
+            else if(name == ":authority") authority = &value;
+            else if(name != ":scheme") return false;
+            continue;
+        }
+        regular = true;
+        if(IsConnectionHeader(name) || (name == "te" && value != "trailers")) return false;
+        if(name == "cookie") {
+            if(!cookie.empty()) cookie += "; ";
+            cookie += value;
+        }
+    }
+    if(!method || !path || path->empty()) return false;
+    s.headOnly = *method == "HEAD";
+
+    reqBuff_.RetrieveAll();
+    reqBuff_.Append(*method + " " + *path + " HTTP/1.1\r\n");
+    if(authority && !authority->empty()) {
+        reqBuff_.Append("Host: " + *authority + "\r\n");
+    }
+    for(auto& field: s.headers) {
+        const string& name = field.first;
+        if(name[0] == ':' || name == "cookie" || name == "content-length" || name == "te"
+           || (authority && name == "host")) continue;
+        reqBuff_.Append(name + ": " + field.second + "\r\n");
+    }
+    if(!cookie.empty()) {
+        reqBuff_.Append("Cookie: " + cookie + "\r\n");
+    }
+    if(!s.body.empty()) {
+        reqBuff_.Append("Content-Length: " + to_string(s.body.size()) + "\r\n");
+    }
+    reqBuff_.Append("\r\n", 2);
+    reqBuff_.Append(s.body);
+    s.headers.clear();
+    s.body.clear();
+    return true;
+}
+
+/* 状态码和响应体同HTTP/1.1 响应头有:status content-type content-length 文件的etag last-modified cache-control
+   和压缩时的content-encoding vary 304没有响应体 只带验证和缓存的头部 */
+void Http2Conn::Respond_(Stream& s, HttpRequest& request, HttpRequest::HTTP_CODE ret) {
+    int code = ret == HttpRequest::GET_REQUEST ? 200 : (ret == HttpRequest::TOO_LARGE_REQUEST ? 413 : 400);
+    LOG_DEBUG("h2 stream %u: %s", s.id, request.path().c_str());
+    response_.Init(srcDir_, request.path(), true, code);
+    response_.SetAcceptEncoding(request.GetHeader(HttpRequest::HDR_ACCEPT_ENCODING));
+    if(s.headOnly || request.method() == "GET") {
+        response_.SetConditional(request.GetHeader(HttpRequest::HDR_IF_NONE_MATCH),
+                                 request.GetHeader(HttpRequest::HDR_IF_MODIFIED_SINCE));
+    }
+    s.content.clear();
+    response_.MakeBody(s.content);
+    bool notModified = response_.Code() == 304;
+
+    block_.RetrieveAll();
+    HpackEncoder::EncodeStatus(block_, response_.Code());
+    const FileCache::File* file = response_.FileInfo();
+    if(file && (response_.Code() == 200 || notModified)) {
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_ETAG, file->etag);
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_LAST_MODIFIED, file->lastModified);
+        const string* cacheControl = response_.CacheControl();
+        if(cacheControl) {
+            HpackEncoder::EncodeField(block_, HpackEncoder::IDX_CACHE_CONTROL, *cacheControl);
+        }
+    }
+    s.file = notModified ? nullptr : response_.ReleaseFile();
+    s.bodyLen = s.file ? s.file->size : s.content.size();
+    s.sent = 0;
+    if(!notModified) {
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_CONTENT_TYPE, response_.ContentType());
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_CONTENT_LENGTH, to_string(s.bodyLen));
+    }
+    if(response_.ContentEncoding() && !notModified) {
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_CONTENT_ENCODING, response_.ContentEncoding());
+    }
+    if(response_.Vary()) {
+        HpackEncoder::EncodeField(block_, HpackEncoder::IDX_VARY, "accept-encoding");
+    }
+    bool end = s.headOnly || s.bodyLen == 0;
+    WriteFrameHeader_(ctrl_, block_.ReadableBytes(), FRAME_HEADERS, FLAG_END_HEADERS | (end ? FLAG_END_STREAM : 0), s.id);
+    ctrl_.Append(block_.Peek(), block_.ReadableBytes());
+    s.responded = true;
+    responded_++;
+    if(end) {
+        uint32_t id = s.id;
+        if(!s.recvEnd || s.tooLarge) ResetStream_(id, ERR_NONE);
+        else CloseStream_(id);
+    }
+}
+
+int Http2Conn::Flush(Buffer& out, size_t limit) {
+    size_t start = out.ReadableBytes();
+    out.Append(ctrl_.Peek(), ctrl_.ReadableBytes());
+    ctrl_.RetrieveAll();
+    while(sendWindow_ > 0 && out.ReadableBytes() - start < limit) {
+        // 从上次发送的流之后开始轮转
+        auto it = streams_.upper_bound(rrLast_);
+        bool found = false;
+        for(size_t i = 0; i < streams_.size(); i++, ++it) {
+            if(it == streams_.end()) it = streams_.begin();
+            if(Sendable_(it->second)) {
+                found = true;
+                break;
+            }
+        }
+        if(!found) break;
+        rrLast_ = it->first;
+        SendData_(it->second, out);
+    }
+    int n = responded_;
+    responded_ = 0;
+    return n;
+}
+
+bool Http2Conn::WantWrite() const {
+    if(ctrl_.ReadableBytes() > 0) return true;
+    if(sendWindow_ <= 0) return false;
+    for(auto& it: streams_) {
+        if(Sendable_(it.second)) return true;
+    }
+    return false;
+}
+
+void Http2Conn::SendData_(Stream& s, Buffer& out) {
+    int64_t n = s.bodyLen - s.sent;
+    n = min(n, static_cast<int64_t>(peerMaxFrame_));
+    n = min(n, s.sendWindow);
+    n = min(n, sendWindow_);
+    bool end = s.sent + n == s.bodyLen;
+    WriteFrameHeader_(out, n, FRAME_DATA, end ? FLAG_END_STREAM : 0, s.id);
+    out.Append((s.file ? s.file->data : s.content.data()) + s.sent, n);
+    s.sent += n;
+    s.sendWindow -= n;
+    sendWindow_ -= n;
+    if(end) {
+        // 请求还没收完(如请求体超限)时以NO_ERROR重置 让对端停止发送
+        if(!s.recvEnd || s.tooLarge) ResetStream_(s.id, ERR_NONE);
+        else CloseStream_(s.id);
+    }
+}
+
+void Http2Conn::CloseStream_(uint32_t id) {
+    auto it = streams_.find(id);
+    if(it == streams_.end()) return;
+    streams_.erase(it);
+}
+
+void Http2Conn::ResetStream_(uint32_t id, ERROR_CODE code) {
+    uint8_t payload[4];
+    Write32(payload, code);
+    WriteFrameHeader_(ctrl_, 4, FRAME_RST_STREAM, 0, id);
+    ctrl_.Append(payload, 4);
+    CloseStream_(id);
+}
+
+/* 连接错误: 丢弃所有流 GOAWAY发出后连接关闭 */
+void Http2Conn::ConnError_(ERROR_CODE code) {
+    if(goawaySent_) return;
+    LOG_WARN("h2 connection error %d", code);
+    while(!streams_.empty()) {
+        CloseStream_(streams_.begin()->first);
+    }
+    uint8_t payload[8];
+    Write32(payload, lastStreamId_);
+    Write32(payload + 4, code);
+    WriteFrameHeader_(ctrl_, 8, FRAME_GOAWAY, 0, 0);
+    ctrl_.Append(payload, 8);
+    goawaySent_ = true;
+}
+
+void Http2Conn::WriteFrameHeader_(Buffer& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t id) {
+    uint8_t head[9] = {static_cast<uint8_t>(len >> 16), static_cast<uint8_t>(len >> 8),
+                       static_cast<uint8_t>(len), type, flags};
+    Write32(head + 5, id);
+    out.Append(head, 9);
+}
+
+void Http2Conn::WriteWindowUpdate_(uint32_t id, uint32_t inc) {
+    uint8_t payload[4];
+    Write32(payload, inc);
+    WriteFrameHeader_(ctrl_, 4, FRAME_WINDOW_UPDATE, 0, id);
+    ctrl_.Append(payload, 4);
+}
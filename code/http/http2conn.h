@@ -0,0 +1,161 @@
+#ifndef HTTP2CONN_H
+#define HTTP2CONN_H
+
+#include <map>
+#include <string>
+#include <stdint.h>
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "strview.h"
+#include "hpack.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+
+/* 明文HTTP/2(h2c)的连接状态机 不直接读写套接字: HttpConn把读缓冲区交给Feed 把Flush生成的帧放进写缓冲区
+   两种进入方式: 连接一开始就是客户端序言(prior knowledge) 或HTTP/1.1请求带Upgrade: h2c 回101后该请求作为流1
+   请求头部经HPACK解码后拼回HTTP/1.1请求交给HttpRequest解析 路径改写、登录等与HTTP/1.1相同
+   响应同样由HttpResponse确定状态码并映射文件 HEADERS帧随即排队 文件内容按流控窗口切成DATA帧
+   多个流的DATA帧轮流发出 每轮每个流一帧 大文件不会挡住同一连接上的其他流
+   只实现服务器一侧: 不推送 忽略优先级 请求体放在内存中 上限同HttpRequest */
+class Http2Conn {
+public:
+    enum FRAME_TYPE {
+        FRAME_DATA = 0,
+        FRAME_HEADERS,
+        FRAME_PRIORITY,
+        FRAME_RST_STREAM,
+        FRAME_SETTINGS,
+        FRAME_PUSH_PROMISE,
+        FRAME_PING,
+        FRAME_GOAWAY,
+        FRAME_WINDOW_UPDATE,
+        FRAME_CONTINUATION,
+    };
+
+    enum FRAME_FLAG {
+        FLAG_END_STREAM = 0x1,
+        FLAG_ACK = 0x1,
+        FLAG_END_HEADERS = 0x4,
+        FLAG_PADDED = 0x8,
+        FLAG_PRIORITY = 0x20,
+    };
+
+    enum SETTING {
+        SETTINGS_HEADER_TABLE_SIZE = 1,
+        SETTINGS_ENABLE_PUSH,
+        SETTINGS_MAX_CONCURRENT_STREAMS,
+        SETTINGS_INITIAL_WINDOW_SIZE,
+        SETTINGS_MAX_FRAME_SIZE,
+        SETTINGS_MAX_HEADER_LIST_SIZE,
+    };
+
+    enum ERROR_CODE {
+        ERR_NONE = 0,
+        ERR_PROTOCOL,
+        ERR_INTERNAL,
+        ERR_FLOW_CONTROL,
+        ERR_SETTINGS_TIMEOUT,
+        ERR_STREAM_CLOSED,
+        ERR_FRAME_SIZE,
+        ERR_REFUSED_STREAM,
+        ERR_CANCEL,
+        ERR_COMPRESSION,
+        ERR_CONNECT,
+        ERR_ENHANCE_YOUR_CALM,
+    };
+
+    explicit Http2Conn(const char* srcDir);
+    ~Http2Conn();
+
+    /* [p, p + len)与客户端序言比较 1 完整匹配 0 目前的数据是序言的前缀 需等更多数据 -1 不是HTTP/2 */
+    static int MatchPreface(const char* p, size_t len);
+    // HTTP2-Settings头部的值(base64url编码的SETTINGS载荷) 格式错误返回false 此时不应升级
+    static bool DecodeSettings(StrView value, std::string& payload);
+
+    // 已回101 request作为流1 payload为DecodeSettings的结果 对端仍需发送客户端序言
+    void Upgrade(HttpRequest& request, const std::string& payload);
+    void Feed(Buffer& in);                      // 处理缓冲区中所有完整的帧 取走处理过的数据
+    int Flush(Buffer& out, size_t limit);       // 生成待发的帧 DATA帧累计到limit字节左右为止 返回新开始的响应数
+    bool WantWrite() const;                     // 还有现在就能发出的帧
+    bool IsClosed() const {                     // 已发GOAWAY 或对端发GOAWAY后所有流都已结束
+        return goawaySent_ || (goawayRecv_ && streams_.empty());
+    }
+
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100;
+    static const uint32_t DEFAULT_WINDOW = 65535;
+    static const uint32_t MAX_FRAME = 16384;    // 本端接收的帧载荷上限 使用协议默认值
+    static const uint32_t MAX_WINDOW = 0x7fffffff;
+    static const size_t MAX_HEADER_BLOCK = 65536;
+
+private:
+    struct Stream {
+        uint32_t id;
+        bool recvEnd;                           // 对端已发END_STREAM 或请求体超限不再接收
+        bool responded;                         // 响应HEADERS已排队
+        bool headOnly;                          // HEAD请求 不发响应体
+        bool tooLarge;                          // 请求体超过上限
+        HpackDecoder::HeaderList headers;
+        std::string body;                       // 请求体
+        int64_t sendWindow;                     // 可以发给对端的字节数 对端改初始窗口时可能为负
+        int64_t recvWindow;
+        uint32_t recvUnacked;                   // 已收到 还未用WINDOW_UPDATE归还的字节数
+        FileCache::FilePtr file;                // 响应体的文件
+        std::string content;                    // 不在文件中的响应体(错误页面)
+        size_t bodyLen;
+        size_t sent;                            // 已发出的响应体字节数
+    };
+
+    void OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    void OnData_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    void OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    void OnSettings_(uint8_t flags, uint32_t id, const uint8_t* p, uint32_t len);
+    void OnWindowUpdate_(uint32_t id, const uint8_t* p, uint32_t len);
+    void OnRstStream_(uint32_t id, uint32_t len);
+    void EndHeaders_();                         // 头部块完整 解码并开始或结束流
+    ERROR_CODE ApplySettings_(const uint8_t* p, size_t len);
+    bool StripPadding_(uint8_t flags, const uint8_t*& p, uint32_t& len);
+
+    void StartResponse_(Stream& s);             // 请求完整(或请求体超限)
+    bool BuildRequest_(Stream& s);              // 把请求拼回HTTP/1.1放入reqBuff_ 不合法的请求返回false
+    void Respond_(Stream& s, HttpRequest& request, HttpRequest::HTTP_CODE ret);
+    bool Sendable_(const Stream& s) const {
+        return s.responded && s.sent < s.bodyLen && s.sendWindow > 0;
+    }
+    void SendData_(Stream& s, Buffer& out);     // 发出一个DATA帧 响应发完时结束流
+    void CloseStream_(uint32_t id);             // 释放文件映射并删除
+    void ResetStream_(uint32_t id, ERROR_CODE code);
+    void ConnError_(ERROR_CODE code);           // 发GOAWAY 之后不再处理输入
+
+    static void WriteFrameHeader_(Buffer& out, uint32_t len, uint8_t type, uint8_t flags, uint32_t id);
+    void WriteWindowUpdate_(uint32_t id, uint32_t inc);
+
+    const char* srcDir_;
+    bool prefaceOk_;                            // 已收到客户端序言
+    bool settingsOk_;                           // 已收到对端第一个SETTINGS
+    bool goawaySent_, goawayRecv_;
+    uint32_t lastStreamId_;                     // 对端开过的最大流id
+    uint32_t rrLast_;                           // 上一个发DATA帧的流 下一帧从它之后的流开始找
+
+    // 对端的设置和连接级的窗口
+    int64_t peerInitWindow_;
+    uint32_t peerMaxFrame_;
+    int64_t sendWindow_;
+    int64_t recvWindow_;
+    uint32_t recvUnacked_;
+
+    uint32_t headerStream_;                     // 正在接收CONTINUATION的流 0为没有
+    bool headerEndStream_;
+    std::string headerBlock_;
+
+    std::map<uint32_t, Stream> streams_;
+    int responded_;                             // 上次Flush之后新开始的响应数
+    Buffer ctrl_;                               // 排队中的控制帧和HEADERS帧 先于DATA帧发出
+    Buffer block_;                              // 编码响应头用
+    Buffer reqBuff_;                            // 拼回的HTTP/1.1请求
+    HpackDecoder decoder_;
+    HttpRequest request_;
+    HttpResponse response_;
+};
+
+#endif
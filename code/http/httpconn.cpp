@@ -4,34 +4,51 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+size_t HttpConn::sendfileMin = FileCache::SENDFILE_MIN;
 
 HttpConn::HttpConn(){
     fd_ = -1;
     addr_ = {0};
     isClose_ = true;
+    readPaused_ = false;
+    iovCnt_ = iovIdx_ = fileCnt_ = 0;
+    toWrite_ = 0;
+    isKeepAlive_ = false;
+    fresh_ = true;
+    sendfile_ = true;
 }
 
 HttpConn::~HttpConn(){
     Close();
 }
 
-void HttpConn::init(int fd, const sockaddr_in& addr){
+void HttpConn::init(int fd, const sockaddr_in& addr, bool sendfile){
     assert(fd > 0);
     userCount++;
     addr_ = addr;
     fd_ = fd;
+    sendfile_ = sendfile;
+    ClearWritten_();                        // 槽位复用 清掉上个连接未写完的响应
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
+    request_.Init();                        // 丢弃上个连接解析到一半的请求
+    readPaused_ = false;
+    isKeepAlive_ = false;
+    fresh_ = true;
+    h2_.reset();
     isClose_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
-void HttpConn::Close(){
-    response_.UnmapFile();
+void HttpConn::Close(bool closeFd){
+    response_.ReleaseFile();
+    ClearWritten_();
+    request_.Init();                        // 释放没收完的请求体的接收者(如上传的临时文件)
+    h2_.reset();
     if(isClose_ == false){
         isClose_ = true;
         userCount--;
-        close(fd_);
+        if(closeFd) close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
     }
 }
@@ -55,9 +72,20 @@ int HttpConn::GetPort() const{
 
 ssize_t HttpConn::read(int* saveErrno){
     ssize_t len = -1;
+    readPaused_ = false;
     do{
-        len = readBuff_.ReadFd(fd_, saveErrno);
+        size_t readable = readBuff_.ReadableBytes();
+        if(readable >= READ_HIGH_WATER){
+            readPaused_ = isET;         // 上次读入的还没处理完 当作暂时没有数据
+            *saveErrno = EAGAIN;
+            return -1;
+        }
+        len = readBuff_.ReadFd(fd_, saveErrno, READ_HIGH_WATER - readable);
         if(len <= 0) break;
+        if(isET && readBuff_.ReadableBytes() >= READ_HIGH_WATER){
+            readPaused_ = true;         // 还没读到EAGAIN 先处理已读入的
+            break;
+        }
     }while(isET);       // ET边缘触发要一次性读出
     return len;
 }
@@ -66,50 +94,215 @@ ssize_t HttpConn::read(int* saveErrno){
 ssize_t HttpConn::write(int* saveErrno){
     ssize_t len = -1;
     do {
-        len = writev(fd_, iov_, iovCnt_);        // 将iov的内容写到fd中
+        len = WriteOnce_();                     // 将iov的内容写到fd中
         if(len <= 0){
             *saveErrno = errno;
             break;
         }
-        if(iov_[0].iov_len + iov_[1].iov_len == 0) break;       // 传输结束
-        // 由于writev不会对成员做任何处理 需要手动处理了iov中的指针和长度
-        else if(static_cast<size_t>(len) > iov_[0].iov_len){    // 读取的数据长度大于写缓冲区的长度 说明也从响应消息的文件里读取了
-            iov_[1].iov_base = (uint8_t*)iov_[1].iov_base + (len - iov_[0].iov_len);    // 更新iov_[1]
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if(iov_[0].iov_len){            // 写缓冲区还有数据
-                writeBuff_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        }else{                                                  // 只从缓冲区内读取了
-            iov_[0].iov_base = (uint8_t*)iov_[0].iov_base + len;
-            iov_[0].iov_len -= len;
-            writeBuff_.Retrieve(len);
-        }
+        RetrieveWritten(len);
+        if(toWrite_ == 0) break;                // 传输结束
     }while(isET || ToWriteBytes() > 10240);
     return len;
 }
 
-bool HttpConn::process() {
-    request_.Init();
-    if(readBuff_.ReadableBytes() <= 0) return false;
-    else if(request_.parse(readBuff_)){         // 从读缓冲区匹配request
-        LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
-    }else{
-        response_.Init(srcDir, request_.path(), false, 400);
+/* 后面是sendfile的项时 内存项带MSG_MORE发出 响应头留在套接字中等文件内容一起组成报文
+   sendfile在内核中从页缓存直接发往套接字 不映射到用户空间 也不复制 */
+ssize_t HttpConn::WriteOnce_(){
+    int i = iovIdx_;
+    if(iovFd_[i] >= 0){
+        off_t off = iovOff_[i];
+        return sendfile(fd_, iovFd_[i], &off, iov_[i].iov_len);
+    }
+    int end = i;
+    while(end < iovCnt_ && iovFd_[end] < 0) end++;
+    if(end == iovCnt_){
+        return writev(fd_, iov_ + i, end - i);
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov_ + i;
+    msg.msg_iovlen = end - i;
+    return sendmsg(fd_, &msg, MSG_MORE);
+}
+
+// 由于writev不会对成员做任何处理 需要手动处理了iov中的指针和长度
+void HttpConn::RetrieveWritten(size_t len){
+    assert(len <= toWrite_);
+    toWrite_ -= len;
+    while(len > 0){
+        struct iovec& iov = iov_[iovIdx_];
+        if(len < iov.iov_len){          // 这一项只写了一部分
+            if(iovFd_[iovIdx_] >= 0){
+                iovOff_[iovIdx_] += len;
+            }else{
+                iov.iov_base = (uint8_t*)iov.iov_base + len;
+            }
+            iov.iov_len -= len;
+            break;
+        }
+        len -= iov.iov_len;
+        iov.iov_len = 0;
+        iovIdx_++;
+    }
+    while(iovIdx_ < iovCnt_ && iov_[iovIdx_].iov_len == 0) iovIdx_++;
+}
+
+void HttpConn::ClearWritten_(){
+    for(int i = 0; i < fileCnt_; i++){
+        files_[i].reset();
     }
+    fileCnt_ = 0;
+    iovCnt_ = iovIdx_ = 0;
+    toWrite_ = 0;
+    writeBuff_.Retrieve(writeBuff_.ReadableBytes());
+}
+
+bool HttpConn::MayBlock() const{
+    // 只有POST会走到UserVerify访问数据库或写上传的文件 静态文件请求只有stat/open/mmap
+    // HTTP/2的帧里不便预判 其上的登录请求在当前通道处理
+    if(h2_) return false;
+    // 头部已解析并从读缓冲区取走 请求体的后续数据(表单或上传)不再以"POST"开头
+    if(request_.IsReadingBody()) return true;
+    return readBuff_.ReadableBytes() >= 4 && memcmp(readBuff_.Peek(), "POST", 4) == 0;
+}
 
-    response_.MakeResponse(writeBuff_);         // 从写缓冲区构造响应消息
-    // 响应头
+void HttpConn::AppendRead(const char* data, size_t len){
+    readBuff_.Append(data, len);
+}
+
+/* 流水线: 依次处理读缓冲区中的完整请求 响应按请求顺序排入iov 由一次写一起发出
+   遇到不保持连接的请求就停止 之后的请求不再处理 下一个请求可能阻塞时也先停下 由调用者决定交给哪个通道 */
+int HttpConn::process() {
+    assert(toWrite_ == 0);
+    ClearWritten_();
+    if(!h2_ && fresh_) {
+        int m = Http2Conn::MatchPreface(readBuff_.Peek(), readBuff_.ReadableBytes());
+        if(m == 0) return 0;                    // 可能是序言的前一部分
+        if(m > 0) h2_.reset(new Http2Conn(srcDir));
+    }
+    if(h2_) return ProcessH2_();
+    fresh_ = false;
+    struct Piece {
+        size_t headEnd;                 // 写缓冲区中上一段之后到headEnd为止的内容
+        const char* file;               // 之后发送的文件内容[offset, offset + fileLen) 没有时fileLen为0
+        int fd;                         // 用sendfile发送时为文件的fd 否则为-1
+        size_t offset;
+        size_t fileLen;
+    };
+    Piece pieces[MAX_PIECES];
+    int pieceCnt = 0, cnt = 0;
+    while(cnt < MAX_PIPELINE && pieceCnt + HttpResponse::MAX_RANGES + 1 <= MAX_PIECES
+          && readBuff_.ReadableBytes() > 0 && !(cnt > 0 && MayBlock())) {
+        HttpRequest::HTTP_CODE ret = request_.parse(readBuff_);     // 从读缓冲区匹配request
+        if(ret == HttpRequest::NO_REQUEST){                         // 请求不完整 等待更多数据
+            if(request_.TakeContinue()){
+                // 客户端在等待 先回100 作为一个没有文件的响应 最终的响应在请求体收完后
+                writeBuff_.Append("HTTP/1.1 100 Continue\r\n\r\n");
+                pieces[pieceCnt++] = {writeBuff_.ReadableBytes(), nullptr, -1, 0, 0};
+                cnt++;
+                isKeepAlive_ = true;
+            }
+            break;
+        }
+        if(ret == HttpRequest::GET_REQUEST && UpgradeH2_()){
+            // 101和HTTP/2的帧作为一个没有文件的响应 之后的数据都按HTTP/2处理
+            pieces[pieceCnt++] = {writeBuff_.ReadableBytes(), nullptr, -1, 0, 0};
+            cnt++;
+            break;
+        }
+        if(ret == HttpRequest::GET_REQUEST){
+            LOG_DEBUG("%s", request_.path().c_str());
+            isKeepAlive_ = request_.IsKeepAlive();
+            response_.Init(srcDir, request_.path(), isKeepAlive_, 200);
+            response_.SetAcceptEncoding(request_.GetHeader(HttpRequest::HDR_ACCEPT_ENCODING));
+            if(request_.method() == "GET"){
+                response_.SetRange(request_.GetHeader(HttpRequest::HDR_RANGE), request_.GetHeader(HttpRequest::HDR_IF_RANGE));
+                response_.SetConditional(request_.GetHeader(HttpRequest::HDR_IF_NONE_MATCH),
+                                         request_.GetHeader(HttpRequest::HDR_IF_MODIFIED_SINCE));
+            }
+        }else{
+            isKeepAlive_ = false;
+            response_.Init(srcDir, request_.path(), false, ret == HttpRequest::TOO_LARGE_REQUEST ? 413 : 400);
+        }
+        response_.MakeResponse(writeBuff_);     // 从写缓冲区构造响应消息
+        bool hasFile = response_.SliceCount() > 0;
+        if(hasFile){
+            files_[fileCnt_] = response_.ReleaseFile();
+            const FileCache::File& file = *files_[fileCnt_++];
+            int fd = sendfile_ && file.fd >= 0 && file.size >= sendfileMin ? file.fd : -1;
+            for(int i = 0; i < response_.SliceCount(); i++){
+                const HttpResponse::Slice& slice = response_.GetSlice(i);
+                pieces[pieceCnt++] = {slice.headEnd, file.data, fd, slice.offset, slice.len};
+            }
+        }
+        if(!hasFile || pieces[pieceCnt - 1].headEnd < writeBuff_.ReadableBytes()){
+            pieces[pieceCnt++] = {writeBuff_.ReadableBytes(), nullptr, -1, 0, 0};
+        }
+        cnt++;
+        if(!isKeepAlive_) break;
+    }
+    if(cnt == 0) return 0;
+
+    // writeBuff_在追加时可能扩容搬移 全部生成后再填iov 前一段没有文件时与它的内容合并为一项
+    char* base = const_cast<char*>(writeBuff_.Peek());
+    size_t headStart = 0;
+    for(int i = 0; i < pieceCnt; i++){
+        size_t len = pieces[i].headEnd - headStart;
+        if(len > 0){
+            if(i > 0 && pieces[i - 1].fileLen == 0){
+                iov_[iovCnt_ - 1].iov_len += len;
+            }else{
+                iovFd_[iovCnt_] = -1;
+                iov_[iovCnt_].iov_base = base + headStart;
+                iov_[iovCnt_++].iov_len = len;
+            }
+        }
+        headStart = pieces[i].headEnd;
+        if(pieces[i].fileLen > 0){
+            const Piece& piece = pieces[i];
+            iovFd_[iovCnt_] = piece.fd;
+            iovOff_[iovCnt_] = piece.offset;
+            iov_[iovCnt_].iov_base = piece.fd >= 0 ? nullptr : const_cast<char*>(piece.file + piece.offset);
+            iov_[iovCnt_++].iov_len = piece.fileLen;
+        }
+    }
+    toWrite_ = 0;
+    for(int i = 0; i < iovCnt_; i++){
+        toWrite_ += iov_[i].iov_len;
+    }
+    LOG_DEBUG("%d responses, %d iov, to write %zu", cnt, iovCnt_, toWrite_);
+    return cnt;
+}
+
+/* 只升级没有请求体的请求 HTTP2-Settings不合法时按HTTP/1.1处理 */
+bool HttpConn::UpgradeH2_(){
+    StrView upgrade = request_.GetHeader(HttpRequest::HDR_UPGRADE);
+    StrView settings = request_.GetHeader(HttpRequest::HDR_HTTP2_SETTINGS);
+    std::string payload;
+    if(!upgrade.EqualsNoCase("h2c") || settings.empty() || request_.BodyBytes() > 0
+       || !Http2Conn::DecodeSettings(settings, payload)){
+        return false;
+    }
+    writeBuff_.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    h2_.reset(new Http2Conn(srcDir));
+    h2_->Upgrade(request_, payload);
+    h2_->Feed(readBuff_);
+    h2_->Flush(writeBuff_, H2_WRITE_BATCH);
+    isKeepAlive_ = !h2_->IsClosed();
+    return true;
+}
+
+/* HTTP/2: 处理读缓冲区中完整的帧 生成的帧全部在writeBuff_中 一项iov
+   只有控制帧或续发上次剩下的DATA帧时也返回1 */
+int HttpConn::ProcessH2_(){
+    h2_->Feed(readBuff_);
+    int n = h2_->Flush(writeBuff_, H2_WRITE_BATCH);
+    isKeepAlive_ = !h2_->IsClosed();
+    if(writeBuff_.ReadableBytes() == 0) return 0;
+    iovFd_[0] = -1;
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
     iov_[0].iov_len = writeBuff_.ReadableBytes();
     iovCnt_ = 1;
-    // 文件
-    if(response_.FileLen() > 0 && response_.File()){
-        iov_[1].iov_base = response_.File();
-        iov_[1].iov_len = response_.FileLen();
-        iovCnt_ = 2;
-    }
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
-}
\ No newline at end of file
+    toWrite_ = iov_[0].iov_len;
+    LOG_DEBUG("h2 %d responses, to write %zu", n, toWrite_);
+    return n > 0 ? n : 1;
+}
@@ -3,6 +3,8 @@
 
 #include <sys/types.h>
 #include <sys/uio.h>     // readv/writev
+#include <sys/socket.h>  // sendmsg
+#include <sys/sendfile.h>
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
@@ -12,32 +14,52 @@
 #include "../buffer/buffer.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "http2conn.h"
 
 class HttpConn {
 public:
     HttpConn();
     ~HttpConn();
 
-    void init(int sockFd, const sockaddr_in& addr);
+    void init(int sockFd, const sockaddr_in& addr, bool sendfile = true);     // sendfile为false时只用iov(如io_uring的writev)
     ssize_t read(int* saveErrno);
     ssize_t write(int* saveErrno);
-    void Close();
+    void Close(bool closeFd = true);    // closeFd为false时由调用者负责关闭fd(如io_uring的close SQE)
     
     int GetFd() const;
     int GetPort() const;
     const char* GetIP() const;
     sockaddr_in GetAddr() const;
 
-    bool process();
-    int ToWriteBytes(){
-        return iov_[0].iov_len + iov_[1].iov_len;
+    int process();                                  // 处理读缓冲区中所有完整的请求 返回生成的响应数 0表示请求不完整(HTTP/2为没有可发的帧)
+    void AppendRead(const char* data, size_t len);  // 完成式IO 将已收到的数据放入读缓冲区
+    const struct iovec* Iov() const { return iov_ + iovIdx_; }
+    int IovCnt() const { return iovCnt_ - iovIdx_; }
+    void RetrieveWritten(size_t len);               // 已写出len字节 调整iov
+    bool IsClose() const { return isClose_; }
+    bool ReadPaused() const { return readPaused_; }     // 上次read因读缓冲区到上限而停下 套接字中可能还有数据
+    bool MayBlock() const;                          // 已读入的请求可能阻塞(POST登录/注册需访问数据库 上传需写磁盘)
+    // 读缓冲区中还有未处理的数据 或HTTP/2连接还有能发的帧
+    bool HasBuffered() const { return readBuff_.ReadableBytes() > 0 || (h2_ && h2_->WantWrite()); }
+
+    size_t ToWriteBytes() const {
+        return toWrite_;
     }
 
     bool IsKeepAlive() const{
-        return request_.IsKeepAlive();
+        return isKeepAlive_;
     }
 
+    static const int MAX_PIPELINE = 16;             // 一次process最多生成的响应数
+    // 一次process的响应各由几段组成: 写缓冲区中的一段内容之后可接文件的一段 普通响应一段 多个范围的响应每个范围一段再加结尾
+    static const int MAX_PIECES = MAX_PIPELINE + HttpResponse::MAX_RANGES;
+    static const size_t H2_WRITE_BATCH = 65536;     // HTTP/2一次process生成的DATA帧 与常见的套接字发送缓冲区相当
+    /* 读缓冲区中未处理的数据不超过这么多 ET模式一次read读到此为止 处理完再读 每个连接的内存有上界
+       单次注册(EPOLLONESHOT)时重新注册EPOLLIN会因剩余数据立即触发 常驻注册时由调用者根据ReadPaused继续读 */
+    static const size_t READ_HIGH_WATER = 256 * 1024;
+
     static bool isET;
+    static size_t sendfileMin;                      // 不小于此大小且缓存中保持打开的文件用sendfile发送 SIZE_MAX为不用
     static const char* srcDir;
     static std::atomic<int> userCount;
 
@@ -47,9 +69,29 @@ private:
                                 // 16bit TCP/UDP port number
                                 // 32bit IP address        
     bool isClose_;
+    bool readPaused_;
+
+    /* 流水线的多个响应按顺序排在iov中 响应头都在writeBuff_里 文件中要发送的每一段各占一项
+       [iovIdx_, iovCnt_)为未写完的部分 文件缓存的引用在这一批写完、下次process时放下
+       用sendfile发送的段iov_base为空 由iovFd_、iovOff_给出文件和偏移 之前的内存项用MSG_MORE发出 与文件内容拼成满的报文 */
+    int iovCnt_;                                // iov个数
+    int iovIdx_;                                // 第一个未写完的iov
+    size_t toWrite_;                            // 剩余待写字节数
+    struct iovec iov_[2 * MAX_PIECES];          // 用于聚集写
+    int iovFd_[2 * MAX_PIECES];                 // sendfile的文件 内存项为-1
+    off_t iovOff_[2 * MAX_PIECES];              // sendfile下一次的文件偏移
+    bool sendfile_;
+    FileCache::FilePtr files_[MAX_PIPELINE];
+    int fileCnt_;
+    bool isKeepAlive_;                          // 最后一个响应是否保持连接
+
+    void ClearWritten_();                       // 丢弃上一批响应 放下文件
+    ssize_t WriteOnce_();                       // 从第一个未写完的项起 一次sendmsg/writev或sendfile
+    bool UpgradeH2_();                          // 刚解析的请求要求升级到h2c时回101并切换 返回是否已切换
+    int ProcessH2_();
 
-    int iovCnt_;                 // iov个数
-    struct iovec iov_[2];       // 用于分散读和聚集写
+    bool fresh_;                                // 连接上还没有解析过请求 只有这时检查HTTP/2客户端序言
+    std::unique_ptr<Http2Conn> h2_;             // 切换到HTTP/2之后的连接状态
 
     Buffer readBuff_;           // 读缓冲区
     Buffer writeBuff_;          // 写缓冲区
@@ -1,176 +1,490 @@
 #include "httprequest.h"
+#include "router.h"
+#include "upload.h"
 using namespace std;
 
-const unordered_set<string> HttpRequest::DEFAULT_HTML{
-            "/index", "/register", "/login",
-             "/welcome", "/video", "/picture", };
+namespace {
 
-const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
-            {"/register.html", 0}, {"/login.html", 1},  };
+const char* const HEADER_NAMES[HttpRequest::HDR_COUNT] = {
+    "Accept", "Accept-Encoding", "Accept-Language", "Authorization", "Cache-Control", "Connection",
+    "Content-Encoding", "Content-Length", "Content-Type", "Cookie", "Expect", "Host", "If-Match",
+    "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since", "Origin", "Range",
+    "Referer", "Transfer-Encoding", "Upgrade", "User-Agent", "HTTP2-Settings",
+};
+
+/* 常用头部名的完美哈希: 由长度和首尾字符(|0x20转小写 token字符中只影响字母)算出槽位 常用头部两两不冲突
+   命中槽位后再比较一次名字 增删常用头部时须重新选取系数 */
+const int HEADER_SLOTS = 64;
+
+int HeaderSlot(StrView name) {
+    return (name.size() + 2 * (name[0] | 0x20) + 20 * (name[name.size() - 1] | 0x20)) & (HEADER_SLOTS - 1);
+}
+
+struct HeaderTable {
+    HeaderTable() {
+        for(int i = 0; i < HEADER_SLOTS; i++) { slots[i] = HttpRequest::HDR_COUNT; }
+        for(int i = 0; i < HttpRequest::HDR_COUNT; i++) {
+            int slot = HeaderSlot(HEADER_NAMES[i]);
+            assert(slots[slot] == HttpRequest::HDR_COUNT);
+            slots[slot] = static_cast<HttpRequest::HEADER>(i);
+        }
+    }
+    HttpRequest::HEADER slots[HEADER_SLOTS];
+};
+
+const HeaderTable HEADER_TABLE;
+
+// 逗号分隔的token列表(如Connection: keep-alive, Upgrade)中是否有token 不区分大小写 忽略两侧空白
+bool HasToken(StrView list, StrView token) {
+    const char* p = list.data();
+    const char* end = p + list.size();
+    while(p < end) {
+        const char* comma = static_cast<const char*>(memchr(p, ',', end - p));
+        const char* q = comma ? comma : end;
+        while(p < q && (*p == ' ' || *p == '\t')) p++;
+        const char* e = q;
+        while(e > p && (e[-1] == ' ' || e[-1] == '\t')) e--;
+        if(StrView(p, e - p).EqualsNoCase(token)) return true;
+        p = comma ? comma + 1 : end;
+    }
+    return false;
+}
+
+}
+
+static_assert(HttpRequest::HDR_COUNT <= 32, "present_ is a 32-bit mask");
 
 void HttpRequest::Init() {
-    method_ = path_ = version_ = body_ = "";
     state_ = REQUEST_LINE;
-    header_.clear();
-    post_.clear();
+    lineStart_ = scan_ = bodyLen_ = bodyBytes_ = 0;
+    base_ = nullptr;
+    method_ = version_ = Span{0, 0};
+    present_ = 0;
+    others_.clear();
+    keepAlive_ = expectContinue_ = false;
+    path_.clear();
+    head_.clear();
+    body_.clear();
+    sink_.reset();
+    form_.clear();
+    formFields_.clear();
 }
 
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
-    }
-    return false;
+    return keepAlive_;
 }
 
-bool HttpRequest::parse(Buffer& buff) {
-    const char CRLF[] = "\r\n";
-    if(buff.ReadableBytes() <= 0) {
-        return false;
+HttpRequest::HTTP_CODE HttpRequest::parse(Buffer& buff) {
+    if(state_ == FINISH) { Init(); }
+    HTTP_CODE ret = GET_REQUEST;
+    if(state_ == REQUEST_LINE || state_ == HEADERS) { ret = ParseHead_(buff); }
+    if(ret == GET_REQUEST && state_ == BODY) { ret = ParseBody_(buff); }
+    if(ret == GET_REQUEST && state_ != FINISH) { ret = ParseChunked_(buff); }
+    if(ret == NO_REQUEST) { return NO_REQUEST; }
+    if(ret == GET_REQUEST && sink_ && !sink_->OnEnd()) {
+        LOG_ERROR("Body sink failed");
+        ret = BAD_REQUEST;
+    }
+    if(ret != GET_REQUEST) {            // 出错 连接随错误响应关闭 丢弃剩余数据 接收者不调用OnEnd就析构
+        state_ = FINISH;
+        sink_.reset();
+        buff.Retrieve(buff.ReadableBytes());
+        return ret;
     }
-    while(buff.ReadableBytes() && state_ != FINISH) {
-        const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
-        std::string line(buff.Peek(), lineEnd);
-        switch(state_)
-        {
-        case REQUEST_LINE:
-            if(!ParseRequestLine_(line)) {
-                return false;
+    Finish_();
+    return GET_REQUEST;
+}
+
+HttpRequest::HTTP_CODE HttpRequest::ParseHead_(Buffer& buff) {
+    const char* begin = buff.Peek();
+    size_t n = buff.ReadableBytes();
+    base_ = begin;
+    while(state_ == REQUEST_LINE || state_ == HEADERS) {
+        const char* eol = CharScan::Find(begin + scan_, begin + n, CharScan::EOL);
+        if(eol == begin + n || (*eol == '\r' && eol + 1 == begin + n)) {
+            scan_ = eol - begin;        // 行尾未到 或CR后的LF未到
+            if(n > MAX_HEAD_BYTES) {
+                LOG_ERROR("Request head too large");
+                return BAD_REQUEST;
             }
-            ParsePath_();
-            break;    
-        case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
+            return NO_REQUEST;
+        }
+        if(*eol == '\r' && eol[1] != '\n') {
+            LOG_ERROR("Bare CR in request head");
+            return BAD_REQUEST;
+        }
+        size_t end = eol - begin;
+        size_t next = end + (*eol == '\r' ? 2 : 1);
+        if(state_ == HEADERS && lineStart_ == end) { return StartBody_(buff, next); }
+        bool ok = (state_ == REQUEST_LINE) ? ParseRequestLine_(begin, lineStart_, end)
+                                           : ParseHeader_(begin, lineStart_, end);
+        if(!ok) { return BAD_REQUEST; }
+        lineStart_ = scan_ = next;
+    }
+    return GET_REQUEST;
+}
+
+// 同时有Transfer-Encoding和Content-Length的请求可能被用于请求走私 拒绝
+HttpRequest::HTTP_CODE HttpRequest::StartBody_(Buffer& buff, size_t headLen) {
+    StrView te = GetHeader(HDR_TRANSFER_ENCODING), len = GetHeader(HDR_CONTENT_LENGTH);
+    if(!te.empty()) {
+        if(!te.EqualsNoCase("chunked") || !len.empty()) {
+            LOG_ERROR("Transfer-Encoding not supported");
+            return BAD_REQUEST;
+        }
+        state_ = CHUNK_SIZE;
+    } else {
+        bodyLen_ = 0;
+        for(size_t i = 0; i < len.size(); i++) {
+            if(len[i] < '0' || len[i] > '9' || bodyLen_ > (SIZE_MAX - 9) / 10) {
+                LOG_ERROR("Content-Length Error");
+                return BAD_REQUEST;
             }
-            break;
-        case BODY:
-            ParseBody_(line);
-            break;
-        default:
-            break;
+            bodyLen_ = bodyLen_ * 10 + (len[i] - '0');
         }
-        if(lineEnd == buff.BeginWrite()) { break; }
-        buff.RetrieveUntil(lineEnd + 2);
+        state_ = bodyLen_ > 0 ? BODY : FINISH;
     }
-    LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+    if(state_ == FINISH) {
+        buff.Retrieve(headLen);
+        return GET_REQUEST;
+    }
+    // 有请求体: 头部复制出来 之后请求体的数据可以边到边从缓冲区取走
+    head_.assign(buff.Peek(), headLen);
+    base_ = head_.data();
+    buff.Retrieve(headLen);
+    lineStart_ = scan_ = 0;
+    if(sinkFactory_) {
+        sink_ = sinkFactory_(*this);
+    } else {
+        RouteMatch match;
+        if(Match_(match)) { sink_ = match.Handler().OpenBody(*this, match); }
+    }
+    if(!sink_ && state_ == BODY) {
+        if(bodyLen_ > maxBody_) {
+            LOG_WARN("Body too large: %zu", bodyLen_);
+            return TOO_LARGE_REQUEST;
+        }
+        body_.reserve(bodyLen_);
+    }
+    expectContinue_ = View_(version_) == "1.1" && GetHeader(HDR_EXPECT).EqualsNoCase("100-continue");
+    return GET_REQUEST;
 }
 
-void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; 
+HttpRequest::HTTP_CODE HttpRequest::ParseBody_(Buffer& buff) {
+    size_t take = std::min(bodyLen_, buff.ReadableBytes());
+    if(take > 0) {
+        HTTP_CODE ret = AppendBody_(buff.Peek(), take);
+        buff.Retrieve(take);
+        bodyLen_ -= take;
+        if(ret != GET_REQUEST) { return ret; }
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
+    if(bodyLen_ > 0) { return NO_REQUEST; }
+    state_ = FINISH;
+    return GET_REQUEST;
+}
+
+/* 块大小(十六进制)[;扩展] CRLF 块数据 CRLF ... 0 CRLF [尾部字段 CRLF] CRLF
+   除块数据外都按行处理 扩展和尾部字段忽略 */
+HttpRequest::HTTP_CODE HttpRequest::ParseChunked_(Buffer& buff) {
+    while(state_ != FINISH) {
+        const char* begin = buff.Peek();
+        size_t n = buff.ReadableBytes();
+        if(state_ == CHUNK_DATA) {
+            size_t take = std::min(bodyLen_, n);
+            if(take == 0) { return NO_REQUEST; }
+            HTTP_CODE ret = AppendBody_(begin, take);
+            buff.Retrieve(take);
+            if(ret != GET_REQUEST) { return ret; }
+            bodyLen_ -= take;
+            if(bodyLen_ == 0) { state_ = CHUNK_DATA_END; }
+            continue;
+        }
+        const char* eol = CharScan::Find(begin + scan_, begin + n, CharScan::EOL);
+        if(eol == begin + n || (*eol == '\r' && eol + 1 == begin + n)) {
+            scan_ = eol - begin;
+            if(n > MAX_HEAD_BYTES) {
+                LOG_ERROR("Chunk line too large");
+                return BAD_REQUEST;
             }
+            return NO_REQUEST;
         }
+        if(*eol == '\r' && eol[1] != '\n') {
+            LOG_ERROR("Bare CR in chunked body");
+            return BAD_REQUEST;
+        }
+        size_t end = eol - begin;
+        if(state_ == CHUNK_SIZE) {
+            size_t size = 0, i = 0;
+            for(; i < end && isxdigit(static_cast<unsigned char>(begin[i])); i++) {
+                if(size > (SIZE_MAX >> 4)) {
+                    LOG_ERROR("Chunk size overflow");
+                    return BAD_REQUEST;
+                }
+                size = size << 4 | ConverHex(begin[i]);
+            }
+            if(i == 0 || (i < end && begin[i] != ';' && begin[i] != ' ' && begin[i] != '\t')) {
+                LOG_ERROR("Chunk size Error");
+                return BAD_REQUEST;
+            }
+            bodyLen_ = size;
+            state_ = size > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+        } else if(state_ == CHUNK_DATA_END) {
+            if(end != 0) {
+                LOG_ERROR("Chunk data too long");
+                return BAD_REQUEST;
+            }
+            state_ = CHUNK_SIZE;
+        } else if(end == 0) {           // CHUNK_TRAILER 空行结束
+            state_ = FINISH;
+        }
+        buff.Retrieve(end + (*eol == '\r' ? 2 : 1));
+        scan_ = 0;
     }
+    return GET_REQUEST;
 }
 
-bool HttpRequest::ParseRequestLine_(const string& line) {
-    regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {   
-        method_ = subMatch[1];
-        path_ = subMatch[2];
-        version_ = subMatch[3];
-        state_ = HEADERS;
-        return true;
+HttpRequest::HTTP_CODE HttpRequest::AppendBody_(const char* data, size_t len) {
+    bodyBytes_ += len;
+    if(sink_) {
+        if(sink_->OnData(data, len)) { return GET_REQUEST; }
+        LOG_ERROR("Body sink failed");
+        return BAD_REQUEST;
     }
-    LOG_ERROR("RequestLine Error");
-    return false;
+    if(body_.size() + len > maxBody_) {
+        LOG_WARN("Body too large: %zu", body_.size() + len);
+        return TOO_LARGE_REQUEST;
+    }
+    body_.append(data, len);
+    return GET_REQUEST;
+}
+
+void HttpRequest::Finish_() {
+    StrView method = View_(method_), version = View_(version_);
+    // HTTP/1.1默认保持连接 除非带close HTTP/1.0须明确带keep-alive
+    StrView connection = GetHeader(HDR_CONNECTION);
+    keepAlive_ = version == "1.1" ? !HasToken(connection, "close") : HasToken(connection, "keep-alive");
+    if(IsFormPost()) { ParseFromUrlencoded_(); }
+    Route_();
+    LOG_DEBUG("[%.*s], [%s], [%.*s]", (int)method.size(), method.data(), path_.c_str(),
+              (int)version.size(), version.data());
+}
+
+bool HttpRequest::Match_(RouteMatch& match) const {
+    const char* query = static_cast<const char*>(memchr(path_.data(), '?', path_.size()));
+    StrView target(path_.data(), query ? query - path_.data() : path_.size());
+    return (router_ ? router_ : &DefaultRouter())->Match(target, match);
 }
 
-void HttpRequest::ParseHeader_(const string& line) {
-    regex patten("^([^:]*): ?(.*)$");
-    smatch subMatch;
-    if(regex_match(line, subMatch, patten)) {
-        header_[subMatch[1]] = subMatch[2];
+void HttpRequest::Route_() {
+    RouteMatch match;
+    if(Match_(match)) { match.Handler().Handle(*this, match); }
+}
+
+// 方法 SP 路径 SP HTTP/版本 方法须为token 路径不含控制字符
+bool HttpRequest::ParseRequestLine_(const char* begin, size_t start, size_t end) {
+    const char* line = begin + start;
+    const char* lineEnd = begin + end;
+    const char* sp1 = CharScan::Find(line, lineEnd, CharScan::NOT_TOKEN);
+    const char* sp2 = (sp1 != lineEnd && *sp1 == ' ') ? CharScan::Find(sp1 + 1, lineEnd, CharScan::NOT_TARGET) : nullptr;
+    if(!sp2 || sp1 == line || sp2 == sp1 + 1 || sp2 == lineEnd || *sp2 != ' '
+        || lineEnd - sp2 - 1 < 5 || memcmp(sp2 + 1, "HTTP/", 5) != 0
+        || CharScan::Find(sp2 + 6, lineEnd, CharScan::NOT_TOKEN) != lineEnd) {
+        LOG_ERROR("RequestLine Error");
+        return false;
     }
-    else {
-        state_ = BODY;
+    method_ = Span{static_cast<uint32_t>(start), static_cast<uint32_t>(sp1 - line)};
+    path_.assign(sp1 + 1, sp2);
+    version_ = Span{static_cast<uint32_t>(sp2 + 6 - begin), static_cast<uint32_t>(lineEnd - sp2 - 6)};
+    state_ = HEADERS;
+    return true;
+}
+
+// 字段名: 值 字段名须为token 值不含控制字符 值两端的空白不计入
+bool HttpRequest::ParseHeader_(const char* begin, size_t start, size_t end) {
+    const char* colon = CharScan::Find(begin + start, begin + end, CharScan::NOT_TOKEN);
+    if(colon == begin + start || colon == begin + end || *colon != ':') {
+        LOG_ERROR("Header Error");
+        return false;
     }
+    size_t valStart = colon - begin + 1;
+    while(valStart < end && (begin[valStart] == ' ' || begin[valStart] == '\t')) { valStart++; }
+    if(CharScan::Find(begin + valStart, begin + end, CharScan::NOT_VALUE) != begin + end) {
+        LOG_ERROR("Header Error");
+        return false;
+    }
+    while(end > valStart && (begin[end - 1] == ' ' || begin[end - 1] == '\t')) { end--; }
+    Span name{static_cast<uint32_t>(start), static_cast<uint32_t>(colon - begin - start)};
+    Span value{static_cast<uint32_t>(valStart), static_cast<uint32_t>(end - valStart)};
+    HEADER id = LookupHeader(StrView(begin + start, name.len));
+    if(id == HDR_COUNT || (present_ >> id & 1)) {
+        // 决定请求边界和目标主机的头部不允许重复 否则前后两级对请求的理解可能不同
+        if(id == HDR_CONTENT_LENGTH || id == HDR_TRANSFER_ENCODING || id == HDR_HOST) {
+            LOG_ERROR("Duplicate %s", HEADER_NAMES[id]);
+            return false;
+        }
+        others_.emplace_back(name, value);
+    } else {
+        known_[id] = value;
+        present_ |= 1u << id;
+    }
+    return true;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
-    ParsePost_();
-    state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+HttpRequest::HEADER HttpRequest::LookupHeader(StrView name) {
+    if(name.empty()) { return HDR_COUNT; }
+    HEADER id = HEADER_TABLE.slots[HeaderSlot(name)];
+    return (id != HDR_COUNT && name.EqualsNoCase(HEADER_NAMES[id])) ? id : HDR_COUNT;
+}
+
+const char* HttpRequest::HeaderName(HEADER id) {
+    assert(id < HDR_COUNT);
+    return HEADER_NAMES[id];
+}
+
+StrView HttpRequest::GetHeader(StrView name) const {
+    HEADER id = LookupHeader(name);
+    if(id != HDR_COUNT) { return GetHeader(id); }
+    for(auto& header: others_) {
+        if(View_(header.first).EqualsNoCase(name)) { return View_(header.second); }
+    }
+    return StrView();
 }
 
 int HttpRequest::ConverHex(char ch) {
     if(ch >= 'A' && ch <= 'F') return ch -'A' + 10;
     if(ch >= 'a' && ch <= 'f') return ch -'a' + 10;
+    if(ch >= '0' && ch <= '9') return ch - '0';
     return ch;
 }
 
-void HttpRequest::ParsePost_() {
-    if(method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
-        ParseFromUrlencoded_();
-        if(DEFAULT_HTML_TAG.count(path_)) {
-            int tag = DEFAULT_HTML_TAG.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if(tag == 0 || tag == 1) {
-                bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
-                    path_ = "/welcome.html";
-                } 
-                else {
-                    path_ = "/error.html";
-                }
-            }
+bool HttpRequest::IsFormPost() const {
+    return View_(method_) == "POST" && GetHeader(HDR_CONTENT_TYPE) == "application/x-www-form-urlencoded";
+}
+
+namespace {
+
+int HexValue(char ch) {
+    if(ch >= '0' && ch <= '9') return ch - '0';
+    if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+}
+
+// 普通字符成段复制 只在'%' '+'处逐个处理 p与out相同时out从不超前于p
+size_t HttpRequest::UrlDecode(const char* p, size_t len, char* out, bool plusIsSpace) {
+    const char* end = p + len;
+    char* dst = out;
+    while(p < end) {
+        const char* esc = CharScan::Find(p, end, CharScan::URL_ESCAPE);
+        if(dst != p) { memmove(dst, p, esc - p); }
+        dst += esc - p;
+        p = esc;
+        if(p == end) { break; }
+        if(*p == '+') {
+            *dst++ = plusIsSpace ? ' ' : '+';
+            p++;
+            continue;
+        }
+        int hi = end - p > 2 ? HexValue(p[1]) : -1;
+        int lo = hi >= 0 ? HexValue(p[2]) : -1;
+        if(lo >= 0) {
+            *dst++ = static_cast<char>(hi << 4 | lo);
+            p += 3;
+        } else {
+            *dst++ = *p++;
         }
-    }   
+    }
+    return dst - out;
 }
 
+/* 按'&'分字段 每个字段第一个'='之前为键 键和值分别解码后紧挨着写入form_
+   解码不会变长 form_一次调整为请求体的大小 没有'='的字段值为空 空字段跳过 */
 void HttpRequest::ParseFromUrlencoded_() {
-    if(body_.size() == 0) { return; }
-
-    string key, value;
-    int num = 0;
-    int n = body_.size();
-    int i = 0, j = 0;
-
-    for(; i < n; i++) {
-        char ch = body_[i];
-        switch (ch) {
-        case '=':
-            key = body_.substr(j, i - j);
-            j = i + 1;
-            break;
-        case '+':
-            body_[i] = ' ';
-            break;
-        case '%':
-            num = ConverHex(body_[i + 1]) * 16 + ConverHex(body_[i + 2]);
-            body_[i + 2] = num % 10 + '0';
-            body_[i + 1] = num / 10 + '0';
-            i += 2;
-            break;
-        case '&':
-            value = body_.substr(j, i - j);
-            j = i + 1;
-            post_[key] = value;
-            LOG_DEBUG("%s = %s", key.c_str(), value.c_str());
-            break;
-        default:
-            break;
+    if(body_.empty()) { return; }
+    form_.resize(body_.size());
+    char* out = &form_[0];
+    const char* p = body_.data();
+    const char* end = p + body_.size();
+    size_t used = 0;
+    while(p < end) {
+        const char* amp = static_cast<const char*>(memchr(p, '&', end - p));
+        const char* fieldEnd = amp ? amp : end;
+        if(fieldEnd > p) {
+            const char* eq = static_cast<const char*>(memchr(p, '=', fieldEnd - p));
+            const char* keyEnd = eq ? eq : fieldEnd;
+            Span key{static_cast<uint32_t>(used), 0}, value;
+            key.len = UrlDecode(p, keyEnd - p, out + used);
+            used += key.len;
+            value.off = used;
+            value.len = eq ? UrlDecode(eq + 1, fieldEnd - eq - 1, out + used) : 0;
+            used += value.len;
+            formFields_.emplace_back(key, value);
+            LOG_DEBUG("%.*s = %.*s", (int)key.len, out + key.off, (int)value.len, out + value.off);
         }
+        p = fieldEnd + 1;
+    }
+    form_.resize(used);
+}
+
+StrView HttpRequest::GetForm(StrView key) const {
+    for(auto& field: formFields_) {
+        if(FormView_(field.first) == key) { return FormView_(field.second); }
     }
-    assert(j <= i);
-    if(post_.count(key) == 0 && j < i) {
-        value = body_.substr(j, i - j);
-        post_[key] = value;
+    return StrView();
+}
+
+HttpRequest::UserVerifier HttpRequest::verifier_ = nullptr;
+HttpRequest::BodySinkFactory HttpRequest::sinkFactory_ = nullptr;
+size_t HttpRequest::maxBody_ = HttpRequest::DEFAULT_MAX_BODY;
+const Router* HttpRequest::router_ = nullptr;
+
+void HttpRequest::SetRouter(const Router* router) {
+    router_ = router;
+}
+
+namespace {
+
+bool AddDefaultRoutes(Router& router) {
+    const char* pages[] = {"/index", "/welcome", "/video", "/picture"};
+    for(const char* page: pages) {
+        router.Add(page, make_shared<PageHandler>(string(page) + ".html"));
     }
+    router.Add("/", make_shared<PageHandler>("/index.html"));
+    router.Add("/register", make_shared<UserFormHandler>("/register.html", false));
+    router.Add("/register.html", make_shared<UserFormHandler>("/register.html", false));
+    router.Add("/login", make_shared<UserFormHandler>("/login.html", true));
+    router.Add("/login.html", make_shared<UserFormHandler>("/login.html", true));
+    router.Add("/upload", make_shared<UploadHandler>("/upload.html"));
+    router.Add("/*", make_shared<StaticFileHandler>());
+    return true;
+}
+
+}
+
+const Router& HttpRequest::DefaultRouter() {
+    static Router router;
+    static const bool built = AddDefaultRoutes(router);     // 首次使用时建好 局部静态变量的初始化是线程安全的
+    (void)built;
+    return router;
+}
+
+void HttpRequest::SetBodySinkFactory(BodySinkFactory factory) {
+    sinkFactory_ = factory;
+}
+
+void HttpRequest::SetMaxBodySize(size_t bytes) {
+    maxBody_ = bytes;
+}
+
+void HttpRequest::SetUserVerifier(UserVerifier verifier) {
+    verifier_ = verifier;
 }
 
 bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false; }
+    if(verifier_) { return verifier_(name, pwd, isLogin); }
     LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
     MYSQL* sql;
     SqlConnRAII(&sql,  SqlConnPool::Instance());
@@ -238,25 +552,19 @@ std::string& HttpRequest::path(){
     return path_;
 }
 std::string HttpRequest::method() const {
-    return method_;
+    return View_(method_).ToString();
 }
 
 std::string HttpRequest::version() const {
-    return version_;
+    return View_(version_).ToString();
 }
 
 std::string HttpRequest::GetPost(const std::string& key) const {
     assert(key != "");
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
+    return GetForm(StrView(key.data(), key.size())).ToString();
 }
 
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
-    if(post_.count(key) == 1) {
-        return post_.find(key)->second;
-    }
-    return "";
-}
\ No newline at end of file
+    return GetForm(StrView(key, strlen(key))).ToString();
+}
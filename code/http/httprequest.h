@@ -1,24 +1,37 @@
 #ifndef HTTPREQUEST_H
 #define HTTPREQUEST_H
 
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
-#include <regex>
+#include <vector>
+#include <memory>
 #include <error.h>
 #include <mysql/mysql.h>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "strview.h"
+#include "charscan.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
 
+/* 可续解析的HTTP/1.1请求解析器 直接在读缓冲区上扫描 不构造正则 不按行复制
+   行尾、分隔符的查找和token/字段值的字符检查由CharScan按16/32字节批量完成
+   请求行和头部只记录相对请求起点的偏移 请求分多次到达时从上次停下的位置继续 缓冲区扩容搬移后偏移仍有效
+   请求完整后才从缓冲区取走 方法、版本、头部的视图在下次向读缓冲区写入前有效
+   有请求体时头部复制一份 请求体按Content-Length或chunked分帧 数据到达即从缓冲区取走 放入body_或交给BodySink */
+class Router;
+struct RouteMatch;
+
 class HttpRequest{
 public:
     enum PARSE_STATE{
         REQUEST_LINE,
         HEADERS,
-        BODY,
+        BODY,               // 按Content-Length接收请求体
+        CHUNK_SIZE,         // chunked: 块大小行
+        CHUNK_DATA,
+        CHUNK_DATA_END,     // 块数据后的CRLF
+        CHUNK_TRAILER,      // 最后一块之后的尾部字段 直到空行
         FINISH,
     };
 
@@ -31,13 +44,56 @@ public:
         FILE_REQUEST,
         INTERNAL_ERROR,
         CLOSED_CONNECTION,
+        TOO_LARGE_REQUEST,  // 请求体超过上限
+    };
+
+    /* 请求体的流式接收者 头部解析完后由工厂按请求创建 请求体数据到达即交给它 不在内存中累积 也不受请求体上限限制
+       OnData/OnEnd返回false时请求以错误结束 请求出错时不调用OnEnd就析构 */
+    class BodySink {
+    public:
+        virtual ~BodySink() = default;
+        virtual bool OnData(const char* data, size_t len) = 0;
+        virtual bool OnEnd() { return true; }
     };
+    // 返回nullptr表示这个请求的请求体放在内存中
+    typedef std::unique_ptr<BodySink> (*BodySinkFactory)(const HttpRequest& request);
 
-    HttpRequest() { Init(); }
+    // 常用头部 解析时按字段名的完美哈希直接落到固定槽位 其余头部放在一个小的数组中
+    enum HEADER {
+        HDR_ACCEPT,
+        HDR_ACCEPT_ENCODING,
+        HDR_ACCEPT_LANGUAGE,
+        HDR_AUTHORIZATION,
+        HDR_CACHE_CONTROL,
+        HDR_CONNECTION,
+        HDR_CONTENT_ENCODING,
+        HDR_CONTENT_LENGTH,
+        HDR_CONTENT_TYPE,
+        HDR_COOKIE,
+        HDR_EXPECT,
+        HDR_HOST,
+        HDR_IF_MATCH,
+        HDR_IF_MODIFIED_SINCE,
+        HDR_IF_NONE_MATCH,
+        HDR_IF_RANGE,
+        HDR_IF_UNMODIFIED_SINCE,
+        HDR_ORIGIN,
+        HDR_RANGE,
+        HDR_REFERER,
+        HDR_TRANSFER_ENCODING,
+        HDR_UPGRADE,
+        HDR_USER_AGENT,
+        HDR_HTTP2_SETTINGS,
+        HDR_COUNT,              // 不是常用头部
+    };
+
+    HttpRequest() { others_.reserve(16); Init(); }
     ~HttpRequest() = default;
 
     void Init();
-    bool parse(Buffer& buff);
+    /* GET_REQUEST 解析出完整请求并从缓冲区取走 NO_REQUEST 数据不完整 等待更多数据后再调用
+       BAD_REQUEST 格式错误 TOO_LARGE_REQUEST 请求体超过上限 出错时丢弃缓冲区中剩余的数据 */
+    HTTP_CODE parse(Buffer& buff);
 
     std::string path() const;
     std::string& path();
@@ -45,27 +101,98 @@ public:
     std::string version() const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    // 表单字段 键和值都已解码 同名字段取第一个 视图在下一个请求开始前有效
+    typedef std::pair<StrView, StrView> FormField;
+    size_t FormCount() const { return formFields_.size(); }
+    FormField GetFormField(size_t i) const {
+        return FormField(FormView_(formFields_[i].first), FormView_(formFields_[i].second));
+    }
+    StrView GetForm(StrView key) const;         // 不存在返回空视图
+    StrView GetHeader(HEADER id) const {        // 重复的常用头部返回第一个
+        return (present_ >> id & 1) ? View_(known_[id]) : StrView();
+    }
+    StrView GetHeader(StrView name) const;      // 字段名不区分大小写 不存在返回空视图
+    size_t HeaderCount() const { return __builtin_popcount(present_) + others_.size(); }
+
+    /* 百分号解码 plusIsSpace时'+'解为空格(表单) 不合法的"%XX"原样保留
+       out至少len字节 可以就是p 返回解码后的长度 */
+    static size_t UrlDecode(const char* p, size_t len, char* out, bool plusIsSpace = true);
+    static HEADER LookupHeader(StrView name);   // 不区分大小写 不是常用头部返回HDR_COUNT
+    static const char* HeaderName(HEADER id);
+    const std::string& body() const { return body_; }      // 交给BodySink的请求体不在这里
+    size_t BodyBytes() const { return bodyBytes_; }         // 已收到的请求体字节数(解码chunked之后)
+    BodySink* GetBodySink() const { return sink_.get(); }   // 保留到下一个请求开始
+    bool IsReadingBody() const { return state_ > HEADERS && state_ < FINISH; }
+    // 头部已完整、请求体还没收完 客户端带Expect: 100-continue在等待 只返回一次true
+    bool TakeContinue() {
+        bool ret = expectContinue_;
+        expectContinue_ = false;
+        return ret;
+    }
 
     bool IsKeepAlive() const;                   // 判断链接是否存在
+    bool IsFormPost() const;                    // POST且请求体为application/x-www-form-urlencoded
+
+    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);  // 用户验证
+
+    // 请求完整后按路径找处理者 需在服务器启动前设置 nullptr恢复默认路由
+    static void SetRouter(const Router* router);
+    static const Router& DefaultRouter();       // 原有的页面、登录/注册 其余路径为静态文件
+
+    // 替换数据库上的用户验证(如测试中模拟慢数据库) 需在服务器启动前设置 nullptr恢复默认
+    typedef bool (*UserVerifier)(const std::string& name, const std::string& pwd, bool isLogin);
+    static void SetUserVerifier(UserVerifier verifier);
+
+    // 需在服务器启动前设置 设置后优先于路由处理者的OpenBody
+    static void SetBodySinkFactory(BodySinkFactory factory);
+    static void SetMaxBodySize(size_t bytes);               // 放在内存中的请求体的上限
+    static size_t MaxBodySize() { return maxBody_; }
+
+    static const size_t MAX_HEAD_BYTES = 8192;      // 请求行加头部的上限 超过仍不完整视为错误请求 chunked的每行同样
+    static const size_t DEFAULT_MAX_BODY = 1 << 20;
 
 private:
-    bool ParseRequestLine_(const std::string& line);    // 处理请求行
-    void ParseHeader_(const std::string& line);         // 处理请求头
-    void ParseBody_(const std::string& line);           // 处理请求体
+    struct Span {                                   // 相对请求起点的偏移
+        uint32_t off, len;
+    };
 
-    void ParsePath_();                                  // 匹配路径
-    void ParsePost_();                                  // 处理Post事件
-    void ParseFromUrlencoded_();                        // 从rul解析编码
+    bool ParseRequestLine_(const char* begin, size_t start, size_t end);    // 处理请求行 [start, end)不含行尾
+    bool ParseHeader_(const char* begin, size_t start, size_t end);         // 处理请求头
+    HTTP_CODE ParseHead_(Buffer& buff);                 // 请求行和头部
+    HTTP_CODE StartBody_(Buffer& buff, size_t headLen); // 头部结束 确定请求体的分帧方式
+    HTTP_CODE ParseBody_(Buffer& buff);                 // 按Content-Length接收
+    HTTP_CODE ParseChunked_(Buffer& buff);              // chunked解码
+    HTTP_CODE AppendBody_(const char* data, size_t len);
+    void Finish_();                                                         // 请求完整后的处理
+    StrView View_(Span span) const { return StrView(base_ + span.off, span.len); }
+    StrView FormView_(Span span) const { return StrView(form_.data() + span.off, span.len); }
 
-    static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);  // 用户验证
+    bool Match_(RouteMatch& match) const;               // 按路由表找处理者 路由时忽略查询串
+    void Route_();                                      // 交给处理者
+    void ParseFromUrlencoded_();                        // 把请求体解码到form_
 
     PARSE_STATE state_;                                     // 状态
-    std::string method_, path_, version_, body_;            // 请求行的 请求方式、资源路径、HTTP版本 
-    std::unordered_map<std::string, std::string> header_;   // 请求头
-    std::unordered_map<std::string, std::string> post_;
+    size_t lineStart_;                                      // 当前行起点
+    size_t scan_;                                           // 已扫描到的位置 续解析时从这里找行尾
+    size_t bodyLen_;                                        // 当前请求体或当前块还未收到的字节数
+    size_t bodyBytes_;
+    const char* base_;                                      // 请求起点 头部在缓冲区中时每次parse更新
+    std::string head_;                                      // 有请求体时头部的副本 base_指向它
+    std::unique_ptr<BodySink> sink_;
+    Span method_, version_;                                 // 请求行的 请求方式、HTTP版本
+    Span known_[HDR_COUNT];                                 // 常用头部的值
+    uint32_t present_;                                      // 第i位为1表示known_[i]有效
+    std::vector<std::pair<Span, Span>> others_;             // 其他头部和重复的常用头部 (字段名, 值)
+    bool keepAlive_;
+    bool expectContinue_;
+    std::string path_, body_;                               // 资源路径 会被改写故单独保存
+    std::string form_;                                      // 解码后的表单 清空时保留容量 不必每个请求分配
+    std::vector<std::pair<Span, Span>> formFields_;         // (键, 值)在form_中的偏移
     
-    static const std::unordered_set<std::string> DEFAULT_HTML;
-    static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
+    static UserVerifier verifier_;
+    static BodySinkFactory sinkFactory_;
+    static size_t maxBody_;
+    static const Router* router_;
     static int ConverHex(char ch);      // 16 -> 10 
 };
 
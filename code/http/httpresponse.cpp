@@ -1,7 +1,77 @@
 #include "httpresponse.h"
+#include <algorithm>
+#include <atomic>
+#include <array>
+#include <time.h>
 
 using namespace std;
 
+namespace {
+
+// 十进制数 溢出时饱和为SIZE_MAX 没有数字返回false
+bool ParseSize(const char*& p, const char* end, size_t& n) {
+    const char* start = p;
+    n = 0;
+    while(p < end && *p >= '0' && *p <= '9') {
+        size_t d = *p++ - '0';
+        n = n > (SIZE_MAX - d) / 10 ? SIZE_MAX : n * 10 + d;
+    }
+    return p > start;
+}
+
+const char* SkipSpace(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+const size_t HTTP_DATE_LEN = 29;
+
+// 当前时间的HTTP日期 每个线程每秒只格式化一次
+const char* HttpDateNow() {
+    thread_local time_t last = 0;
+    thread_local char date[32];
+    time_t now = time(nullptr);
+    if(now != last) {
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        last = now;
+    }
+    return date;
+}
+
+// IMF-fixdate: Sun, 06 Nov 1994 08:49:37 GMT
+bool ParseHttpDate(StrView value, time_t& t) {
+    char date[64];
+    if(value.size() >= sizeof(date)) return false;
+    memcpy(date, value.data(), value.size());
+    date[value.size()] = '\0';
+    struct tm tm = {};
+    const char* end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0') return false;
+    t = timegm(&tm);
+    return true;
+}
+
+// If-None-Match: "a", W/"b" 或 * 弱比较 忽略W/
+bool EtagListMatches(StrView list, const string& etag) {
+    const char* p = list.data();
+    const char* end = p + list.size();
+    while(true) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if(p == end) return false;
+        if(*p == '*') return true;
+        if(end - p > 2 && p[0] == 'W' && p[1] == '/') p += 2;
+        if(*p != '"') return false;
+        const char* close = static_cast<const char*>(memchr(p + 1, '"', end - p - 1));
+        if(!close) return false;
+        if(StrView(p, close + 1 - p) == StrView(etag.data(), etag.size())) return true;
+        p = close + 1;
+    }
+}
+
+}
+
 const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".html",  "text/html" },
     { ".xml",   "text/xml" },
@@ -18,150 +88,438 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
     { ".mpeg",  "video/mpeg" },
     { ".mpg",   "video/mpeg" },
     { ".avi",   "video/x-msvideo" },
+    { ".mp4",   "video/mp4" },
     { ".gz",    "application/x-gzip" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
     { 200, "OK" },
+    { 206, "Partial Content" },
+    { 304, "Not Modified" },
     { 400, "Bad Request" },
     { 403, "Forbidden" },
     { 404, "Not Found" },
+    { 413, "Payload Too Large" },
+    { 416, "Range Not Satisfiable" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
+    { 413, "/413.html" },
+};
+
+vector<pair<string, string>> HttpResponse::cacheControl_;
+
+/* 在栈上拼接响应头 满了或需要知道在写缓冲区中的位置时才复制到写缓冲区 通常一个响应只复制一次 */
+class HttpResponse::HeadWriter {
+public:
+    explicit HeadWriter(Buffer& buff): buff_(buff), len_(0) {}
+    ~HeadWriter() { Flush(); }
+
+    void Put(const char* str, size_t len) {
+        if(len_ + len > sizeof(buf_)) {
+            Flush();
+            if(len > sizeof(buf_)) {
+                buff_.Append(str, len);
+                return;
+            }
+        }
+        memcpy(buf_ + len_, str, len);
+        len_ += len;
+    }
+    void Put(const string& str) { Put(str.data(), str.size()); }
+    template<size_t N>
+    void Put(const char (&str)[N]) { Put(str, N - 1); }
+    void PutDecimal(size_t n) {
+        char digits[20];
+        char* p = digits + sizeof(digits);
+        do {
+            *--p = '0' + n % 10;
+            n /= 10;
+        } while(n > 0);
+        Put(p, digits + sizeof(digits) - p);
+    }
+    size_t Flush() {                    // 返回写缓冲区中可读的字节数
+        if(len_ > 0) {
+            buff_.Append(buf_, len_);
+            len_ = 0;
+        }
+        return buff_.ReadableBytes();
+    }
+    Buffer& buff() { return buff_; }
+
+private:
+    Buffer& buff_;
+    char buf_[1024];
+    size_t len_;
 };
 
 HttpResponse::HttpResponse() {
     code_ = -1;
     path_ = srcDir_ = "";
     isKeepAlive_ = false;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    encoding_ = nullptr;
+    vary_ = false;
+    rangeCnt_ = sliceCnt_ = 0;
 };
 
 HttpResponse::~HttpResponse() {
-    UnmapFile();
 }
 
 void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
     assert(srcDir != "");
-    if(mmFile_) { UnmapFile(); }
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
-    mmFile_ = nullptr; 
-    mmFileStat_ = { 0 };
+    file_.reset();
+    source_.reset();
+    range_ = ifRange_ = acceptEncoding_ = ifNoneMatch_ = ifModifiedSince_ = StrView();
+    encoding_ = nullptr;
+    vary_ = false;
+    rangeCnt_ = sliceCnt_ = 0;
+}
+
+void HttpResponse::SetRange(StrView range, StrView ifRange) {
+    range_ = range;
+    ifRange_ = ifRange;
+}
+
+// 确定状态码和要发送的文件
+void HttpResponse::Resolve_() {
+    /* 判断请求的资源文件 已确定为错误的请求不看请求的文件 直接返回错误页面 */
+    if(code_ < 400) {
+        fullPath_.assign(srcDir_).append(path_);
+        int ret = FileCache::Instance()->Get(fullPath_, file_);
+        if(ret != 200) {
+            code_ = ret;                // 404 403
+        }
+        else if(code_ == -1) { 
+            code_ = 200; 
+        }
+    }
+    ErrorHtml_();
+    if(code_ == 200) {
+        Negotiate_();
+        if(NotModified_()) {
+            code_ = 304;
+        }
+    }
+}
+
+/* 有If-None-Match时只看它 否则看If-Modified-Since 比较的是协商后要发送的表示 */
+bool HttpResponse::NotModified_() const {
+    if(!ifNoneMatch_.empty()) {
+        return EtagListMatches(ifNoneMatch_, file_->etag);
+    }
+    time_t since;
+    return !ifModifiedSince_.empty() && ParseHttpDate(ifModifiedSince_, since) && file_->st.st_mtime <= since;
+}
+
+void HttpResponse::SetCacheControl(const string& prefix, const string& value) {
+    auto it = find_if(cacheControl_.begin(), cacheControl_.end(),
+                      [&](const pair<string, string>& rule) { return rule.first == prefix; });
+    if(it != cacheControl_.end()) {
+        if(value.empty()) cacheControl_.erase(it);
+        else if(it->second != value) it->second = value;
+        return;
+    }
+    if(value.empty()) return;
+    cacheControl_.emplace_back(prefix, value);
+    stable_sort(cacheControl_.begin(), cacheControl_.end(), [](const pair<string, string>& a, const pair<string, string>& b) {
+        return a.first.size() > b.first.size();
+    });
+}
+
+const string* HttpResponse::CacheControl() const {
+    for(const auto& rule: cacheControl_) {
+        if(path_.compare(0, rule.first.size(), rule.first) == 0) return &rule.second;
+    }
+    return nullptr;
+}
+
+/* 可压缩的类型都带Vary 范围请求按原文件处理 不压缩 */
+void HttpResponse::Negotiate_() {
+    vary_ = CompressCache::Compressible(file_->contentType);
+    if(!vary_ || !range_.empty() || acceptEncoding_.empty()) return;
+    unsigned accept = CompressCache::Accepted(acceptEncoding_);
+    if(accept == 0) return;
+    FileCache::FilePtr variant;
+    encoding_ = CompressCache::Instance()->Select(file_, accept, variant);
+    if(encoding_) {
+        source_ = move(file_);
+        file_ = move(variant);
+    }
 }
 
 // 调用函数生成响应消息
 void HttpResponse::MakeResponse(Buffer& buff) {
-    /* 判断请求的资源文件 */
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
-        code_ = 404;
-    }
-    else if(!(mmFileStat_.st_mode & S_IROTH)) {
-        code_ = 403;
+    Resolve_();
+    if(code_ == 200 && !range_.empty()) {
+        ApplyRange_();
     }
-    else if(code_ == -1) { 
-        code_ = 200; 
+    HeadWriter head(buff);
+    AddStateLine_(head);
+    AddHeader_(head);
+    AddContent_(head);
+}
+
+void HttpResponse::MakeBody(string& content) {
+    Resolve_();
+    if(!file_) {
+        content = ErrorBody_("File NotFound!");
     }
-    ErrorHtml_();
-    AddStateLine_(buff);
-    AddHeader_(buff);
-    AddContent_(buff);
 }
 
-char* HttpResponse::File() {
-    return mmFile_;
+const char* HttpResponse::File() const {
+    return file_ ? file_->data : nullptr;
 }
 
 size_t HttpResponse::FileLen() const {
-    return mmFileStat_.st_size;
+    return file_ ? file_->size : 0;
+}
+
+// Range不合法、范围太多或If-Range不匹配时忽略Range 返回整个文件 都不可满足时416 空响应体
+void HttpResponse::ApplyRange_() {
+    if(!IfRangeMatches_() || !ParseRange_()) {
+        rangeCnt_ = 0;
+        return;
+    }
+    code_ = rangeCnt_ > 0 ? 206 : 416;
+    if(rangeCnt_ > 1) {
+        static atomic<unsigned long long> seq(0);
+        snprintf(boundary_, sizeof(boundary_), "%016llx", (++seq) * 0x9E3779B97F4A7C15ULL);
+    }
+}
+
+/* bytes=0-499, 500-, -200 元素间可有空白和空元素 起点超出文件的范围不可满足 跳过
+   终点超出时截到文件末尾 排序后合并重叠和相邻的范围 */
+bool HttpResponse::ParseRange_() {
+    const size_t size = file_->size;
+    const char* p = range_.data();
+    const char* end = p + range_.size();
+    if(range_.size() < 6 || !StrView(p, 6).EqualsNoCase("bytes=")) return false;
+    p += 6;
+    int specs = 0;
+    rangeCnt_ = 0;
+    while(true) {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) p++;
+        if(p == end) break;
+        size_t first, last;
+        bool hasFirst = ParseSize(p, end, first);
+        if(p == end || *p++ != '-') return false;
+        bool hasLast = ParseSize(p, end, last);
+        p = SkipSpace(p, end);
+        if((p < end && *p != ',') || (!hasFirst && !hasLast) || (hasFirst && hasLast && last < first)
+           || ++specs > MAX_RANGES) return false;
+        if(!hasFirst) {                             // 最后last个字节
+            if(last == 0 || size == 0) continue;
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        } else {
+            if(first >= size) continue;
+            if(!hasLast || last >= size) last = size - 1;
+        }
+        ranges_[rangeCnt_++] = {first, last};
+    }
+    if(specs == 0) return false;
+    sort(ranges_, ranges_ + rangeCnt_, [](const Range& a, const Range& b) { return a.first < b.first; });
+    int n = 0;
+    for(int i = 0; i < rangeCnt_; i++) {
+        if(n > 0 && ranges_[i].first <= ranges_[n - 1].last + 1) {
+            ranges_[n - 1].last = max(ranges_[n - 1].last, ranges_[i].last);
+        } else {
+            ranges_[n++] = ranges_[i];
+        }
+    }
+    rangeCnt_ = n;
+    return true;
+}
+
+// If-Range为实体标签时强比较 弱标签总是不匹配 为HTTP日期时须与文件的修改时间相同
+bool HttpResponse::IfRangeMatches_() const {
+    if(ifRange_.empty()) return true;
+    if(ifRange_[0] == '"') return ifRange_ == StrView(file_->etag.data(), file_->etag.size());
+    if(ifRange_.size() > 1 && ifRange_[0] == 'W' && ifRange_[1] == '/') return false;
+    time_t t;
+    return ParseHttpDate(ifRange_, t) && t == file_->st.st_mtime;
 }
 
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {
         path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        fullPath_.assign(srcDir_).append(path_);
+        FileCache::Instance()->Get(fullPath_, file_);
     }
 }
 
-// 生成响应行
-void HttpResponse::AddStateLine_(Buffer& buff) {
-    string status;
-    if(CODE_STATUS.count(code_) == 1) {
-        status = CODE_STATUS.find(code_)->second;
-    }
-    else {
+// 响应行和Connection头部 按状态码和是否keep-alive预先生成
+const string& HttpResponse::StatusHead_(int code, bool keepAlive) {
+    static const unordered_map<int, array<string, 2>> heads = [] {
+        unordered_map<int, array<string, 2>> m;
+        for(const auto& status: CODE_STATUS) {
+            string line = "HTTP/1.1 " + to_string(status.first) + " " + status.second + "\r\n";
+            m[status.first] = {{line + "Connection: close\r\n",
+                                line + "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n"}};
+        }
+        return m;
+    }();
+    return heads.find(code)->second[keepAlive ? 1 : 0];
+}
+
+// 生成响应行 连同Connection和Date
+void HttpResponse::AddStateLine_(HeadWriter& head) {
+    if(CODE_STATUS.count(code_) == 0) {
         code_ = 400;
-        status = CODE_STATUS.find(400)->second;
     }
-    // 空格必不可少
-    buff.Append("HTTP/1.1 " + to_string(code_) + " " + status + "\r\n");
+    head.Put(StatusHead_(code_, isKeepAlive_));
+    head.Put("Date: ");
+    head.Put(HttpDateNow(), HTTP_DATE_LEN);
+    head.Put("\r\n");
 }
 
-// 生成响应头
-void HttpResponse::AddHeader_(Buffer& buff) {
-    buff.Append("Connection: ");
-    if(isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
-    } else{
-        buff.Append("close\r\n");
+// 生成响应头 文件的类型和验证头部是文件缓存中预先生成的片段
+void HttpResponse::AddHeader_(HeadWriter& head) {
+    if(code_ == 206 && rangeCnt_ > 1) {
+        head.Put("Content-type: multipart/byteranges; boundary=");
+        head.Put(boundary_, strlen(boundary_));
+        head.Put("\r\n");
+    } else if(code_ != 304 && code_ != 416) {       // 304和416没有响应体 不带类型
+        const FileCache::File* file = source_ ? source_.get() : file_.get();
+        if(file) {
+            head.Put(file->typeHeader);
+        } else {
+            head.Put("Content-type: ");
+            head.Put(FileType(path_));
+            head.Put("\r\n");
+        }
+    }
+    if(file_ && (code_ == 200 || code_ == 206 || code_ == 304)) {
+        head.Put(file_->validatorHeaders);
+        const string* cacheControl = CacheControl();
+        if(cacheControl) {
+            head.Put("Cache-Control: ");
+            head.Put(*cacheControl);
+            head.Put("\r\n");
+        }
+    }
+    if(encoding_ && code_ != 304) {
+        head.Put("Content-Encoding: ");
+        head.Put(encoding_, strlen(encoding_));
+        head.Put("\r\n");
+    } else if(code_ == 200 || code_ == 206 || code_ == 416) {
+        head.Put("Accept-Ranges: bytes\r\n");
+    }
+    if(vary_) {
+        head.Put("Vary: Accept-Encoding\r\n");
     }
-    buff.Append("Content-type: " + GetFileType_() + "\r\n");
 }
 
 // 生成响应体
-void HttpResponse::AddContent_(Buffer& buff) {
-    int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-    if(srcFd < 0) { 
-        ErrorContent(buff, "File NotFound!");
-        return; 
+void HttpResponse::AddContent_(HeadWriter& head) {
+    if(code_ == 304) {
+        head.Put("\r\n");
+        file_.reset();
+        return;
     }
-
-    /* 将文件映射到内存提高文件的访问速度 
-        MAP_PRIVATE 建立一个写入时拷贝的私有映射*/
-    LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-    int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
-    if(*mmRet == -1) {
-        ErrorContent(buff, "File NotFound!");
-        return; 
+    if(code_ == 416) {
+        head.Put("Content-Range: bytes */");
+        head.Put(file_->contentLength);
+        head.Put("\r\nContent-length: 0\r\n\r\n");
+        file_.reset();
+        return;
+    }
+    if(!file_) {
+        head.Flush();
+        ErrorContent(head.buff(), "File NotFound!");
+        return;
+    }
+    if(code_ == 206) {
+        AddRangeContent_(head);
+        return;
+    }
+    head.Put("Content-length: ");
+    head.Put(file_->contentLength);
+    head.Put("\r\n\r\n");
+    size_t headEnd = head.Flush();
+    if(file_->size > 0) {
+        slices_[sliceCnt_++] = {headEnd, 0, file_->size};
     }
-    mmFile_ = (char*)mmRet;
-    close(srcFd);
-    buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
 }
 
-void HttpResponse::UnmapFile() {
-    if(mmFile_) {
-        munmap(mmFile_, mmFileStat_.st_size);
-        mmFile_ = nullptr;
+/* 一个范围时只发送文件的那一段 多个时为multipart/byteranges
+   各段的头部和结尾写入缓冲区 段的内容仍从文件映射发送 */
+void HttpResponse::AddRangeContent_(HeadWriter& head) {
+    const size_t size = file_->size;
+    if(rangeCnt_ == 1) {
+        const Range& r = ranges_[0];
+        head.Put("Content-Range: bytes ");
+        head.PutDecimal(r.first);
+        head.Put("-");
+        head.PutDecimal(r.last);
+        head.Put("/");
+        head.Put(file_->contentLength);
+        head.Put("\r\nContent-length: ");
+        head.PutDecimal(r.last - r.first + 1);
+        head.Put("\r\n\r\n");
+        slices_[sliceCnt_++] = {head.Flush(), r.first, r.last - r.first + 1};
+        return;
     }
+    const char* type = file_->contentType.c_str();
+    const char* fmt = "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %zu-%zu/%zu\r\n\r\n";
+    char tail[48];
+    int tailLen = snprintf(tail, sizeof(tail), "\r\n--%s--\r\n", boundary_);
+    size_t total = tailLen;
+    for(int i = 0; i < rangeCnt_; i++) {
+        const Range& r = ranges_[i];
+        total += snprintf(nullptr, 0, fmt, boundary_, type, r.first, r.last, size) + r.last - r.first + 1;
+    }
+    head.Put("Content-length: ");
+    head.PutDecimal(total);
+    head.Put("\r\n\r\n");
+    char part[256];
+    for(int i = 0; i < rangeCnt_; i++) {
+        const Range& r = ranges_[i];
+        int n = snprintf(part, sizeof(part), fmt, boundary_, type, r.first, r.last, size);
+        head.Put(part, min(static_cast<size_t>(n), sizeof(part) - 1));
+        slices_[sliceCnt_++] = {head.Flush(), r.first, r.last - r.first + 1};
+    }
+    head.Put(tail, tailLen);
 }
 
-string HttpResponse::GetFileType_() {
+FileCache::FilePtr HttpResponse::ReleaseFile() {
+    return move(file_);
+}
+
+const string& HttpResponse::ContentType() const {
+    if(source_) return source_->contentType;
+    return file_ ? file_->contentType : FileType(path_);
+}
+
+const string& HttpResponse::FileType(const string& path) {
     /* 判断文件类型 */
-    string::size_type idx = path_.find_last_of('.');
+    static const string PLAIN = "text/plain";
+    string::size_type idx = path.find_last_of('.');
     if(idx == string::npos) {
-        return "text/plain";
-    }
-    string suffix = path_.substr(idx);
-    if(SUFFIX_TYPE.count(suffix) == 1) {
-        return SUFFIX_TYPE.find(suffix)->second;
+        return PLAIN;
     }
-    return "text/plain";
+    auto it = SUFFIX_TYPE.find(path.substr(idx));
+    return it == SUFFIX_TYPE.end() ? PLAIN : it->second;
 }
 
 void HttpResponse::ErrorContent(Buffer& buff, string message) 
 {
+    string body = ErrorBody_(message);
+    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+    buff.Append(body);
+}
+
+string HttpResponse::ErrorBody_(const string& message) {
     string body;
     string status;
     body += "<html><title>Error</title>";
@@ -174,7 +532,5 @@ void HttpResponse::ErrorContent(Buffer& buff, string message)
     body += to_string(code_) + " : " + status  + "\n";
     body += "<p>" + message + "</p>";
     body += "<hr><em>TinyWebServer</em></body></html>";
-
-    buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-    buff.Append(body);
-}
\ No newline at end of file
+    return body;
+}
@@ -2,47 +2,107 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stat.h>
-#include <sys/mman.h>
+#include <vector>
+#include <utility>
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "strview.h"
+#include "filecache.h"
+#include "compresscache.h"
 
 class HttpResponse {
 public:
+    /* 响应体中来自文件的一段: 写缓冲区中(可读部分)到headEnd为止的内容之后 发送文件的[offset, offset + len)
+       200为整个文件一段 206为各个范围 multipart/byteranges各段的头部和结尾在写缓冲区中 */
+    struct Slice {
+        size_t headEnd;
+        size_t offset;
+        size_t len;
+    };
+
     HttpResponse();
     ~HttpResponse();
 
     void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
+    // GET请求的Range和If-Range 在Init之后、MakeResponse之前设置 指向的内存需在MakeResponse时有效
+    void SetRange(StrView range, StrView ifRange);
+    // 请求的Accept-Encoding 同样在生成响应前设置 可压缩类型的200响应改为发送压缩版本
+    void SetAcceptEncoding(StrView acceptEncoding) { acceptEncoding_ = acceptEncoding; }
+    // GET的If-None-Match和If-Modified-Since 同样在生成响应前设置 与文件一致时为没有响应体的304
+    void SetConditional(StrView ifNoneMatch, StrView ifModifiedSince) {
+        ifNoneMatch_ = ifNoneMatch;
+        ifModifiedSince_ = ifModifiedSince;
+    }
     void MakeResponse(Buffer& buff);                        // 生成状态码 调用Add创建响应消息
-    void UnmapFile();                                       // 取消内存映射
-    char* File();                                           // 返回内存映射
+    int SliceCount() const { return sliceCnt_; }            // MakeResponse之后 没有映射文件时为0
+    const Slice& GetSlice(int i) const { return slices_[i]; }
+    // HTTP/2用: 只确定状态码并映射文件 不生成HTTP/1.1的响应行和头部 映射失败时错误页面放入content
+    void MakeBody(std::string& content);
+    FileCache::FilePtr ReleaseFile();                       // 交出文件缓存的引用 发送完之前由调用者持有
+    const FileCache::File* FileInfo() const { return file_.get(); }     // 交出前的文件 304时留到下次Init
+    const char* File() const;                               // 文件内容
     size_t FileLen() const;                                 // 文件长度
     void ErrorContent(Buffer& buff, std::string message);   // 错误时页面
     int Code() const { return code_; }
+    const std::string& ContentType() const;                     // 压缩时为原文件的类型
+    const char* ContentEncoding() const { return encoding_; }   // "gzip" "br" 未压缩为nullptr
+    bool Vary() const { return vary_; }                         // 响应随Accept-Encoding不同
+    const std::string* CacheControl() const;                    // 按路径前缀配置的Cache-Control 没有为nullptr
+    // 路径前缀为prefix的文件的Cache-Control 最长的前缀优先 value为空时删除 需在服务器启动前设置
+    static void SetCacheControl(const std::string& prefix, const std::string& value);
+    static const std::string& FileType(const std::string& path);    // 按后缀判断文件类型
+
+    static const int MAX_RANGES = 16;       // 一个请求最多的范围数 更多时忽略Range 返回整个文件
 
 private:
-    void AddStateLine_(Buffer& buff);                       // 添加响应行
-    void AddHeader_(Buffer& buff);                          // 添加响应头
-    void AddContent_(Buffer& buff);                         // 添加响应体
+    class HeadWriter;                                       // 在栈上拼接响应头 一次复制到写缓冲区
+
+    static const std::string& StatusHead_(int code, bool keepAlive);   // 预先生成的响应行和Connection
+    void AddStateLine_(HeadWriter& head);                   // 添加响应行
+    void AddHeader_(HeadWriter& head);                      // 添加响应头
+    void AddContent_(HeadWriter& head);                     // 添加响应体
+    void Resolve_();                                        // 确定状态码和文件
+    void Negotiate_();                                      // 200时按Accept-Encoding换成压缩版本
+    void ApplyRange_();                                     // 200时按Range改为206或416
+    bool ParseRange_();                                     // 解析Range到ranges_ 语法不合法返回false
+    bool IfRangeMatches_() const;
+    bool NotModified_() const;                              // 条件请求与文件一致
+    void AddRangeContent_(HeadWriter& head);
+    std::string ErrorBody_(const std::string& message);
 
     void ErrorHtml_();                                      // 定向到错误页面
-    std::string GetFileType_();                             // 判断文件类型
 
     int code_;
     bool isKeepAlive_;
 
     std::string path_;
     std::string srcDir_;
+    std::string fullPath_;          // srcDir_ + path_ 复用内存
+
+    FileCache::FilePtr file_;       // 要发送的文件 来自共享的文件缓存 压缩时为压缩版本
+    FileCache::FilePtr source_;     // 压缩时的原文件 取Content-Type
+
+    StrView acceptEncoding_;
+    const char* encoding_;
+    bool vary_;
+
+    StrView ifNoneMatch_, ifModifiedSince_;
 
-    char* mmFile_;                  // 内存映射
-    struct stat mmFileStat_;        // 文件属性结构体 用于文件操作
+    StrView range_, ifRange_;
+    struct Range {
+        size_t first, last;         // 闭区间
+    };
+    Range ranges_[MAX_RANGES];      // 可满足的范围 按起点排序 重叠和相邻的已合并
+    int rangeCnt_;
+    char boundary_[24];             // multipart/byteranges的分隔
+    Slice slices_[MAX_RANGES];
+    int sliceCnt_;
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;      // 后缀类型集
     static const std::unordered_map<int ,std::string> CODE_STATUS;              // 状态类型集
     static const std::unordered_map<int ,std::string> CODE_PATH;                // 状态路径集
+    static std::vector<std::pair<std::string, std::string>> cacheControl_;     // 按前缀长度降序
 };
 
 # endif
\ No newline at end of file
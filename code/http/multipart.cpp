@@ -0,0 +1,228 @@
+#include "multipart.h"
+#include <algorithm>
+using namespace std;
+
+namespace {
+
+const char* SkipSpace(const char* p, const char* end) {
+    while(p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+StrView Trim(const char* p, const char* end) {
+    p = SkipSpace(p, end);
+    while(end > p && (end[-1] == ' ' || end[-1] == '\t')) end--;
+    return StrView(p, end - p);
+}
+
+/* 取下一个";"分隔的参数 key=value 或 key="value"
+   浏览器把引号编码为%22 不用反斜杠转义 反斜杠原样保留(Windows路径) 引号内到下一个引号为止
+   p指向参数开头(已跳过前面的';') 返回后指向下一个参数 没有参数返回false */
+bool NextParam(const char*& p, const char* end, StrView& key, string& value) {
+    p = SkipSpace(p, end);
+    if(p == end) return false;
+    const char* k = p;
+    while(p < end && *p != '=' && *p != ';') p++;
+    key = Trim(k, p);
+    value.clear();
+    if(p < end && *p == '=') {
+        p = SkipSpace(p + 1, end);
+        if(p < end && *p == '"') {
+            const char* v = ++p;
+            while(p < end && *p != '"') p++;
+            value.assign(v, p - v);
+            if(p < end) p++;
+            const char* semi = static_cast<const char*>(memchr(p, ';', end - p));
+            p = semi ? semi : end;
+        } else {
+            const char* v = p;
+            while(p < end && *p != ';') p++;
+            StrView token = Trim(v, p);
+            value.assign(token.data(), token.size());
+        }
+    }
+    if(p < end) p++;                // ';'
+    return true;
+}
+
+// 头部值中第一个';'之前的部分 p指向之后的参数
+StrView HeadValue(const char*& p, const char* end) {
+    const char* semi = static_cast<const char*>(memchr(p, ';', end - p));
+    StrView v = Trim(p, semi ? semi : end);
+    p = semi ? semi + 1 : end;
+    return v;
+}
+
+}
+
+MultipartParser::MultipartParser(const string& boundary, Handler* handler):
+    delim_("\r\n--" + boundary), handler_(handler), state_(PREAMBLE), carry_("\r\n") {
+    part_.hasFilename = false;
+}
+
+bool MultipartParser::GetBoundary(StrView contentType, string& boundary) {
+    const char* p = contentType.data();
+    const char* end = p + contentType.size();
+    if(!HeadValue(p, end).EqualsNoCase("multipart/form-data")) return false;
+    StrView key;
+    string value;
+    while(NextParam(p, end, key, value)) {
+        if(key.EqualsNoCase("boundary")) {
+            if(value.empty() || value.size() > MAX_BOUNDARY) return false;
+            boundary = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* 数据态: 在输入中找分隔符 找到前的数据交出 输入结尾可能是分隔符开头的部分留在carry_
+   下次先把carry_补上至多一个分隔符长的新数据再找 跨两次输入的分隔符由此找到 */
+bool MultipartParser::Feed(const char* p, size_t len) {
+    const char* end = p + len;
+    while(p < end && state_ != ERROR && state_ != EPILOGUE) {
+        switch(state_) {
+        case PREAMBLE:
+        case DATA: {
+            if(!carry_.empty()) {
+                size_t old = carry_.size();
+                size_t take = min(static_cast<size_t>(end - p), delim_.size());
+                carry_.append(p, take);
+                const char* c = carry_.data();
+                const char* found = static_cast<const char*>(memmem(c, carry_.size(), delim_.data(), delim_.size()));
+                if(found) {
+                    size_t k = found - c;
+                    p += k + delim_.size() - old;
+                    if(!Emit_(c, k)) break;
+                    carry_.clear();
+                    OnDelimiter_();
+                    continue;
+                }
+                if(take < delim_.size()) {      // 输入已全部并入carry_
+                    size_t keep = HeldBack_(c, carry_.size());
+                    if(!Emit_(c, carry_.size() - keep)) break;
+                    carry_.erase(0, carry_.size() - keep);
+                    return true;
+                }
+                // 从旧数据开始的分隔符会完整地落在carry_中 没找到说明旧数据都不是分隔符
+                if(!Emit_(c, old)) break;
+                carry_.clear();
+            }
+            const char* found = static_cast<const char*>(memmem(p, end - p, delim_.data(), delim_.size()));
+            if(found) {
+                if(!Emit_(p, found - p)) break;
+                p = found + delim_.size();
+                OnDelimiter_();
+                continue;
+            }
+            size_t keep = HeldBack_(p, end - p);
+            if(!Emit_(p, end - p - keep)) break;
+            carry_.assign(end - keep, keep);
+            return true;
+        }
+        case DELIM_TAIL:
+            if(*p == '-') { state_ = DELIM_DASH; }
+            else if(*p == '\r') { state_ = DELIM_LF; }
+            else if(*p != ' ' && *p != '\t') { state_ = ERROR; }
+            p++;
+            break;
+        case DELIM_DASH:
+            state_ = *p++ == '-' ? EPILOGUE : ERROR;
+            break;
+        case DELIM_LF:
+            if(*p++ == '\n') {
+                state_ = HEADERS;
+                header_.assign("\r\n");
+            } else {
+                state_ = ERROR;
+            }
+            break;
+        case HEADERS: {
+            size_t old = header_.size();
+            size_t take = min(static_cast<size_t>(end - p), MAX_PART_HEADER + 2 - old);
+            header_.append(p, take);
+            size_t k = header_.find("\r\n\r\n", old >= 3 ? old - 3 : 0);
+            if(k == string::npos) {
+                if(header_.size() >= MAX_PART_HEADER + 2) { state_ = ERROR; }
+                p += take;
+                break;
+            }
+            p += k + 4 - old;
+            if(!ParseHeaders_(header_.data() + 2, k) || !handler_->OnPartBegin(part_)) {
+                state_ = ERROR;
+                break;
+            }
+            state_ = DATA;
+            break;
+        }
+        default:
+            break;
+        }
+    }
+    return state_ != ERROR;
+}
+
+bool MultipartParser::Emit_(const char* p, size_t len) {
+    if(state_ != DATA || len == 0) return true;
+    if(handler_->OnPartData(p, len)) return true;
+    state_ = ERROR;
+    return false;
+}
+
+// 分隔符以CR开头 只需检查最后(分隔符长度 - 1)个字节中的CR
+size_t MultipartParser::HeldBack_(const char* p, size_t len) const {
+    size_t from = len >= delim_.size() ? len - delim_.size() + 1 : 0;
+    const char* cr = static_cast<const char*>(memchr(p + from, '\r', len - from));
+    while(cr) {
+        size_t n = p + len - cr;
+        if(memcmp(cr, delim_.data(), n) == 0) return n;
+        cr = static_cast<const char*>(memchr(cr + 1, '\r', n - 1));
+    }
+    return 0;
+}
+
+bool MultipartParser::OnDelimiter_() {
+    if(state_ == DATA && !handler_->OnPartEnd()) {
+        state_ = ERROR;
+        return false;
+    }
+    state_ = DELIM_TAIL;
+    return true;
+}
+
+// 只关心Content-Disposition和Content-Type 其余头部忽略
+bool MultipartParser::ParseHeaders_(const char* p, size_t len) {
+    part_.name.clear();
+    part_.filename.clear();
+    part_.contentType.clear();
+    part_.hasFilename = false;
+    bool disposition = false;
+    const char* end = p + len;
+    while(p < end) {
+        const char* eol = static_cast<const char*>(memmem(p, end - p, "\r\n", 2));
+        const char* lineEnd = eol ? eol : end;
+        const char* colon = static_cast<const char*>(memchr(p, ':', lineEnd - p));
+        if(!colon) return false;
+        StrView name = Trim(p, colon);
+        const char* v = colon + 1;
+        if(name.EqualsNoCase("Content-Disposition")) {
+            if(!HeadValue(v, lineEnd).EqualsNoCase("form-data")) return false;
+            StrView key;
+            string value;
+            while(NextParam(v, lineEnd, key, value)) {
+                if(key.EqualsNoCase("name")) {
+                    part_.name = value;
+                } else if(key.EqualsNoCase("filename")) {
+                    part_.filename = value;
+                    part_.hasFilename = true;
+                }
+            }
+            disposition = true;
+        } else if(name.EqualsNoCase("Content-Type")) {
+            StrView type = Trim(v, lineEnd);
+            part_.contentType.assign(type.data(), type.size());
+        }
+        p = eol ? eol + 2 : end;
+    }
+    return disposition;
+}
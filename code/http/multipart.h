@@ -0,0 +1,66 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <string>
+
+#include "strview.h"
+
+/* multipart/form-data(RFC 7578)的流式解析器 数据可以任意切分后依次交给Feed
+   各部分的数据到达即交给Handler 不在内存中累积 只保留可能是分隔符开头的最多一个分隔符长的数据和当前部分的头部
+   分隔符为 CRLF "--" boundary 第一个分隔符前视为有一个CRLF 最后一个分隔符后接"--" 之后的数据忽略 */
+class MultipartParser {
+public:
+    struct Part {
+        std::string name;               // Content-Disposition的name
+        std::string filename;
+        std::string contentType;
+        bool hasFilename;               // 没有filename参数的是普通字段 有的是文件(filename可能为空)
+    };
+
+    class Handler {
+    public:
+        virtual ~Handler() = default;
+        // 返回false时停止解析 Feed返回false
+        virtual bool OnPartBegin(const Part& part) = 0;
+        virtual bool OnPartData(const char* data, size_t len) = 0;
+        virtual bool OnPartEnd() = 0;
+    };
+
+    enum STATE {
+        PREAMBLE,           // 第一个分隔符之前
+        DELIM_TAIL,         // 分隔符之后: "--"结束 或可选的空白后CRLF开始一个部分
+        DELIM_DASH,         // 已有一个'-'
+        DELIM_LF,           // 已有CR
+        HEADERS,
+        DATA,
+        EPILOGUE,           // 结束分隔符之后
+        ERROR,
+    };
+
+    MultipartParser(const std::string& boundary, Handler* handler);
+
+    // 从Content-Type中取出boundary 不是multipart/form-data或boundary不合法时返回false
+    static bool GetBoundary(StrView contentType, std::string& boundary);
+
+    bool Feed(const char* p, size_t len);       // 格式错误或Handler要求停止时返回false 之后不再处理
+    bool Finished() const { return state_ == EPILOGUE; }
+    STATE State() const { return state_; }
+
+    static const size_t MAX_BOUNDARY = 70;      // RFC 2046
+    static const size_t MAX_PART_HEADER = 8192;
+
+private:
+    bool Emit_(const char* p, size_t len);      // 分隔符之前的数据 前言丢弃 部分数据交给Handler
+    size_t HeldBack_(const char* p, size_t len) const;     // 结尾可能是分隔符开头的字节数
+    bool OnDelimiter_();
+    bool ParseHeaders_(const char* p, size_t len);
+
+    std::string delim_;                         // CRLF "--" boundary
+    Handler* handler_;
+    STATE state_;
+    std::string carry_;                         // 上次结尾可能是分隔符开头的数据 短于分隔符
+    std::string header_;                        // 当前部分的头部 前面补一个CRLF 便于找空行
+    Part part_;
+};
+
+#endif
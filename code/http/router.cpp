@@ -0,0 +1,146 @@
+#include "router.h"
+using namespace std;
+
+StrView RouteMatch::Param(StrView name) const {
+    for(int i = 0; i < paramCnt && i < (int)route->paramNames.size(); i++) {
+        if(name == StrView(route->paramNames[i].data(), route->paramNames[i].size())) {
+            return params[i];
+        }
+    }
+    return StrView();
+}
+
+Router::Router(): root_(new Node) {}
+
+Router::~Router() = default;
+
+// 沿静态片段下行 与已有子节点只有部分相同时在分叉处拆开
+Router::Node* Router::InsertStatic_(Node* n, const char* s, size_t len) {
+    while(len > 0) {
+        size_t idx = n->indices.find(s[0]);
+        if(idx == string::npos) {
+            unique_ptr<Node> child(new Node);
+            child->label.assign(s, len);
+            n->indices.push_back(s[0]);
+            n->children.push_back(move(child));
+            return n->children.back().get();
+        }
+        Node* child = n->children[idx].get();
+        size_t common = 0;
+        while(common < len && common < child->label.size() && child->label[common] == s[common]) {
+            common++;
+        }
+        if(common < child->label.size()) {
+            unique_ptr<Node> mid(new Node);
+            mid->label = child->label.substr(0, common);
+            child->label.erase(0, common);
+            mid->indices.push_back(child->label[0]);
+            mid->children.push_back(move(n->children[idx]));
+            n->children[idx] = move(mid);
+            child = n->children[idx].get();
+        }
+        n = child;
+        s += common;
+        len -= common;
+    }
+    return n;
+}
+
+bool Router::Add(const string& pattern, shared_ptr<const RouteHandler> handler) {
+    if(pattern.empty() || pattern[0] != '/' || !handler) return false;
+    Node* n = root_.get();
+    vector<string> names;
+    bool isPrefix = false;
+    size_t i = 0;
+    while(i < pattern.size()) {
+        if(pattern[i] == ':') {
+            size_t end = pattern.find('/', i);
+            if(end == string::npos) end = pattern.size();
+            // 参数占整个路径段
+            if(pattern[i - 1] != '/' || end == i + 1 || names.size() == RouteMatch::MAX_PARAMS
+               || pattern.find_first_of(":*", i + 1) < end) return false;
+            names.push_back(pattern.substr(i + 1, end - i - 1));
+            if(!n->param) n->param.reset(new Node);
+            n = n->param.get();
+            i = end;
+        } else if(pattern[i] == '*') {
+            if(i != pattern.size() - 1) return false;
+            isPrefix = true;
+            i++;
+        } else {
+            size_t end = pattern.find_first_of(":*", i);
+            if(end == string::npos) end = pattern.size();
+            n = InsertStatic_(n, pattern.data() + i, end - i);
+            i = end;
+        }
+    }
+    Route*& slot = isPrefix ? n->prefix : n->exact;
+    if(slot) {
+        slot->handler = move(handler);
+        slot->paramNames = move(names);
+        return true;
+    }
+    routes_.emplace_back(new Route{pattern, move(handler), move(names)});
+    slot = routes_.back().get();
+    return true;
+}
+
+bool Router::Match(StrView path, RouteMatch& match) const {
+    match.route = nullptr;
+    match.paramCnt = 0;
+    match.rest = StrView();
+    return Match_(root_.get(), path.data(), path.data() + path.size(), match);
+}
+
+// n的label已匹配 [p, end)为剩余路径
+bool Router::Match_(const Node* n, const char* p, const char* end, RouteMatch& match) const {
+    if(p == end && n->exact) {
+        match.route = n->exact;
+        return true;
+    }
+    if(p < end) {
+        const char* idx = static_cast<const char*>(memchr(n->indices.data(), *p, n->indices.size()));
+        if(idx) {
+            const Node* child = n->children[idx - n->indices.data()].get();
+            size_t len = child->label.size();
+            if(static_cast<size_t>(end - p) >= len && memcmp(p, child->label.data(), len) == 0
+               && Match_(child, p + len, end, match)) {
+                return true;
+            }
+        }
+        if(n->param && match.paramCnt < RouteMatch::MAX_PARAMS) {
+            const char* slash = static_cast<const char*>(memchr(p, '/', end - p));
+            const char* segEnd = slash ? slash : end;
+            if(segEnd > p) {
+                match.params[match.paramCnt++] = StrView(p, segEnd - p);
+                if(Match_(n->param.get(), segEnd, end, match)) return true;
+                match.paramCnt--;
+            }
+        }
+    }
+    if(n->prefix) {
+        match.route = n->prefix;
+        match.rest = StrView(p, end - p);
+        return true;
+    }
+    return false;
+}
+
+void StaticFileHandler::Handle(HttpRequest& request, const RouteMatch&) const {
+    size_t query = request.path().find('?');
+    if(query != string::npos) request.path().resize(query);
+}
+
+void PageHandler::Handle(HttpRequest& request, const RouteMatch&) const {
+    request.path() = page_;
+}
+
+void UserFormHandler::Handle(HttpRequest& request, const RouteMatch&) const {
+    if(!request.IsFormPost()) {
+        request.path() = page_;
+    } else if(HttpRequest::UserVerify(request.GetPost("username"), request.GetPost("password"), isLogin_)) {
+        request.path() = "/welcome.html";
+    } else {
+        request.path() = "/error.html";
+    }
+}
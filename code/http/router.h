@@ -0,0 +1,103 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "strview.h"
+#include "httprequest.h"
+
+class RouteHandler;
+
+struct Route {
+    std::string pattern;
+    std::shared_ptr<const RouteHandler> handler;
+    std::vector<std::string> paramNames;        // 按在模式中出现的顺序
+};
+
+// 一次匹配的结果 参数和剩余部分是指向被匹配路径的视图 不分配内存
+struct RouteMatch {
+    static const int MAX_PARAMS = 8;
+
+    const Route* route;
+    int paramCnt;
+    StrView params[MAX_PARAMS];
+    StrView rest;                               // 前缀路由"*"匹配到的部分
+
+    const RouteHandler& Handler() const { return *route->handler; }
+    StrView Param(StrView name) const;          // 没有该参数返回空视图
+};
+
+/* 请求的处理者 请求完整后由路由调用 通过改写request.path()决定返回哪个文件
+   match中的视图指向path() 改写路径前先取出参数 */
+class RouteHandler {
+public:
+    virtual ~RouteHandler() = default;
+    virtual void Handle(HttpRequest& request, const RouteMatch& match) const = 0;
+    // 头部解析完、请求体到达前调用 返回非空时请求体流式交给它 默认放在内存中
+    virtual std::unique_ptr<HttpRequest::BodySink> OpenBody(const HttpRequest& request, const RouteMatch& match) const {
+        return nullptr;
+    }
+};
+
+/* 压缩前缀树(radix trie)的路由表 启动时建好 之后只读 多线程并发查找无需加锁
+   模式以'/'开头: 静态片段按字符匹配 ":name"匹配一个非空的路径段 结尾的"*"匹配任意剩余部分(前缀路由)
+   同一节点下先试静态子节点 再试参数子节点 都不成立时用本节点的前缀路由 故静态 > 参数 > 前缀 前缀取最长的
+   查找沿树下行 每个节点按首字符选静态子节点 不回溯时为O(路径长度) 不分配内存 */
+class Router {
+public:
+    Router();
+    ~Router();
+
+    // 模式格式错误返回false 同一模式再次添加时覆盖之前的处理者
+    bool Add(const std::string& pattern, std::shared_ptr<const RouteHandler> handler);
+    bool Match(StrView path, RouteMatch& match) const;
+    size_t RouteCount() const { return routes_.size(); }
+
+private:
+    struct Node {
+        std::string label;                      // 从父节点到这里的静态片段 参数节点为空
+        std::string indices;                    // 静态子节点label的首字符 与children一一对应
+        std::vector<std::unique_ptr<Node>> children;
+        std::unique_ptr<Node> param;            // ":name"子节点 各路由的参数名可以不同
+        Route* exact;                           // 路径恰好在这里结束
+        Route* prefix;                          // 路径以这里为前缀
+        Node(): exact(nullptr), prefix(nullptr) {}
+    };
+
+    Node* InsertStatic_(Node* n, const char* s, size_t len);
+    bool Match_(const Node* n, const char* p, const char* end, RouteMatch& match) const;
+
+    std::unique_ptr<Node> root_;
+    std::vector<std::unique_ptr<Route>> routes_;
+};
+
+// 按请求路径返回静态文件 去掉查询串
+class StaticFileHandler: public RouteHandler {
+public:
+    void Handle(HttpRequest& request, const RouteMatch& match) const override;
+};
+
+// 返回固定的页面 如"/"返回"/index.html"
+class PageHandler: public RouteHandler {
+public:
+    explicit PageHandler(const std::string& page): page_(page) {}
+    void Handle(HttpRequest& request, const RouteMatch& match) const override;
+
+private:
+    std::string page_;
+};
+
+// 登录/注册: POST表单验证用户 成功返回欢迎页 失败返回错误页 其他请求返回表单页page
+class UserFormHandler: public RouteHandler {
+public:
+    UserFormHandler(const std::string& page, bool isLogin): page_(page), isLogin_(isLogin) {}
+    void Handle(HttpRequest& request, const RouteMatch& match) const override;
+
+private:
+    std::string page_;
+    bool isLogin_;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef STRVIEW_H
+#define STRVIEW_H
+
+#include <cstring>
+#include <string>
+
+/* 只读字符串视图 指向外部内存(如读缓冲区) 不持有也不复制 C++14没有std::string_view
+   底层内存被修改或搬移后失效 */
+class StrView {
+public:
+    StrView(): data_(nullptr), size_(0) {}
+    StrView(const char* data, size_t size): data_(data), size_(size) {}
+    StrView(const char* str): data_(str), size_(strlen(str)) {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    char operator[](size_t i) const { return data_[i]; }
+    std::string ToString() const { return std::string(data_, size_); }
+
+    bool operator==(StrView other) const {
+        return size_ == other.size_ && (size_ == 0 || memcmp(data_, other.data_, size_) == 0);
+    }
+    bool operator!=(StrView other) const { return !(*this == other); }
+
+    // ASCII不区分大小写比较 用于头部字段名等
+    bool EqualsNoCase(StrView other) const {
+        if(size_ != other.size_) return false;
+        for(size_t i = 0; i < size_; i++) {
+            if(Lower_(data_[i]) != Lower_(other.data_[i])) return false;
+        }
+        return true;
+    }
+
+private:
+    static char Lower_(char ch) { return (ch >= 'A' && ch <= 'Z') ? ch + ('a' - 'A') : ch; }
+
+    const char* data_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include "upload.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <errno.h>
+using namespace std;
+
+string UploadHandler::defaultDir_;
+
+UploadSink::UploadSink(const string& dir, const string& boundary, size_t maxBytes):
+    dir_(dir), parser_(boundary, this), bytes_(0), maxBytes_(maxBytes), fieldBytes_(0), fd_(-1), skip_(false) {
+    if(!dir_.empty() && dir_.back() != '/') dir_ += '/';
+}
+
+UploadSink::~UploadSink() {
+    Discard_();
+}
+
+bool UploadSink::OnEnd() {
+    if(!parser_.Finished()) {
+        LOG_ERROR("Multipart body truncated");
+        return false;
+    }
+    return true;
+}
+
+// 浏览器可能带上客户端的路径 只取最后一段 '.'开头的改掉 避免隐藏文件和与临时文件重名
+string UploadSink::SafeName(const string& filename) {
+    size_t slash = filename.find_last_of("/\\");
+    string name = filename.substr(slash == string::npos ? 0 : slash + 1, 200);
+    for(char& ch: name) {
+        unsigned char c = ch;
+        if(!(isalnum(c) || c == '.' || c == '-' || c == '_' || c >= 0x80)) ch = '_';
+    }
+    if(name.empty()) return "upload";
+    if(name[0] == '.') name[0] = '_';
+    return name;
+}
+
+bool UploadSink::OnPartBegin(const MultipartParser::Part& part) {
+    skip_ = false;
+    if(!part.hasFilename) {
+        fields_.emplace_back(part.name, string());
+        return true;
+    }
+    if(part.filename.empty()) {
+        skip_ = true;
+        return true;
+    }
+    name_ = SafeName(part.filename);
+    tmpPath_ = dir_ + ".upload-XXXXXX";
+    mkdir(dir_.c_str(), 0755);
+    fd_ = mkstemp(&tmpPath_[0]);
+    if(fd_ < 0) {
+        LOG_ERROR("Upload temp file error: %s %d", tmpPath_.c_str(), errno);
+        return false;
+    }
+    fchmod(fd_, 0644);
+    return true;
+}
+
+bool UploadSink::OnPartData(const char* data, size_t len) {
+    if(skip_) return true;
+    if(fd_ < 0) {
+        fieldBytes_ += len;
+        if(fieldBytes_ > MAX_FIELD_BYTES) {
+            LOG_WARN("Upload fields too large");
+            return false;
+        }
+        fields_.back().second.append(data, len);
+        return true;
+    }
+    bytes_ += len;
+    if(bytes_ > maxBytes_) {
+        LOG_WARN("Upload too large: %zu", bytes_);
+        return false;
+    }
+    while(len > 0) {
+        ssize_t n = write(fd_, data, len);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            LOG_ERROR("Upload write error: %d", errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool UploadSink::OnPartEnd() {
+    if(fd_ < 0) return true;
+    bool ok = Commit_();
+    Discard_();
+    return ok;
+}
+
+bool UploadSink::Commit_() {
+    size_t dot = name_.rfind('.');
+    if(dot == 0 || dot == string::npos) dot = name_.size();
+    for(int i = 0; i < 100; i++) {
+        string name = i == 0 ? name_ : name_.substr(0, dot) + "-" + to_string(i) + name_.substr(dot);
+        if(link(tmpPath_.c_str(), (dir_ + name).c_str()) == 0) {
+            LOG_INFO("Uploaded %s", name.c_str());
+            files_.push_back(name);
+            return true;
+        }
+        if(errno != EEXIST) break;
+    }
+    LOG_ERROR("Upload save error: %s %d", name_.c_str(), errno);
+    return false;
+}
+
+void UploadSink::Discard_() {
+    if(fd_ < 0) return;
+    close(fd_);
+    unlink(tmpPath_.c_str());
+    fd_ = -1;
+}
+
+void UploadHandler::SetDefaultDir(const string& dir) {
+    defaultDir_ = dir;
+}
+
+unique_ptr<HttpRequest::BodySink> UploadHandler::OpenBody(const HttpRequest& request, const RouteMatch&) const {
+    const string& dir = dir_.empty() ? defaultDir_ : dir_;
+    string boundary;
+    if(dir.empty() || request.method() != "POST"
+       || !MultipartParser::GetBoundary(request.GetHeader(HttpRequest::HDR_CONTENT_TYPE), boundary)) {
+        return nullptr;
+    }
+    return unique_ptr<HttpRequest::BodySink>(new UploadSink(dir, boundary, maxBytes_));
+}
+
+// 请求体出错时解析器返回错误码 不会到这里
+void UploadHandler::Handle(HttpRequest& request, const RouteMatch&) const {
+    if(request.method() != "POST") {
+        request.path() = page_;
+        return;
+    }
+    const UploadSink* sink = dynamic_cast<const UploadSink*>(request.GetBodySink());
+    request.path() = sink && !sink->Files().empty() ? page_ : "/error.html";
+}
@@ -0,0 +1,70 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "multipart.h"
+#include "router.h"
+
+/* multipart/form-data上传的请求体接收者 文件部分到达即从读缓冲区write到目录下的临时文件
+   部分结束时以link改为上传的文件名 同名文件已存在时加"-1" "-2"... 不覆盖 请求失败时删除临时文件
+   内存中只有解析器的少量状态和普通字段 与上传大小无关
+   write在磁盘跟不上时阻塞 这期间连接不再读 套接字缓冲区满后TCP窗口关闭 客户端随之放慢 */
+class UploadSink: public HttpRequest::BodySink, private MultipartParser::Handler {
+public:
+    UploadSink(const std::string& dir, const std::string& boundary, size_t maxBytes);
+    ~UploadSink() override;
+
+    bool OnData(const char* data, size_t len) override { return parser_.Feed(data, len); }
+    bool OnEnd() override;
+
+    const std::vector<std::string>& Files() const { return files_; }       // 保存的文件名 按上传顺序
+    const std::vector<std::pair<std::string, std::string>>& Fields() const { return fields_; }
+
+    static std::string SafeName(const std::string& filename);   // 去掉目录 只保留安全的字符
+
+    static const size_t MAX_FIELD_BYTES = 65536;                // 普通字段合计的上限
+
+private:
+    bool OnPartBegin(const MultipartParser::Part& part) override;
+    bool OnPartData(const char* data, size_t len) override;
+    bool OnPartEnd() override;
+    bool Commit_();                                             // 临时文件改为正式的文件名
+    void Discard_();
+
+    std::string dir_;                           // 以'/'结尾
+    MultipartParser parser_;
+    size_t bytes_, maxBytes_;                   // 文件部分已写入的字节数和上限
+    size_t fieldBytes_;
+    int fd_;                                    // 当前文件部分的临时文件 -1为当前部分不是文件
+    bool skip_;                                 // 没有选择文件的空文件部分 数据丢弃
+    std::string tmpPath_, name_;
+    std::vector<std::string> files_;
+    std::vector<std::pair<std::string, std::string>> fields_;
+};
+
+/* 上传页面: GET返回page POST multipart/form-data时流式保存文件 成功返回page 失败返回错误页
+   目录为空时使用SetDefaultDir设置的目录 两者都没有时不接受上传 */
+class UploadHandler: public RouteHandler {
+public:
+    explicit UploadHandler(const std::string& page, const std::string& dir = std::string(),
+                           size_t maxBytes = DEFAULT_MAX_UPLOAD):
+        page_(page), dir_(dir), maxBytes_(maxBytes) {}
+
+    void Handle(HttpRequest& request, const RouteMatch& match) const override;
+    std::unique_ptr<HttpRequest::BodySink> OpenBody(const HttpRequest& request, const RouteMatch& match) const override;
+
+    static void SetDefaultDir(const std::string& dir);          // 需在服务器启动前设置
+
+    static const size_t DEFAULT_MAX_UPLOAD = 1UL << 30;         // 一个请求中所有文件合计的上限
+
+private:
+    std::string page_, dir_;
+    size_t maxBytes_;
+
+    static std::string defaultDir_;
+};
+
+#endif
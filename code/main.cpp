@@ -5,6 +5,7 @@ int main() {
     WebServer server(
         9006, 3, 60000, false,                  /* 端口 ET模式 timeoutMS 优雅退出 */
         3306, "root", "qwer", "yourdb",     /* Mysql配置 */
-        12, 6, true, 1, 1024);                  /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列数量*/
+        12, 6, true, 1, 1024,                   /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列数量*/
+        0, false, false, true, false, 2, 16);   /* Reactor数量(0为单Reactor+线程池) 按CPU分发连接 io_uring 小请求就地处理 连接亲和 blocking通道线程数 io通道最大线程数 */
     server.Start();
 }
@@ -0,0 +1,23 @@
+#include "executor.h"
+
+ThreadPool* Executor::AddLane(const std::string& name, size_t threadCount, size_t queueLimit, bool affine,
+                              size_t maxThreads) {
+    assert(!Lane(name));
+    lanes_.emplace_back(name, std::unique_ptr<ThreadPool>(new ThreadPool(threadCount, affine, maxThreads)));
+    ThreadPool* lane = lanes_.back().second.get();
+    lane->SetQueueLimit(queueLimit);
+    return lane;
+}
+
+ThreadPool* Executor::Lane(const std::string& name) const {
+    for(auto& lane: lanes_) {
+        if(lane.first == name) return lane.second.get();
+    }
+    return nullptr;
+}
+
+void Executor::SetOpHandler(ThreadPool::OpHandler handler, void* ctx) {
+    for(auto& lane: lanes_) {
+        lane.second->SetOpHandler(handler, ctx);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "threadpool.h"
+
+/* 按名字区分的执行通道 每个通道是一个独立的线程池 线程数和排队上限各自配置
+   如"io"通道处理静态文件 "blocking"通道处理会阻塞在数据库上的请求 慢的数据库不会占满io通道的线程 */
+class Executor {
+public:
+    Executor() = default;
+    ~Executor() = default;
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // queueLimit为0表示不限制排队任务数 maxThreads大于threadCount时线程数在两者之间动态调整
+    ThreadPool* AddLane(const std::string& name, size_t threadCount, size_t queueLimit = 0, bool affine = false,
+                        size_t maxThreads = 0);
+    ThreadPool* Lane(const std::string& name) const;    // 不存在返回nullptr
+
+    void SetOpHandler(ThreadPool::OpHandler handler, void* ctx);    // 设置所有通道的操作处理函数
+    size_t LaneCount() const { return lanes_.size(); }
+
+private:
+    std::vector<std::pair<std::string, std::unique_ptr<ThreadPool>>> lanes_;
+};
+
+#endif
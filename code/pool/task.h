@@ -0,0 +1,105 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
+#include <assert.h>
+
+/* 定长、只可移动的任务 可调用对象直接存放在内部缓冲区 不在堆上分配
+   捕获超过INLINE_SIZE时编译报错 而不是像std::function那样退回堆分配 */
+class Task {
+public:
+    static const size_t INLINE_SIZE = 48;
+
+    Task() noexcept: ops_(nullptr) {}
+
+    template<typename F, typename Fn = typename std::decay<F>::type,
+             typename = typename std::enable_if<!std::is_same<Fn, Task>::value>::type>
+    Task(F&& f): ops_(nullptr) {
+        Emplace_<Fn>(std::forward<F>(f));
+    }
+
+    Task(Task&& other) noexcept: ops_(nullptr) {
+        MoveFrom_(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if(this != &other) {
+            Reset();
+            MoveFrom_(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { Reset(); }
+
+    void operator()() {
+        assert(ops_);
+        ops_->invoke(buf_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    // 在空的Task中原地构造 省去构造临时Task再移动
+    template<typename F, typename Fn = typename std::decay<F>::type>
+    void Emplace(F&& f) {
+        assert(!ops_);
+        Emplace_<Fn>(std::forward<F>(f));
+    }
+
+    void Reset() {
+        if(ops_) {
+            ops_->destroy(buf_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void* self);
+        void (*move)(void* dst, void* src);     // 移动构造到dst并析构src
+        void (*destroy)(void* self);
+    };
+
+    template<typename Fn>
+    struct OpsFor {
+        static void Invoke(void* self) { (*static_cast<Fn*>(self))(); }
+        static void Move(void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        }
+        static void Destroy(void* self) { static_cast<Fn*>(self)->~Fn(); }
+        static const Ops table;
+    };
+
+    template<typename Fn, typename F>
+    void Emplace_(F&& f) {
+        static_assert(sizeof(Fn) <= INLINE_SIZE, "task captures too large for inline storage");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "task captures over-aligned");
+        new (buf_) Fn(std::forward<F>(f));
+        ops_ = &OpsFor<Fn>::table;
+    }
+
+    void MoveFrom_(Task& other) {
+        if(other.ops_) {
+            other.ops_->move(buf_, other.buf_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char buf_[INLINE_SIZE];
+    const Ops* ops_;
+};
+
+template<typename Fn>
+const Task::Ops Task::OpsFor<Fn>::table = {
+    &Task::OpsFor<Fn>::Invoke, &Task::OpsFor<Fn>::Move, &Task::OpsFor<Fn>::Destroy
+};
+
+#endif
@@ -0,0 +1,504 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+const int SPIN_ROUNDS = 64;             // 休眠前自旋查找的轮数
+const size_t INJECT_BATCH = 32;         // 一次从注入队列搬到本地的最大任务数
+const size_t INJECT_INIT = 1024;        // 注入队列初始容量 2的幂
+const int MONITOR_TICK_MS = 5;          // 动态线程数的监控周期
+
+/* 当前线程所属的线程池和工作线程 外部线程为nullptr */
+thread_local void* tlsPool = nullptr;
+thread_local void* tlsWorker = nullptr;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// 微秒数所在的直方图桶
+inline int HistBucket(int64_t ns) {
+    uint64_t us = ns > 0 ? static_cast<uint64_t>(ns) / 1000 : 0;
+    int b = us ? 64 - __builtin_clzll(us) : 0;
+    return b < ThreadPool::HIST_BUCKETS ? b : ThreadPool::HIST_BUCKETS - 1;
+}
+
+// 只有一个写者的计数器 不需要原子的读-改-写
+inline void Bump(std::atomic<unsigned long long>& cnt) {
+    cnt.store(cnt.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+}
+
+ThreadPool::ThreadPool(size_t threadCount, bool affine, size_t maxThreads, int growDelayMs, int coolDownMs):
+    pool_(std::make_shared<Pool>()){
+    assert(threadCount > 0);
+    pool_->affine = affine;
+    pool_->minThreads = threadCount;
+    pool_->growDelayMs = growDelayMs;
+    pool_->coolDownMs = coolDownMs;
+    // 全部Worker建好后再启动线程 窃取时需要遍历workers
+    for(size_t i = 0; i < std::max(threadCount, maxThreads); i++){
+        pool_->workers.emplace_back(new Worker(i));
+    }
+    pool_->activeCnt = threadCount;
+    pool_->lastResizeNs = Pool::NowNs();
+    for(size_t i = 0; i < threadCount; i++){
+        pool_->Start(pool_->workers[i].get());
+    }
+    if(maxThreads > threadCount){
+        std::thread([pool = pool_] { pool->Monitor(); }).detach();
+    }
+}
+
+ThreadPool::Telemetry ThreadPool::GetTelemetry() const{
+    Telemetry t;
+    memset(&t, 0, sizeof(t));
+    if(!pool_) return t;
+    t.threads = pool_->activeCnt.load();
+    t.queueDepth = pool_->Pending();
+    t.stolen = pool_->stolenCnt.load();
+    t.grown = pool_->grownCnt.load();
+    t.retired = pool_->retiredCnt.load();
+    for(auto& w: pool_->workers){
+        t.executed += w->executed.load(std::memory_order_relaxed);
+        for(int b = 0; b < HIST_BUCKETS; b++){
+            t.waitHist[b] += w->waitHist[b].load(std::memory_order_relaxed);
+            t.runHist[b] += w->runHist[b].load(std::memory_order_relaxed);
+        }
+    }
+    return t;
+}
+
+double ThreadPool::Telemetry::Percentile(const unsigned long long* hist, double p){
+    unsigned long long total = 0;
+    for(int b = 0; b < HIST_BUCKETS; b++) total += hist[b];
+    if(total == 0) return 0;
+    unsigned long long rank = static_cast<unsigned long long>(p * total);
+    unsigned long long seen = 0;
+    for(int b = 0; b < HIST_BUCKETS; b++){
+        seen += hist[b];
+        if(seen > rank) return static_cast<double>(1ull << b);
+    }
+    return static_cast<double>(1ull << (HIST_BUCKETS - 1));
+}
+
+ThreadPool::~ThreadPool(){
+    if(static_cast<bool>(pool_)){
+        pool_->Close();         // 唤醒所有线程 处理剩下任务后退出
+    }
+}
+
+void ThreadPool::JobRing::Push(uint64_t job){
+    if(Size() == buf.size()){
+        std::vector<uint64_t> bigger(buf.size() * 2);
+        for(size_t i = head; i < tail; i++){
+            bigger[i - head] = buf[i & (buf.size() - 1)];
+        }
+        buf.swap(bigger);
+        tail -= head;
+        head = 0;
+    }
+    buf[tail++ & (buf.size() - 1)] = job;
+}
+
+ThreadPool::Pool::Pool(): activeCnt(0), minThreads(0), growDelayMs(0), coolDownMs(0),
+    lastResizeNs(0), grownCnt(0), retiredCnt(0), affine(false), stolenCnt(0), queueLimit(0), handler(nullptr), handlerCtx(nullptr), chunkCnt(0), freeHead(0),
+    inject(INJECT_INIT), injectSize(0), injected(0),
+    idleCnt(0), spinning(0), isClosed(false){
+    for(uint32_t i = 0; i < MAX_CHUNKS; i++){
+        chunks[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+ThreadPool::Pool::~Pool(){
+    // 未执行的任务随节点块一起析构
+    for(uint32_t i = 0; i < chunkCnt; i++){
+        delete[] chunks[i].load();
+    }
+}
+
+uint32_t ThreadPool::Pool::AllocNode(){
+    while(true){
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+        uint32_t top = static_cast<uint32_t>(head);
+        if(top == 0){
+            // 空闲链表为空 分配一整块节点 除第一个外挂到链表上
+            std::lock_guard<std::mutex> locker(growMtx);
+            if(static_cast<uint32_t>(freeHead.load()) != 0) continue;
+            if(chunkCnt == MAX_CHUNKS) throw std::bad_alloc();
+            uint32_t base = chunkCnt * NODE_CHUNK;
+            TaskNode* chunk = new TaskNode[NODE_CHUNK];
+            chunks[chunkCnt++].store(chunk, std::memory_order_release);
+            for(uint32_t i = 1; i + 1 < NODE_CHUNK; i++){
+                chunk[i].next.store(base + i + 2, std::memory_order_relaxed);      // 下标+1
+            }
+            FreeChain_(base + 1, base + NODE_CHUNK - 1);
+            return base;
+        }
+        uint32_t next = Node(top - 1).next.load(std::memory_order_relaxed);
+        uint64_t newHead = ((head >> 32) + 1) << 32 | next;
+        if(freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel)){
+            return top - 1;
+        }
+    }
+}
+
+void ThreadPool::Pool::FreeNode_(uint32_t idx){
+    FreeChain_(idx, idx);
+}
+
+void ThreadPool::Pool::FreeChain_(uint32_t first, uint32_t last){
+    uint64_t head = freeHead.load(std::memory_order_relaxed);
+    while(true){
+        Node(last).next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        uint64_t newHead = ((head >> 32) + 1) << 32 | (first + 1);
+        if(freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) return;
+    }
+}
+
+void ThreadPool::Pool::FlushFree_(Worker* w){
+    if(w->freeCnt == 0) return;
+    FreeChain_(w->freeFirst, w->freeLast);
+    w->freeCnt = 0;
+}
+
+size_t ThreadPool::Pool::Pending() const{
+    unsigned long long submitted = injected.load(std::memory_order_relaxed), started = 0;
+    for(auto& w: workers){
+        submitted += w->pushed.load(std::memory_order_relaxed) + w->boxed.load(std::memory_order_relaxed);
+        started += w->started.load(std::memory_order_relaxed);
+    }
+    return submitted > started ? static_cast<size_t>(submitted - started) : 0;
+}
+
+void ThreadPool::Pool::Push(uint64_t job){
+    if(affine && (job & 1)){
+        PushAffine_(workers[(job >> 32) % activeCnt.load(std::memory_order_relaxed)].get(), job);
+        return;
+    }
+    bool wake;
+    if(tlsPool == this){
+        // 工作线程内提交 放入本地队列 空闲线程可窃取
+        Worker* w = static_cast<Worker*>(tlsWorker);
+        w->deque.Push(job);
+        Bump(w->pushed);
+        // 与Park_中登记idle后的复查配对 保证任务可见或能看到休眠线程
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wake = spinning.load(std::memory_order_relaxed) == 0 && idleCnt.load(std::memory_order_relaxed) > 0;
+    } else {
+        std::lock_guard<std::mutex> locker(injectMtx);
+        inject.Push(job);
+        injectSize.store(injectSize.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        Bump(injected);
+        // 持锁读 Park_登记idle后也持锁复查注入队列 两者由injectMtx排序 外部提交不需要fence
+        wake = spinning.load(std::memory_order_relaxed) == 0 && idleCnt.load(std::memory_order_relaxed) > 0;
+    }
+    if(wake) WakeOne_();
+}
+
+void ThreadPool::Pool::PushAffine_(Worker* w, uint64_t job){
+    size_t size;
+    {
+        std::lock_guard<std::mutex> locker(w->boxMtx);
+        w->box.Push(job);
+        size = w->boxSize.load(std::memory_order_relaxed) + 1;
+        w->boxSize.store(size, std::memory_order_relaxed);
+        Bump(w->boxed);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(w->isIdle.load(std::memory_order_relaxed)){
+        WakeWorker_(w);
+    } else if(!w->active.load(std::memory_order_relaxed)){
+        WakeOne_();     // 目标线程恰好退出 邮箱中的任务由其他线程窃取
+    } else if(size >= AFFINE_SATURATED && spinning.load(std::memory_order_relaxed) == 0
+                && idleCnt.load(std::memory_order_relaxed) > 0){
+        WakeOne_();     // 所属线程忙不过来 叫醒一个线程来分担
+    }
+}
+
+void ThreadPool::Pool::Close(){
+    {
+        std::lock_guard<std::mutex> locker(monitorMtx);
+        isClosed.store(true);
+    }
+    monitorCond.notify_all();
+    for(auto& w: workers){
+        std::lock_guard<std::mutex> locker(w->mtx);
+        w->notified = true;
+        w->cond.notify_one();
+    }
+}
+
+void ThreadPool::Pool::Start(Worker* w){
+    w->active.store(true);
+    w->running.store(true);
+    std::thread([pool = shared_from_this(), w] {
+        pool->Run(w);
+    }).detach();
+}
+
+void ThreadPool::Pool::Monitor(){
+    int64_t delayedSince = 0;       // 排队延迟开始超过阈值的时刻 0表示当前未超过
+    unsigned long long lastExecuted = 0;
+    std::unique_lock<std::mutex> locker(monitorMtx);
+    while(!isClosed.load()){
+        monitorCond.wait_for(locker, std::chrono::milliseconds(MONITOR_TICK_MS));
+        int64_t now = NowNs();
+        int64_t delay = growDelayMs * 1000000LL;
+        int64_t waitEwma = 0;
+        unsigned long long executed = 0;
+        size_t n = activeCnt.load();
+        for(size_t i = 0; i < workers.size(); i++){
+            executed += workers[i]->executed.load(std::memory_order_relaxed);
+            if(i < n) waitEwma += workers[i]->waitEwmaNs.load(std::memory_order_relaxed) / static_cast<int64_t>(n);
+        }
+        // 近期任务平均等待过久 或所有线程都被占住、排队任务一个周期内没有进展
+        bool stalled = (executed == lastExecuted);
+        lastExecuted = executed;
+        bool delayed = Pending() > 0 && (waitEwma > delay || stalled);
+        if(!delayed){
+            delayedSince = 0;
+            continue;
+        }
+        if(delayedSince == 0) delayedSince = now;
+        if(now - delayedSince < delay) continue;
+        std::lock_guard<std::mutex> resizeLocker(resizeMtx);
+        n = activeCnt.load();
+        if(n == workers.size() || now - lastResizeNs.load() < coolDownMs * 1000000LL / 10) continue;
+        Worker* w = workers[n].get();
+        if(w->running.load()) continue;     // 上一个使用该位置的线程还未退出
+        Start(w);
+        activeCnt.store(n + 1);
+        lastResizeNs.store(now);
+        grownCnt++;
+        delayedSince = 0;
+    }
+}
+
+void ThreadPool::Pool::Run(Worker* w){
+    tlsPool = this;
+    tlsWorker = w;
+    while(true){
+        uint64_t job;
+        bool found = Find_(w, job);
+        // 自旋的线程不超过活跃线程的一半 其余直接休眠 线程多时不让大家反复扫描彼此的队列
+        if(!found && spinning.load(std::memory_order_relaxed) * 2 < activeCnt.load(std::memory_order_relaxed)){
+            spinning.fetch_add(1);
+            for(int i = 0; i < SPIN_ROUNDS && !found; i++){
+                CpuRelax();
+                found = Find_(w, job);
+            }
+            // 最后一个自旋线程找到了任务 由它再唤醒一个线程接替找任务 应对突发
+            if(spinning.fetch_sub(1) == 1 && found && idleCnt.load() > 0){
+                WakeOne_();
+            }
+        }
+        if(found){
+            Execute_(job);
+            continue;
+        }
+        if(isClosed.load() && !HasWork_(w)) break;
+        if(Park_(w)) break;
+    }
+    FlushFree_(w);
+    tlsPool = nullptr;
+    tlsWorker = nullptr;
+    w->running.store(false);
+}
+
+void ThreadPool::Pool::Execute_(uint64_t job){
+    Worker* w = static_cast<Worker*>(tlsWorker);
+    Bump(w->started);
+    uint64_t tick = (job & 1) ? (job >> (OP_BITS + 1)) & OP_TICK_MASK : 0;
+    int64_t enqueueNs = (job & 1) ? 0 : Node(static_cast<uint32_t>(job >> 1)).enqueueNs;
+    bool sampled = (tick != 0 || enqueueNs != 0);
+    int64_t start = 0;
+    if(sampled){
+        start = NowNs();
+        int64_t wait = start - enqueueNs;
+        if(job & 1){
+            wait = static_cast<int64_t>((((static_cast<uint64_t>(start) >> OP_TICK_SHIFT) - tick) & OP_TICK_MASK) << OP_TICK_SHIFT);
+        }
+        Bump(w->waitHist[HistBucket(wait)]);
+        int64_t ewma = w->waitEwmaNs.load(std::memory_order_relaxed);
+        w->waitEwmaNs.store(ewma + (wait - ewma) / 8, std::memory_order_relaxed);
+    }
+
+    if(job & 1){
+        handler(handlerCtx, static_cast<int>((job >> 1) & ((1u << OP_BITS) - 1)), static_cast<uint32_t>(job >> 32));
+    } else {
+        // 在节点内原地执行和析构 不搬出任务
+        uint32_t idx = static_cast<uint32_t>(job >> 1);
+        Task& task = Node(idx).task;
+        task();
+        task.Reset();
+        // 先放在本线程 攒够一批再还 提交线程取节点时不必每个任务都与执行线程争用空闲链表头
+        Node(idx).next.store(w->freeCnt ? w->freeFirst + 1 : 0, std::memory_order_relaxed);
+        if(w->freeCnt++ == 0) w->freeLast = idx;
+        w->freeFirst = idx;
+        if(w->freeCnt == FREE_BATCH) FlushFree_(w);
+    }
+    if(sampled) Bump(w->runHist[HistBucket(NowNs() - start)]);
+    Bump(w->executed);
+}
+
+bool ThreadPool::Pool::Find_(Worker* w, uint64_t& job){
+    if(w->deque.Take(job)) return true;
+    if(w->boxSize.load(std::memory_order_relaxed) > 0 && PopBox_(w, job)) return true;
+    if(injectSize.load(std::memory_order_relaxed) > 0 && PopInject_(w, job)) return true;
+    return Steal_(w, job);
+}
+
+bool ThreadPool::Pool::PopInject_(Worker* w, uint64_t& job){
+    std::lock_guard<std::mutex> locker(injectMtx);
+    if(inject.Size() == 0) return false;
+    job = inject.Pop();
+    // 按线程数均分 多拿的放进本地队列 减少注入队列锁的争用 其他线程仍可窃取
+    size_t n = std::min(inject.Size() / activeCnt.load(std::memory_order_relaxed), INJECT_BATCH);
+    for(size_t i = 0; i < n; i++){
+        w->deque.Push(inject.Pop());
+    }
+    injectSize.store(inject.Size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::Pool::PopBox_(Worker* w, uint64_t& job){
+    std::lock_guard<std::mutex> locker(w->boxMtx);
+    if(w->box.Size() == 0) return false;
+    job = w->box.Pop();
+    w->boxSize.store(w->box.Size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool ThreadPool::Pool::Steal_(Worker* w, uint64_t& job){
+    size_t n = workers.size();
+    if(n <= 1) return false;
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+    size_t start = w->seed % n;
+    for(size_t i = 0; i < n; i++){
+        Worker* victim = workers[(start + i) % n].get();
+        if(victim != w && victim->deque.Steal(job)) return true;
+    }
+    // 只从饱和或已退出线程的邮箱中窃取 否则连接任务留给所属线程
+    for(size_t i = 0; affine && i < n; i++){
+        Worker* victim = workers[(start + i) % n].get();
+        if(victim != w && Stealable_(victim) && PopBox_(victim, job)){
+            stolenCnt.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::Pool::HasWork_(Worker* w) const{
+    if(w->boxSize.load(std::memory_order_relaxed) > 0) return true;
+    if(injectSize.load(std::memory_order_relaxed) > 0) return true;
+    for(auto& other: workers){
+        if(!other->deque.Empty()) return true;
+        if(Stealable_(other.get())) return true;
+    }
+    return false;
+}
+
+bool ThreadPool::Pool::Stealable_(Worker* w) const{
+    size_t size = w->boxSize.load(std::memory_order_relaxed);
+    return size >= AFFINE_SATURATED || (size > 0 && !w->active.load(std::memory_order_relaxed));
+}
+
+bool ThreadPool::Pool::Park_(Worker* w){
+    FlushFree_(w);
+    {
+        std::lock_guard<std::mutex> locker(idleMtx);
+        idle.push_back(w);
+        w->isIdle.store(true, std::memory_order_relaxed);
+        idleCnt.fetch_add(1, std::memory_order_relaxed);
+    }
+    // 登记之后再复查一次 与Push中的fence或injectMtx配对 避免丢失唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool injectPending;
+    {
+        std::lock_guard<std::mutex> locker(injectMtx);
+        injectPending = inject.Size() > 0;
+    }
+    if(injectPending || HasWork_(w) || isClosed.load()){
+        std::lock_guard<std::mutex> locker(idleMtx);
+        if(w->isIdle.load(std::memory_order_relaxed)){
+            idle.erase(std::find(idle.begin(), idle.end(), w));
+            w->isIdle.store(false, std::memory_order_relaxed);
+            idleCnt.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        // 已被WakeOne_取走 下面的wait会立即返回
+    }
+    std::unique_lock<std::mutex> locker(w->mtx);
+    if(minThreads == workers.size()){
+        w->cond.wait(locker, [w] { return w->notified; });
+    } else if(!w->cond.wait_for(locker, std::chrono::milliseconds(coolDownMs), [w] { return w->notified; })){
+        // 空闲超过冷却时间 离开idle列表后尝试退出
+        locker.unlock();
+        {
+            std::lock_guard<std::mutex> idleLocker(idleMtx);
+            if(!w->isIdle.load(std::memory_order_relaxed)) return false;    // 刚被唤醒 通知留到下次休眠时消费
+            idle.erase(std::find(idle.begin(), idle.end(), w));
+            w->isIdle.store(false, std::memory_order_relaxed);
+            idleCnt.fetch_sub(1, std::memory_order_relaxed);
+        }
+        return TryRetire_(w);
+    }
+    w->notified = false;
+    return false;
+}
+
+bool ThreadPool::Pool::TryRetire_(Worker* w){
+    std::lock_guard<std::mutex> locker(resizeMtx);
+    size_t n = activeCnt.load();
+    int64_t now = NowNs();
+    if(w->id + 1 != n || n <= minThreads || now - lastResizeNs.load() < coolDownMs * 1000000LL) return false;
+    w->active.store(false);
+    // 与PushAffine_中的fence配对 退出前投进来的亲和任务由自己处理
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(w->boxSize.load(std::memory_order_relaxed) > 0 || !w->deque.Empty()){
+        w->active.store(true);
+        return false;
+    }
+    activeCnt.store(n - 1);
+    lastResizeNs.store(now);
+    retiredCnt++;
+    return true;
+}
+
+void ThreadPool::Pool::WakeOne_(){
+    Worker* w;
+    {
+        std::lock_guard<std::mutex> locker(idleMtx);
+        if(idle.empty()) return;
+        w = idle.back();            // 后进先出 唤醒最近休眠、缓存较热的线程
+        idle.pop_back();
+        w->isIdle.store(false, std::memory_order_relaxed);
+        idleCnt.fetch_sub(1, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> locker(w->mtx);
+    w->notified = true;
+    w->cond.notify_one();
+}
+
+void ThreadPool::Pool::WakeWorker_(Worker* w){
+    {
+        std::lock_guard<std::mutex> locker(idleMtx);
+        if(!w->isIdle.load(std::memory_order_relaxed)) return;
+        idle.erase(std::find(idle.begin(), idle.end(), w));
+        w->isIdle.store(false, std::memory_order_relaxed);
+        idleCnt.fetch_sub(1, std::memory_order_relaxed);
+    }
+    std::lock_guard<std::mutex> locker(w->mtx);
+    w->notified = true;
+    w->cond.notify_one();
+}
@@ -3,64 +3,250 @@
 
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <vector>
 #include <thread>
-#include <functional>
+#include <atomic>
+#include <memory>
+#include <chrono>
 #include <assert.h>
+#include "task.h"
+#include "workdeque.h"
 
+/* 工作窃取线程池
+   每个工作线程有自己的Chase-Lev双端队列 外部线程提交的任务进入全局注入队列
+   取任务顺序: 本地队列 -> 注入队列(批量搬到本地) -> 随机窃取其他线程
+   没有任务时先自旋一段时间再休眠(同时自旋的不超过一半线程) 提交任务时只唤醒一个休眠线程 且已有线程在自旋时不唤醒
+   排队深度由各线程的提交/开始计数相减得到 执行完的节点在本线程攒一批再归还 热路径上提交者与执行者不共享原子计数器
+
+   队列中只存放64位的任务字 最低位为0时是任务节点的下标 为1时是(操作码, 连接槽)对
+   任务节点取自池内的空闲链表 预热后提交任务不再分配堆内存
+   (操作码, 连接槽)任务字: [63:32]连接槽 [31:9]入队时刻(OP_TICK_SHIFT纳秒为单位 约137秒回绕) [8:1]操作码 [0]为1
+   取时钟每次约数十纳秒 每个提交线程只给1/2^SAMPLE_SHIFT的任务打入队时刻 直方图只统计这些抽样任务 入队时刻为0表示未抽样
+
+   动态线程数: maxThreads大于threadCount时 监控线程发现排队延迟持续超过growDelayMs就增加一个线程
+   空闲超过coolDownMs的线程退出 线程数保持在[threadCount, maxThreads]
+   增加线程与上次调整至少间隔coolDownMs/10 退出线程至少间隔coolDownMs 负载抖动时不会反复增减
+   活跃线程始终是workers的前n个 只有下标最大的活跃线程可以退出 亲和模式按n取模投递
+
+   连接亲和模式: (操作码, 连接槽)任务按槽号固定投递到某个工作线程的邮箱 同一连接的状态留在同一核的缓存中
+   邮箱积压到AFFINE_SATURATED以上才允许其他线程窃取 */
 class ThreadPool{
 public:
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()){
-        assert(threadCount > 0);
-        for(size_t i = 0; i < threadCount; i++){
-            std::thread([pool = pool_] {
-                std::unique_lock<std::mutex> locker(pool->mtx);
-                while(true){
-                    if(!pool->tasks.empty()){
-                        auto task = std::move(pool->tasks.front());
-                        pool->tasks.pop();
-                        locker.unlock();    // 任务已取出 可提前解锁
-                        task();             // do task
-                        locker.lock();      // 马上又要取任务 上锁
-                    }
-                    else if(pool->isClosed) break;
-                    else pool->cond.wait(locker);   // 等待 任务来了就notify
-                }
-            }).detach();
-        }
-    }
+    // (操作码, 连接槽)任务的处理函数 由工作线程调用
+    typedef void (*OpHandler)(void* ctx, int op, uint32_t slot);
+
+    // 排队等待和执行时间的直方图(抽样) 第i桶为[2^(i-1), 2^i)微秒 第0桶为不足1微秒
+    static const int HIST_BUCKETS = 24;
+
+    struct Telemetry{
+        size_t threads;                 // 当前线程数
+        size_t queueDepth;              // 已提交未开始执行的任务数
+        unsigned long long executed;    // 已执行的任务数
+        unsigned long long stolen;      // 被非所属线程执行的亲和任务数
+        unsigned long long grown;       // 动态增加的线程数
+        unsigned long long retired;     // 空闲退出的线程数
+        unsigned long long waitHist[HIST_BUCKETS];
+        unsigned long long runHist[HIST_BUCKETS];
+
+        // 直方图的百分位 返回所在桶的上界(微秒)
+        static double Percentile(const unsigned long long* hist, double p);
+        double WaitUs(double p) const { return Percentile(waitHist, p); }
+        double RunUs(double p) const { return Percentile(runHist, p); }
+    };
+
+    // maxThreads不大于threadCount时线程数固定
+    explicit ThreadPool(size_t threadCount = 8, bool affine = false,
+                        size_t maxThreads = 0, int growDelayMs = 10, int coolDownMs = 5000);
 
     ThreadPool() = default;
     ThreadPool(ThreadPool&&) = default;
 
-    ~ThreadPool(){
-        if(static_cast<bool>(pool_)){
-            {
-                std::lock_guard<std::mutex> locker(pool_->mtx);
-                pool_->isClosed = true;
-            }
-            pool_->cond.notify_all();       // 唤醒所有进程 处理剩下任务
-        }
-    }
+    ~ThreadPool();
 
     template<typename T>
     void AddTask(T&& task){
-        {
-            std::unique_lock<std::mutex> locker(pool_->mtx);
-            pool_->tasks.emplace(std::forward<T>(task));
-        }
-        pool_->cond.notify_all();
+        uint32_t idx = pool_->AllocNode();
+        TaskNode& node = pool_->Node(idx);
+        node.task.Emplace(std::forward<T>(task));      // 节点执行完已Reset
+        node.enqueueNs = Pool::Sample() ? Pool::NowNs() : 0;
+        pool_->Push(static_cast<uint64_t>(idx) << 1);
+    }
+
+    // 快速路径 只入队一个64位的字 需先SetOpHandler
+    void AddOp(int op, uint32_t slot){
+        assert(pool_->handler && op >= 0 && op < (1 << OP_BITS));
+        uint64_t tick = Pool::Sample() ? (static_cast<uint64_t>(Pool::NowNs()) >> OP_TICK_SHIFT) & OP_TICK_MASK : 0;
+        pool_->Push(static_cast<uint64_t>(slot) << 32 | tick << (OP_BITS + 1) | static_cast<uint64_t>(op) << 1 | 1);
+    }
+
+    // 排队任务数已达上限时拒绝 返回false
+    template<typename T>
+    bool TryAddTask(T&& task){
+        if(pool_->Full()) return false;
+        AddTask(std::forward<T>(task));
+        return true;
     }
-    
+
+    bool TryAddOp(int op, uint32_t slot){
+        if(pool_->Full()) return false;
+        AddOp(op, slot);
+        return true;
+    }
+
+    void SetQueueLimit(size_t limit){ pool_->queueLimit = limit; }     // 0为不限
+    size_t Pending() const { return pool_ ? pool_->Pending() : 0; }     // 已提交未开始执行的任务数
+
+    void SetOpHandler(OpHandler handler, void* ctx){
+        pool_->handler = handler;
+        pool_->handlerCtx = ctx;
+    }
+
+    size_t ThreadCount() const { return pool_ ? pool_->activeCnt.load() : 0; }
+    unsigned long long StolenCount() const { return pool_ ? pool_->stolenCnt.load() : 0; }   // 被非所属线程执行的亲和任务数
+    Telemetry GetTelemetry() const;
 
 private:
-    struct Pool{
+    static const int OP_BITS = 8;
+    static const int OP_TICK_SHIFT = 14;
+    static const int SAMPLE_SHIFT = 4;
+    static const uint64_t OP_TICK_MASK = (1u << (31 - OP_BITS)) - 1;
+
+    // 任务字的环形队列 2的幂大小 满时扩容 不随出队释放 由使用者加锁
+    struct JobRing{
+        explicit JobRing(size_t n): buf(n), head(0), tail(0) {}
+        size_t Size() const { return tail - head; }
+        void Push(uint64_t job);
+        uint64_t Pop(){ return buf[head++ & (buf.size() - 1)]; }
+
+        std::vector<uint64_t> buf;
+        size_t head, tail;
+    };
+
+    struct Worker{
+        explicit Worker(size_t i): id(i), box(256), boxSize(0), isIdle(false), notified(false),
+            seed(static_cast<uint32_t>(i) * 2654435761u + 1), active(false), running(false),
+            freeFirst(0), freeLast(0), freeCnt(0), pushed(0), boxed(0), started(0),
+            waitEwmaNs(0), executed(0) {
+            for(int b = 0; b < HIST_BUCKETS; b++){
+                waitHist[b].store(0, std::memory_order_relaxed);
+                runHist[b].store(0, std::memory_order_relaxed);
+            }
+        }
+        size_t id;
+        WorkDeque<uint64_t> deque;      // 本地任务 只有本线程Push/Take
+        std::mutex boxMtx;
+        JobRing box;                    // 亲和模式下投递给本线程的连接任务
+        std::atomic<size_t> boxSize;
+        std::atomic<bool> isIdle;       // 是否在idle列表中 由Pool::idleMtx保护修改
         std::mutex mtx;
         std::condition_variable cond;
-        bool isClosed;
-        std::queue<std::function<void()>> tasks;    // 任务队列
+        bool notified;                  // 由mtx保护
+        uint32_t seed;                  // 选择窃取对象的随机数状态
+        std::atomic<bool> active;       // 属于活跃线程集合 接收亲和任务
+        std::atomic<bool> running;      // 线程仍在运行(退出中的线程可能已不活跃但尚未返回)
+        // 本线程执行完释放的任务节点 攒够FREE_BATCH个串成一段 一次CAS还给空闲链表 只由本线程访问
+        uint32_t freeFirst, freeLast, freeCnt;
+
+        /* 已提交和已开始执行的任务数 相减即排队深度 提交和执行不再争用同一个原子计数器
+           pushed只由本线程写 boxed持有boxMtx时写 started只由本线程写 */
+        std::atomic<unsigned long long> pushed, boxed, started;
+
+        // 统计 只由本线程写 由监控线程和GetTelemetry汇总 不在线程间共享写以免缓存行来回迁移
+        std::atomic<int64_t> waitEwmaNs;    // 抽样任务排队等待时间的滑动平均
+        std::atomic<unsigned long long> executed;
+        std::atomic<unsigned long long> waitHist[HIST_BUCKETS];
+        std::atomic<unsigned long long> runHist[HIST_BUCKETS];
+    };
+
+    struct TaskNode{
+        Task task;
+        int64_t enqueueNs;              // 入队时刻 0为未抽样
+        std::atomic<uint32_t> next;     // 空闲链表中下一个节点下标+1 0为末尾
+    };
+
+    struct Pool: public std::enable_shared_from_this<Pool>{
+        Pool();
+        ~Pool();
+
+        uint32_t AllocNode();
+        TaskNode& Node(uint32_t idx){
+            return chunks[idx / NODE_CHUNK].load(std::memory_order_acquire)[idx % NODE_CHUNK];
+        }
+        static bool Sample(){
+            static thread_local unsigned cnt = 0;
+            return (cnt++ & ((1u << SAMPLE_SHIFT) - 1)) == 0;
+        }
+        static int64_t NowNs(){
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+        bool Full() const{
+            return queueLimit > 0 && Pending() >= queueLimit;
+        }
+        size_t Pending() const;         // 汇总各线程的计数 并发提交或执行时为近似值
+        void Push(uint64_t job);
+        void Run(Worker* w);
+        void Close();
+        void Start(Worker* w);
+        void Monitor();                 // 动态线程数的监控循环
+
+        void PushAffine_(Worker* w, uint64_t job);
+        void Execute_(uint64_t job);
+        void FreeNode_(uint32_t idx);
+        void FreeChain_(uint32_t first, uint32_t last);     // 已用next串好的一段节点
+        void FlushFree_(Worker* w);
+        bool Find_(Worker* w, uint64_t& job);   // 按顺序取一个任务
+        bool PopInject_(Worker* w, uint64_t& job);
+        bool PopBox_(Worker* w, uint64_t& job);
+        bool Steal_(Worker* w, uint64_t& job);
+        bool HasWork_(Worker* w) const;
+        bool Stealable_(Worker* w) const;   // 邮箱饱和 或所属线程已退出
+        bool Park_(Worker* w);          // 返回true表示本线程应退出
+        bool TryRetire_(Worker* w);
+        void WakeOne_();
+        void WakeWorker_(Worker* w);    // 唤醒指定线程 未休眠则什么也不做
+
+        static const uint32_t NODE_CHUNK = 1024;
+        static const uint32_t MAX_CHUNKS = 4096;
+        static const size_t AFFINE_SATURATED = 4;  // 邮箱积压达到该值视为饱和 允许窃取
+        static const uint32_t FREE_BATCH = 32;
+
+        std::vector<std::unique_ptr<Worker>> workers;      // 按最大线程数预先建好
+        std::atomic<size_t> activeCnt;  // 活跃线程为workers[0, activeCnt)
+        size_t minThreads;
+        int growDelayMs;
+        int coolDownMs;
+        std::mutex resizeMtx;           // 增减线程时持有
+        std::atomic<int64_t> lastResizeNs;
+        std::atomic<unsigned long long> grownCnt, retiredCnt;
+        std::mutex monitorMtx;
+        std::condition_variable monitorCond;    // 关闭时唤醒监控线程
+        bool affine;
+        std::atomic<unsigned long long> stolenCnt;
+        size_t queueLimit;
+
+        OpHandler handler;
+        void* handlerCtx;
+
+        /* 任务节点按块分配 块只增不减 空闲链表头为(版本号<<32 | 下标+1) 版本号防ABA */
+        std::atomic<TaskNode*> chunks[MAX_CHUNKS];
+        uint32_t chunkCnt;              // 由growMtx保护
+        std::mutex growMtx;
+        std::atomic<uint64_t> freeHead;
+
+        std::mutex injectMtx;
+        JobRing inject;                 // 全局注入队列
+        std::atomic<size_t> injectSize; // 以下两个持有injectMtx时修改 不用原子的读-改-写
+        std::atomic<unsigned long long> injected;
+
+        std::mutex idleMtx;
+        std::vector<Worker*> idle;      // 休眠中的线程
+        std::atomic<size_t> idleCnt;
+        std::atomic<size_t> spinning;   // 正在自旋找任务的线程数
+
+        std::atomic<bool> isClosed;
     };
-    std::shared_ptr<Pool> pool_;        
+    std::shared_ptr<Pool> pool_;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,130 @@
+/*
+    Chase-Lev 工作窃取双端队列
+*/
+
+#ifndef WORKDEQUE_H
+#define WORKDEQUE_H
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <assert.h>
+
+/* 所有者在底部Push/Take(后进先出 缓存热) 其他线程从顶部Steal(先进先出)
+   按 Lê et al. "Correct and Efficient Work-Stealing for Weak Memory Models" 实现
+   T须为可平凡拷贝的小类型(通常是指针) 环形数组满时扩容 旧数组保留到析构 避免窃取者读到已释放内存 */
+template<typename T>
+class WorkDeque {
+public:
+    explicit WorkDeque(size_t capacity = 256);
+    ~WorkDeque() = default;
+
+    WorkDeque(const WorkDeque&) = delete;
+    WorkDeque& operator=(const WorkDeque&) = delete;
+
+    void Push(T item);              // 仅所有者线程
+    bool Take(T& item);             // 仅所有者线程
+    bool Steal(T& item);            // 任意线程 竞争失败或为空时返回false
+
+    bool Empty() const;
+    size_t Size() const;
+
+private:
+    struct Array {
+        explicit Array(size_t n): mask(n - 1), slots(new std::atomic<T>[n]) {}
+        size_t Capacity() const { return mask + 1; }
+        T Get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+        void Put(int64_t i, T item) { slots[i & mask].store(item, std::memory_order_relaxed); }
+
+        size_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+    };
+
+    Array* Grow_(Array* a, int64_t top, int64_t bottom);
+
+    // top_与bottom_分处不同缓存行 避免窃取者与所有者互相干扰(C++14的new不保证alignas 用填充)
+    std::atomic<int64_t> top_;                  // 窃取端
+    char pad_[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> bottom_;               // 所有者端
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_;    // 当前及已退役的数组 只由所有者修改
+};
+
+template<typename T>
+WorkDeque<T>::WorkDeque(size_t capacity): top_(0), bottom_(0) {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+    arrays_.emplace_back(new Array(capacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+}
+
+template<typename T>
+typename WorkDeque<T>::Array* WorkDeque<T>::Grow_(Array* a, int64_t top, int64_t bottom) {
+    Array* bigger = new Array(a->Capacity() * 2);
+    for(int64_t i = top; i < bottom; i++) {
+        bigger->Put(i, a->Get(i));
+    }
+    arrays_.emplace_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+template<typename T>
+void WorkDeque<T>::Push(T item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if(b - t > static_cast<int64_t>(a->Capacity()) - 1) {
+        a = Grow_(a, t, b);
+    }
+    a->Put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool WorkDeque<T>::Take(T& item) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if(t > b) {                     // 空
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+    item = a->Get(b);
+    if(t == b) {                    // 最后一个元素 与窃取者竞争
+        bool won = top_.compare_exchange_strong(t, t + 1,
+                        std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<typename T>
+bool WorkDeque<T>::Steal(T& item) {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if(t >= b) return false;
+    Array* a = array_.load(std::memory_order_acquire);
+    item = a->Get(t);
+    return top_.compare_exchange_strong(t, t + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template<typename T>
+bool WorkDeque<T>::Empty() const {
+    return Size() == 0;
+}
+
+template<typename T>
+size_t WorkDeque<T>::Size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+}
+
+#endif
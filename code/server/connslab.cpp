@@ -0,0 +1,97 @@
+#include "connslab.h"
+
+ConnSlab::ConnSlab(int maxFd) {
+    // 容量取 maxFd 与 RLIMIT_NOFILE 中较小者 超出的fd不可能被打开
+    struct rlimit lim;
+    capacity_ = maxFd;
+    if(getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY
+            && lim.rlim_cur < static_cast<rlim_t>(maxFd)) {
+        capacity_ = static_cast<int>(lim.rlim_cur);
+    }
+    assert(capacity_ > 0);
+    // C++14的new不保证超过16字节的对齐 手动按缓存行分配
+    slots_ = static_cast<Slot*>(aligned_alloc(alignof(Slot), sizeof(Slot) * capacity_));
+    assert(slots_);
+    for(int i = 0; i < capacity_; i++) {
+        new (&slots_[i]) Slot();
+        slots_[i].gen = 0;
+        slots_[i].state = CONN_IDLE;
+    }
+}
+
+ConnSlab::~ConnSlab() {
+    for(int i = 0; i < capacity_; i++) {
+        slots_[i].~Slot();
+    }
+    free(slots_);
+}
+
+HttpConn* ConnSlab::Open(int fd, uint32_t* gen) {
+    assert(fd >= 0 && fd < capacity_);
+    Slot& slot = slots_[fd];
+    if(!slot.conn) {
+        slot.conn.reset(new HttpConn());
+    }
+    uint32_t g = slot.gen.fetch_add(1) + 1;
+    if(g == 0) g = slot.gen.fetch_add(1) + 1;   // 代数0保留给监听套接字等不在槽中的fd
+    slot.state = CONN_IDLE;                     // 上一个连接可能在占有状态下关闭
+    *gen = g;
+    return slot.conn.get();
+}
+
+void ConnSlab::Release(int fd) {
+    assert(fd >= 0 && fd < capacity_);
+    slots_[fd].gen.fetch_add(1);
+}
+
+HttpConn* ConnSlab::Get(int fd, uint32_t gen) const {
+    if(fd < 0 || fd >= capacity_) return nullptr;
+    const Slot& slot = slots_[fd];
+    if(slot.gen.load(std::memory_order_acquire) != gen) return nullptr;
+    return slot.conn.get();
+}
+
+HttpConn* ConnSlab::At(int fd) const {
+    assert(fd >= 0 && fd < capacity_);
+    return slots_[fd].conn.get();
+}
+
+uint32_t ConnSlab::Gen(int fd) const {
+    assert(fd >= 0 && fd < capacity_);
+    return slots_[fd].gen.load(std::memory_order_acquire);
+}
+
+bool ConnSlab::Acquire(int fd) {
+    assert(fd >= 0 && fd < capacity_);
+    std::atomic<uint32_t>& state = slots_[fd].state;
+    uint32_t cur = state.load(std::memory_order_acquire);
+    while(true) {
+        if((cur & STATE_MASK) == CONN_IDLE) {
+            if(state.compare_exchange_weak(cur, CONN_READING, std::memory_order_acq_rel)) return true;
+        } else if(cur & PENDING) {
+            return false;                       // 已有挂起事件 合并
+        } else if(state.compare_exchange_weak(cur, cur | PENDING, std::memory_order_acq_rel)) {
+            return false;
+        }
+    }
+}
+
+void ConnSlab::SetState(int fd, CONN_STATE s) {
+    assert(fd >= 0 && fd < capacity_);
+    std::atomic<uint32_t>& state = slots_[fd].state;
+    uint32_t cur = state.load(std::memory_order_relaxed);
+    while(!state.compare_exchange_weak(cur, (cur & PENDING) | s, std::memory_order_acq_rel));
+}
+
+bool ConnSlab::TryIdle(int fd) {
+    assert(fd >= 0 && fd < capacity_);
+    std::atomic<uint32_t>& state = slots_[fd].state;
+    uint32_t cur = state.load(std::memory_order_acquire);
+    while(true) {
+        if(cur & PENDING) {
+            if(state.compare_exchange_weak(cur, cur & ~PENDING, std::memory_order_acq_rel)) return false;
+        } else if(state.compare_exchange_weak(cur, CONN_IDLE, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
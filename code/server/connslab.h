@@ -0,0 +1,60 @@
+#ifndef CONNSLAB_H
+#define CONNSLAB_H
+
+#include <atomic>
+#include <memory>
+#include <stdlib.h>         // aligned_alloc()
+#include <stdint.h>
+#include <assert.h>
+#include <sys/resource.h>   // getrlimit()
+
+#include "../http/httpconn.h"
+
+/* 按fd下标直接索引的连接槽数组 替代unordered_map<int, HttpConn>
+   槽在构造时一次性分配 之后不再移动 HttpConn指针在进程生命周期内保持有效
+   每个槽带一个代数 连接打开和关闭时各加一 事件和定时器携带(fd, 代数) 代数不符即为过期 */
+class ConnSlab {
+public:
+    /* 常驻ET模式下连接的归属状态 非IDLE时连接被某个线程占有
+       占有期间到来的事件只置PENDING位 由占有者在释放前重新处理 不再re-arm epoll */
+    enum CONN_STATE {
+        CONN_IDLE = 0,
+        CONN_READING,
+        CONN_PROCESSING,
+        CONN_WRITING,
+    };
+
+    explicit ConnSlab(int maxFd);
+    ~ConnSlab();
+
+    ConnSlab(const ConnSlab&) = delete;
+    ConnSlab& operator=(const ConnSlab&) = delete;
+
+    int Capacity() const { return capacity_; }
+
+    HttpConn* Open(int fd, uint32_t* gen);      // 新连接占用槽 返回新的代数
+    void Release(int fd);                       // 连接关闭 使已发出的(fd, 代数)全部失效
+    HttpConn* Get(int fd, uint32_t gen) const;  // 代数不符返回nullptr
+    HttpConn* At(int fd) const;                 // 不检查代数
+    uint32_t Gen(int fd) const;
+
+    bool Acquire(int fd);                       // IDLE则占有并返回true 否则置PENDING并返回false
+    void SetState(int fd, CONN_STATE state);    // 占有者切换阶段 保留PENDING
+    bool TryIdle(int fd);                       // 无PENDING则回到IDLE返回true 有则清除并返回false 占有者需再处理一轮
+
+private:
+    // 每槽独占一个缓存行 不同线程处理相邻fd时不会伪共享
+    static const uint32_t STATE_MASK = 0x3;
+    static const uint32_t PENDING = 0x4;
+
+    struct alignas(64) Slot {
+        std::atomic<uint32_t> gen;
+        std::atomic<uint32_t> state;            // CONN_STATE | PENDING
+        std::unique_ptr<HttpConn> conn;         // 首次使用时创建 之后复用
+    };
+
+    int capacity_;
+    Slot* slots_;
+};
+
+#endif
@@ -1,6 +1,6 @@
 #include "epoller.h"
 
-Epoller::Epoller(int maxEvent):epollFd_(epoll_create(512)), events_(maxEvent){
+Epoller::Epoller(int maxEvent):epollFd_(epoll_create(512)), ctlCnt_(0), events_(maxEvent){
     assert(epollFd_ >= 0 && events_.size() > 0);
 }
 
@@ -8,11 +8,12 @@ Epoller::~Epoller(){
     close(epollFd_);
 }
 
-bool Epoller::AddFd(int fd, uint32_t events){
+bool Epoller::AddFd(int fd, uint32_t events, uint32_t gen){
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (uint64_t)gen << 32 | (uint32_t)fd;
     ev.events = events;
+    ctlCnt_.fetch_add(1, std::memory_order_relaxed);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
     /* epfd epoll实例对应的文件描述符
         op  要进行什么操作
@@ -23,17 +24,19 @@ bool Epoller::AddFd(int fd, uint32_t events){
         event 要监听什么事件*/
 }
 
-bool Epoller::ModFd(int fd, uint32_t events){
+bool Epoller::ModFd(int fd, uint32_t events, uint32_t gen){
     if(fd < 0) return false;
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = (uint64_t)gen << 32 | (uint32_t)fd;
     ev.events = events;
+    ctlCnt_.fetch_add(1, std::memory_order_relaxed);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
 bool Epoller::DelFd(int fd){
     if(fd < 0) return false;
     epoll_event ev = {0};
+    ctlCnt_.fetch_add(1, std::memory_order_relaxed);
     return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &ev);
 }
 
@@ -45,7 +48,12 @@ int Epoller::Wait(int timeoutMs){
 
 int Epoller::GetEventFd(size_t i) const {
     assert(i < events_.size() && i >= 0);
-    return events_[i].data.fd;
+    return static_cast<int>(events_[i].data.u64 & 0xffffffff);
+}
+
+uint32_t Epoller::GetEventGen(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return static_cast<uint32_t>(events_[i].data.u64 >> 32);
 }
 
 uint32_t Epoller::GetEvent(size_t i) const {
@@ -6,6 +6,7 @@
 #include <unistd.h>     // close()
 #include <assert.h>     // close()
 #include <vector>
+#include <atomic>
 #include <errno.h>
 
 class Epoller {
@@ -13,14 +14,18 @@ public:
     explicit Epoller(int maxEvent = 1024);
     ~Epoller();
 
-    bool AddFd(int fd, uint32_t events);
-    bool ModFd(int fd, uint32_t enents);
+    // data.u64 高32位存连接代数 低32位存fd 用于丢弃fd被关闭/复用后的过期事件
+    bool AddFd(int fd, uint32_t events, uint32_t gen = 0);
+    bool ModFd(int fd, uint32_t enents, uint32_t gen = 0);
     bool DelFd(int fd);
     int Wait(int timeoutMs = -1);
     int GetEventFd(size_t i) const;
+    uint32_t GetEventGen(size_t i) const;
     uint32_t GetEvent(size_t i) const;
+    unsigned long long CtlCount() const { return ctlCnt_; }    // epoll_ctl调用次数
 private:
     int epollFd_;
+    std::atomic<unsigned long long> ctlCnt_;
     std::vector<struct epoll_event> events_;
 };
 
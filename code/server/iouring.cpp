@@ -0,0 +1,213 @@
+#include "iouring.h"
+
+int IoUring::failAfter_ = -1;
+
+IoUring::IoUring(): ringFd_(-1), params_(), sqPtr_(MAP_FAILED), sqSize_(0), cqPtr_(MAP_FAILED), cqSize_(0),
+    sqes_((io_uring_sqe*)MAP_FAILED), sqesSize_(0), sqLocalTail_(0), toSubmit_(0),
+    bufRing_((io_uring_buf*)MAP_FAILED), bufRingSize_(0), bufCount_(0), bufSize_(0), bufTail_(0), enterCnt_(0) {}
+
+IoUring::~IoUring() {
+    Release_();
+}
+
+void IoUring::Release_() {
+    if(bufRing_ != MAP_FAILED) munmap(bufRing_, bufRingSize_);
+    if(sqes_ != MAP_FAILED) munmap(sqes_, sqesSize_);
+    if(cqPtr_ != MAP_FAILED && cqPtr_ != sqPtr_) munmap(cqPtr_, cqSize_);
+    if(sqPtr_ != MAP_FAILED) munmap(sqPtr_, sqSize_);
+    if(ringFd_ >= 0) close(ringFd_);
+    bufRing_ = (io_uring_buf*)MAP_FAILED;
+    sqes_ = (io_uring_sqe*)MAP_FAILED;
+    cqPtr_ = sqPtr_ = MAP_FAILED;
+    ringFd_ = -1;
+}
+
+bool IoUring::Init(unsigned entries, unsigned bufCount, unsigned bufSize) {
+    assert(ringFd_ < 0);
+    assert(bufCount > 0 && (bufCount & (bufCount - 1)) == 0 && bufCount <= 32768);    // 缓冲区环大小必须是2的幂
+    if(failAfter_ == 0) return false;
+    if(failAfter_ > 0) failAfter_--;
+    memset(&params_, 0, sizeof(params_));
+    params_.flags = IORING_SETUP_CQSIZE;
+    params_.cq_entries = entries * 4;       // 多发accept和突发完成需要更大的CQ
+    ringFd_ = syscall(__NR_io_uring_setup, entries, &params_);
+    if(ringFd_ < 0) {
+        return false;
+    }
+    // 需要带超时的等待
+    if(!(params_.features & IORING_FEAT_EXT_ARG)) {
+        Release_();
+        return false;
+    }
+
+    sqSize_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    cqSize_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    if(params_.features & IORING_FEAT_SINGLE_MMAP) {
+        sqSize_ = cqSize_ = std::max(sqSize_, cqSize_);
+    }
+    sqPtr_ = mmap(0, sqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if(sqPtr_ == MAP_FAILED) {
+        Release_();
+        return false;
+    }
+    if(params_.features & IORING_FEAT_SINGLE_MMAP) {
+        cqPtr_ = sqPtr_;
+    } else {
+        cqPtr_ = mmap(0, cqSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if(cqPtr_ == MAP_FAILED) {
+            Release_();
+            return false;
+        }
+    }
+    sqesSize_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = (io_uring_sqe*)mmap(0, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if(sqes_ == MAP_FAILED) {
+        Release_();
+        return false;
+    }
+
+    char* sq = (char*)sqPtr_;
+    sqHead_ = (unsigned*)(sq + params_.sq_off.head);
+    sqTail_ = (unsigned*)(sq + params_.sq_off.tail);
+    sqMask_ = *(unsigned*)(sq + params_.sq_off.ring_mask);
+    sqArray_ = (unsigned*)(sq + params_.sq_off.array);
+    sqLocalTail_ = *sqTail_;
+    char* cq = (char*)cqPtr_;
+    cqHead_ = (unsigned*)(cq + params_.cq_off.head);
+    cqTail_ = (unsigned*)(cq + params_.cq_off.tail);
+    cqMask_ = *(unsigned*)(cq + params_.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + params_.cq_off.cqes);
+
+    /* 注册缓冲区环(5.19+) recv时由内核挑选缓冲区 不必为每个连接预留读缓冲 */
+    bufCount_ = bufCount;
+    bufSize_ = bufSize;
+    bufRingSize_ = bufCount * sizeof(io_uring_buf);
+    bufRing_ = (io_uring_buf*)mmap(0, bufRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(bufRing_ == MAP_FAILED) {
+        Release_();
+        return false;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)bufRing_;
+    reg.ring_entries = bufCount;
+    reg.bgid = BUF_GROUP;
+    if(syscall(__NR_io_uring_register, ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        Release_();
+        return false;
+    }
+    bufs_.resize((size_t)bufCount * bufSize);
+    bufTail_ = 0;
+    for(unsigned i = 0; i < bufCount; i++) {
+        RecycleBuf(i);
+    }
+    return true;
+}
+
+struct io_uring_sqe* IoUring::GetSqe_() {
+    unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+    if(sqLocalTail_ - head >= params_.sq_entries) {
+        Enter_(toSubmit_, 0, 0);            // SQ已满 先提交一批
+        head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        assert(sqLocalTail_ - head < params_.sq_entries);
+    }
+    unsigned idx = sqLocalTail_ & sqMask_;
+    struct io_uring_sqe* sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[idx] = idx;
+    sqLocalTail_++;
+    toSubmit_++;
+    return sqe;
+}
+
+void IoUring::PrepAccept(int fd, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;  // 一次提交 每个新连接产生一个CQE
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = userData;
+}
+
+void IoUring::PrepRecv(int fd, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->len = bufSize_;
+    sqe->user_data = userData;
+}
+
+void IoUring::PrepWritev(int fd, const struct iovec* iov, int iovCnt, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)iov;
+    sqe->len = iovCnt;
+    sqe->user_data = userData;
+}
+
+void IoUring::PrepClose(int fd, uint64_t userData) {
+    struct io_uring_sqe* sqe = GetSqe_();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    sqe->user_data = userData;
+}
+
+int IoUring::Enter_(unsigned toSubmit, unsigned minComplete, int timeoutMs) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if(timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        arg.ts = (uint64_t)&ts;
+    }
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);    // 发布已填写的SQE
+    unsigned flags = IORING_ENTER_EXT_ARG | (minComplete ? IORING_ENTER_GETEVENTS : 0);
+    enterCnt_++;
+    int ret = syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, &arg, sizeof(arg));
+    if(ret >= 0) {
+        toSubmit_ -= std::min<unsigned>(toSubmit_, ret);
+    }
+    return ret;
+}
+
+int IoUring::SubmitAndWait(int timeoutMs) {
+    unsigned ready = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) - *cqHead_;
+    if(ready == 0 || toSubmit_ > 0) {
+        // 已有CQE时只提交不等待
+        int ret = Enter_(toSubmit_, ready ? 0 : 1, timeoutMs);
+        if(ret < 0 && errno != ETIME && errno != EINTR) {
+            return -1;
+        }
+    }
+    return __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE) - *cqHead_;
+}
+
+bool IoUring::PopCqe(struct io_uring_cqe* cqe) {
+    unsigned head = *cqHead_;
+    if(head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    *cqe = cqes_[head & cqMask_];
+    __atomic_store_n(cqHead_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+char* IoUring::GetBuf(uint16_t bid) {
+    assert(bid < bufCount_);
+    return &bufs_[(size_t)bid * bufSize_];
+}
+
+void IoUring::RecycleBuf(uint16_t bid) {
+    assert(bid < bufCount_);
+    struct io_uring_buf* buf = &bufRing_[bufTail_ & (bufCount_ - 1)];
+    buf->addr = (uint64_t)GetBuf(bid);
+    buf->len = bufSize_;
+    buf->bid = bid;
+    bufTail_++;
+    // 环的tail与bufs[0].resv重叠
+    __atomic_store_n(&bufRing_[0].resv, bufTail_, __ATOMIC_RELEASE);
+}
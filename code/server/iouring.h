@@ -0,0 +1,83 @@
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <linux/io_uring.h> // io_uring_sqe io_uring_cqe
+#include <sys/syscall.h>    // __NR_io_uring_setup
+#include <sys/mman.h>       // mmap()
+#include <sys/uio.h>        // iovec
+#include <sys/socket.h>     // SOCK_NONBLOCK
+#include <unistd.h>         // close()
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+/* 直接通过系统调用使用io_uring(不依赖liburing)
+   与Epoller相对应 只负责环的建立、SQE的填写提交和CQE的收割 业务逻辑在WebServer中 */
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // 建立提交/完成队列和提供给recv的缓冲区环 内核不支持时返回false 由调用者退回epoll
+    bool Init(unsigned entries, unsigned bufCount, unsigned bufSize);
+
+    void PrepAccept(int fd, uint64_t userData);                         // 多发accept
+    void PrepRecv(int fd, uint64_t userData);                           // 从缓冲区环中选取缓冲区的recv
+    void PrepWritev(int fd, const struct iovec* iov, int iovCnt, uint64_t userData);
+    void PrepClose(int fd, uint64_t userData);
+
+    int SubmitAndWait(int timeoutMs = -1);  // 提交SQE并等待至少一个CQE 返回可收割的CQE数量
+    bool PopCqe(struct io_uring_cqe* cqe);  // 取出一个CQE 没有则返回false
+
+    char* GetBuf(uint16_t bid);             // 由CQE中的缓冲区号取得缓冲区
+    void RecycleBuf(uint16_t bid);          // 数据拷走后将缓冲区还给内核
+
+    unsigned long long EnterCount() const { return enterCnt_; }   // io_uring_enter调用次数
+
+    // 测试用 之后的Init先成功n次 其余按内核不支持返回false n<0时恢复
+    static void FailInitAfter(int n) { failAfter_ = n; }
+
+private:
+    struct io_uring_sqe* GetSqe_();         // 取一个空闲SQE SQ满时先提交
+    int Enter_(unsigned toSubmit, unsigned minComplete, int timeoutMs);
+    void Release_();
+
+    static const uint16_t BUF_GROUP = 0;    // 缓冲区组号
+    static int failAfter_;
+
+    int ringFd_;
+    struct io_uring_params params_;
+
+    void* sqPtr_;                           // SQ环的映射
+    size_t sqSize_;
+    void* cqPtr_;                           // CQ环的映射 SINGLE_MMAP时与sqPtr_相同
+    size_t cqSize_;
+    struct io_uring_sqe* sqes_;             // SQE数组
+    size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned* sqArray_;
+    unsigned sqLocalTail_;                  // 已填写但未提交的SQE的尾部
+    unsigned toSubmit_;
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    struct io_uring_cqe* cqes_;
+
+    struct io_uring_buf* bufRing_;          // 缓冲区环 tail与bufs[0].resv重叠
+    size_t bufRingSize_;
+    unsigned bufCount_;
+    unsigned bufSize_;
+    uint16_t bufTail_;
+    std::vector<char> bufs_;                // 缓冲区实体
+
+    unsigned long long enterCnt_;
+};
+
+#endif
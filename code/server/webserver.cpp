@@ -6,19 +6,64 @@ WebServer::WebServer(
     int port, int trigMode, int timeoutMS, bool OptLinger,
     int sqlPort, const char* sqlUser, const  char* sqlPwd,
     const char* dbName, int connPoolNum, int threadNum,
-    bool openLog, int logLevel, int logQueSize):
+    bool openLog, int logLevel, int logQueSize,
+    int reactorNum, bool cpuSteer, bool ioUring, bool inlineSmall, bool connAffine, int blockingNum, int maxThreadNum,
+    const char* rootDir):
     port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-    timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
+    cpuSteer_(cpuSteer && reactorNum > 0), persistent_(false), inlineSmall_(inlineSmall), users_(MAX_FD),
+    threadpool_(nullptr), blockpool_(nullptr)
 {
-    srcDir_ = getcwd(nullptr, 256);         // 获取工作目录
+    if(rootDir) {
+        srcDir_ = static_cast<char*>(malloc(strlen(rootDir) + 16));
+        strcpy(srcDir_, rootDir);
+    } else {
+        srcDir_ = getcwd(nullptr, 256);     // 获取工作目录
+    }
     assert(srcDir_);
     strncat(srcDir_, "/resources/", 16);    // 添加路径
     HttpConn::userCount = 0;
     HttpConn::srcDir = srcDir_;
+    UploadHandler::SetDefaultDir(string(srcDir_, strlen(srcDir_) - strlen("resources/")) + "upload/");
+    // 样式、脚本、字体和图片在浏览器缓存一天 其余每次向服务器确认 没变时为304
+    HttpResponse::SetCacheControl("/", "no-cache");
+    for(const char* prefix: {"/css/", "/js/", "/fonts/", "/images/"}) {
+        HttpResponse::SetCacheControl(prefix, "public, max-age=86400");
+    }
     SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
 
+    if(reactorNum <= 0) {
+        // 单Reactor 读写交给"io"通道 可能阻塞在数据库上的请求交给"blocking"通道 未启用时两者相同
+        threadpool_ = lanes_.AddLane("io", threadNum, 0, connAffine, max(maxThreadNum, 0));
+        blockpool_ = blockingNum > 0 ? lanes_.AddLane("blocking", blockingNum, BLOCKING_QUEUE_MAX) : threadpool_;
+        lanes_.SetOpHandler(&WebServer::OnPoolOp_, this);
+    }
+    for(int i = 0; i < max(reactorNum, 1); i++) {
+        reactors_.emplace_back(new Reactor());
+        reactors_[i]->id = i;
+        reactors_[i]->listenFd = -1;
+        reactors_[i]->epoller.reset(new Epoller());
+        reactors_[i]->timer.reset(new HeapTimer());
+        reactors_[i]->reqCnt = 0;
+        reactors_[i]->inlineCnt = 0;
+        reactors_[i]->offloadCnt = 0;
+    }
+
+    // io_uring 每个Reactor一个环 任一环建立失败(内核过旧或被禁用)则全部退回epoll
+    for(size_t i = 0; ioUring && i < reactors_.size(); i++) {
+        reactors_[i]->uring.reset(new IoUring());
+        if(!reactors_[i]->uring->Init(URING_ENTRIES, URING_BUF_COUNT, URING_BUF_SIZE)) {
+            for(auto& r: reactors_) r->uring.reset();
+            break;
+        }
+    }
+
     InitEventMode_(trigMode);
-    if(!InitSocket_()) isClose_ = true;
+    for(auto& r: reactors_) {
+        if(!InitSocket_(r.get())) { isClose_ = true; break; }
+    }
+    if(!isClose_ && cpuSteer_ && !AttachCpuSteer_()) {
+        cpuSteer_ = false;                  // 内核不支持时退回到默认的哈希分发
+    }
 
     if(openLog) {
         Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
@@ -26,18 +71,32 @@ WebServer::WebServer(
         else {
             LOG_INFO("========== Server init ==========");
             LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
-            LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
+            LOG_INFO("Listen Mode: %s, OpenConn Mode: %s%s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
-                            (connEvent_ & EPOLLET ? "ET": "LT"));
+                            (connEvent_ & EPOLLET ? "ET": "LT"),
+                            (persistent_ ? " persistent" : ""));
+            if(ioUring && !reactors_[0]->uring) { LOG_WARN("io_uring unavailable, fall back to epoll"); }
+            LOG_INFO("IO backend: %s", IoBackend());
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
-            LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            LOG_INFO("File cache capacity: %zu MB, Compress cache capacity: %zu MB",
+                            FileCache::Instance()->GetStats().capacity >> 20, CompressCache::Instance()->GetStats().capacity >> 20);
+            if(threadpool_) {
+                LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d(max %d), Blocking lane num: %d, Inline small: %s, Conn affine: %s",
+                            connPoolNum, threadNum, max(maxThreadNum, threadNum), max(blockingNum, 0),
+                            inlineSmall_ ? "true":"false", connAffine ? "true":"false");
+            } else {
+                LOG_INFO("SqlConnPool num: %d, Reactor num: %d, CPU steer: %s",
+                            connPoolNum, (int)reactors_.size(), cpuSteer_ ? "true":"false");
+            }
         }
     }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    for(auto& r: reactors_) {
+        if(r->listenFd >= 0) close(r->listenFd);
+    }
     isClose_ = true;
     free(srcDir_);
     SqlConnPool::Instance()->ClosePool();
@@ -52,6 +111,7 @@ void WebServer::InitEventMode_(int trigMode){
         1 LT + ET
         2 ET + LT
         3 ET + ET
+        4 ET + ET 常驻注册IN|OUT 不用EPOLLONESHOT 由连接状态机合并并发事件
     */
     switch (trigMode){
         case 0:
@@ -66,6 +126,11 @@ void WebServer::InitEventMode_(int trigMode){
             listenEvent_ |= EPOLLET;
             connEvent_ |= EPOLLET;
             break;
+        case 4:
+            listenEvent_ |= EPOLLET;
+            connEvent_ = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLHUP | EPOLLET;
+            persistent_ = true;
+            break;
         default:
             listenEvent_ |= EPOLLET;
             connEvent_ |= EPOLLET;
@@ -75,27 +140,58 @@ void WebServer::InitEventMode_(int trigMode){
 }
 
 void WebServer::Start() {
-    int timeMS = -1;    /* epoll wait timeout == -1 无事件将阻塞 */
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    // 0号Reactor在当前线程运行 其余各开一个线程
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < reactors_.size(); i++) {
+        threads.emplace_back(&WebServer::Loop_, this, reactors_[i].get());
+    }
+    Loop_(reactors_[0].get());
+    for(auto& t: threads) {
+        t.join();
+    }
+}
+
+void WebServer::Loop_(Reactor* r) {
+    if(cpuSteer_) {
+        // 第i个Reactor绑定到第i个CPU 与CBPF程序按CPU选择监听套接字相对应
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(r->id % thread::hardware_concurrency(), &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+    if(r->uring) {
+        LoopUring_(r);
+        return;
+    }
+    int timeMS = -1;    /* epoll wait timeout == -1 无事件将阻塞 */
     while(!isClose_) {                          // 主事件循环 服务器没关闭就一直执行
         if(timeoutMS_ > 0){                     // 设置了超时时间大于0
-            timeMS = timer_->getNextTick();     // 获取下一次的超时等待时间
+            timeMS = r->timer->getNextTick();   // 获取下一次的超时等待时间
         }
-        int eventCnt = epoller_->Wait(timeMS);  // 返回事件的数量
+        int eventCnt = r->epoller->Wait(timeMS);    // 返回事件的数量
         for(int i = 0; i < eventCnt; i++){      // 处理事件
-            int fd = epoller_->GetEventFd(i);   // 获取第i个事件的文件描述符
-            uint32_t events = epoller_->GetEvent(i); // 第i个事件的具体类型
-            if(fd == listenFd_){                // 如果文件描述符是监听套接字，处理监听事件
-                 DealListen_();
-            }else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){ // 处理连接中的异常事件，比如对端关闭连接（`EPOLLRDHUP`），连接发生错误（`EPOLLHUP` 或 `EPOLLERR`）
-                assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);
+            int fd = r->epoller->GetEventFd(i); // 获取第i个事件的文件描述符
+            uint32_t events = r->epoller->GetEvent(i); // 第i个事件的具体类型
+            if(fd == r->listenFd){              // 如果文件描述符是监听套接字，处理监听事件
+                 DealListen_(r);
+                 continue;
+            }
+            // 按fd直接定位连接槽 代数不符说明连接已关闭或fd已被复用 丢弃该事件
+            HttpConn* client = users_.Get(fd, r->epoller->GetEventGen(i));
+            if(!client) {
+                continue;
+            }
+            if(persistent_) {                   // 挂断也交给读处理 由read()返回0/错误后关闭 避免与占有线程竞争
+                DealEvent_(r, client);
+                continue;
+            }
+            if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){ // 处理连接中的异常事件，比如对端关闭连接（`EPOLLRDHUP`），连接发生错误（`EPOLLHUP` 或 `EPOLLERR`）
+                CloseConn_(r, client);
             }else if(events & EPOLLIN){         // 处理连接的读事件
-                assert(users_.count(fd) > 0);
-                DealRead_(&users_[fd]);
+                DealRead_(r, client);
             }else if(events & EPOLLOUT){        // 处理连接的写事件
-                assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);
+                DealWrite_(r, client);
             }else{                              // 未知的事件类型
                 LOG_ERROR("Unexpected event");
             } 
@@ -103,87 +199,302 @@ void WebServer::Start() {
     }
 }
 
+/* io_uring模式: 多发accept常驻 每个连接任意时刻恰有一个recv或writev在途
+   一次io_uring_enter同时提交所有新SQE并收割完成事件 读、解析、写都在本线程完成 */
+void WebServer::LoopUring_(Reactor* r) {
+    IoUring* ring = r->uring.get();
+    ring->PrepAccept(r->listenFd, (uint64_t)URING_ACCEPT << 32);
+    int timeMS = -1;
+    while(!isClose_) {
+        if(timeoutMS_ > 0){
+            timeMS = r->timer->getNextTick();
+        }
+        if(ring->SubmitAndWait(timeMS) < 0) {
+            LOG_ERROR("io_uring enter error: %d", errno);
+            break;
+        }
+        struct io_uring_cqe cqe;
+        while(ring->PopCqe(&cqe)) {
+            int op = cqe.user_data >> 32;
+            int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+            switch(op) {
+            case URING_ACCEPT:
+                if(cqe.res >= 0) {
+                    if(HttpConn::userCount >= MAX_FD || cqe.res >= users_.Capacity()) {
+                        SendError_(cqe.res, "Server busy!");
+                        LOG_WARN("Clients is full!");
+                    } else {
+                        // 多发accept不返回对端地址 为省去getpeername 日志中地址为空
+                        struct sockaddr_in addr = {0};
+                        uint32_t gen;
+                        HttpConn* client = users_.Open(cqe.res, &gen);
+                        client->init(cqe.res, addr, false);          // 写用PrepWritev 不用sendfile
+                        if(timeoutMS_ > 0) {
+                            r->timer->add(cqe.res, timeoutMS_, std::bind(&WebServer::CloseExpired_, this, r, cqe.res, gen));
+                        }
+                        ring->PrepRecv(cqe.res, (uint64_t)URING_RECV << 32 | cqe.res);
+                    }
+                }
+                if(!(cqe.flags & IORING_CQE_F_MORE)) {  // 多发accept被终止 重新提交
+                    ring->PrepAccept(r->listenFd, (uint64_t)URING_ACCEPT << 32);
+                }
+                break;
+            case URING_RECV:
+                OnRecvUring_(r, fd, cqe);
+                break;
+            case URING_WRITE:
+                OnWriteUring_(r, fd, cqe);
+                break;
+            default:                // URING_CLOSE 无需处理
+                break;
+            }
+        }
+    }
+}
+
+void WebServer::OnRecvUring_(Reactor* r, int fd, const struct io_uring_cqe& cqe) {
+    // 每个连接至多一个操作在途 且只在其完成后关闭 故按fd取槽不会取到过期连接
+    HttpConn* client = users_.At(fd);
+    if(cqe.res == -ENOBUFS) {               // 缓冲区环暂时耗尽 重新提交
+        r->uring->PrepRecv(fd, (uint64_t)URING_RECV << 32 | fd);
+        return;
+    }
+    if(cqe.res <= 0) {                      // 对端关闭或出错
+        CloseUring_(r, client);
+        return;
+    }
+    uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    client->AppendRead(r->uring->GetBuf(bid), cqe.res);
+    r->uring->RecycleBuf(bid);
+    ExtentTime_(r, client);
+    ProcessUring_(r, client);
+}
+
+// 处理读缓冲区中的请求 有响应就提交写 否则请求不完整 继续收
+void WebServer::ProcessUring_(Reactor* r, HttpConn* client) {
+    int fd = client->GetFd();
+    if(int n = client->process()) {
+        r->inlineCnt += n;
+        unsigned long long total = r->reqCnt += n;
+        if((total >> 16) != ((total - n) >> 16)) {     // 每65536个响应记录一次
+            LOG_INFO("Reactor[%d] io_uring: %llu responses, %llu io_uring_enter",
+                        r->id, (unsigned long long)r->reqCnt, r->uring->EnterCount());
+        }
+        r->uring->PrepWritev(fd, client->Iov(), client->IovCnt(), (uint64_t)URING_WRITE << 32 | fd);
+    } else {
+        r->uring->PrepRecv(fd, (uint64_t)URING_RECV << 32 | fd);
+    }
+}
+
+void WebServer::OnWriteUring_(Reactor* r, int fd, const struct io_uring_cqe& cqe) {
+    // 每个连接至多一个操作在途 且只在其完成后关闭 故按fd取槽不会取到过期连接
+    HttpConn* client = users_.At(fd);
+    if(cqe.res < 0) {
+        CloseUring_(r, client);
+        return;
+    }
+    client->RetrieveWritten(cqe.res);
+    if(client->ToWriteBytes() > 0) {        // 未写完 继续写
+        r->uring->PrepWritev(fd, client->Iov(), client->IovCnt(), (uint64_t)URING_WRITE << 32 | fd);
+    } else if(client->IsKeepAlive()) {
+        ProcessUring_(r, client);           // 流水线中的后续请求可能已在读缓冲区
+    } else {
+        CloseUring_(r, client);
+    }
+}
+
+// 只在没有在途操作时调用 fd由close SQE关闭
+void WebServer::CloseUring_(Reactor* r, HttpConn* client) {
+    assert(client);
+    int fd = client->GetFd();
+    LOG_INFO("Client[%d] quit!", fd);
+    users_.Release(fd);
+    client->Close(false);
+    r->uring->PrepClose(fd, (uint64_t)URING_CLOSE << 32 | fd);
+}
+
 void WebServer::SendError_(int fd, const char* info){
+    SendInfo_(fd, info);
+    close(fd);
+}
+
+void WebServer::SendInfo_(int fd, const char* info){
     assert(fd > 0);
     int ret = send(fd, info, strlen(info), 0);
     if(ret < 0){
         LOG_WARN("send error to client[%d] error!", fd);
     }
-    close(fd);
 }
 
 // 添加客户端连接
-void WebServer::AddClient_(int fd, sockaddr_in addr){
+void WebServer::AddClient_(Reactor* r, int fd, sockaddr_in addr){
     assert(fd > 0);
-    users_[fd].init(fd, addr);
+    uint32_t gen;
+    HttpConn* client = users_.Open(fd, &gen);
+    client->init(fd, addr);
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        r->timer->add(fd, timeoutMS_, std::bind(&WebServer::CloseExpired_, this, r, fd, gen));
     }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);
+    r->epoller->AddFd(fd, EPOLLIN | connEvent_, gen);
     SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    LOG_INFO("Client[%d] in!", client->GetFd());
+}
+
+// 定时器到期 代数相符才关闭 避免关到复用了该fd的新连接
+void WebServer::CloseExpired_(Reactor* r, int fd, uint32_t gen){
+    HttpConn* client = users_.Get(fd, gen);
+    if(!client) return;
+    if(persistent_ && !users_.Acquire(fd)) {
+        // 连接正被工作线程处理 重新计时
+        r->timer->add(fd, timeoutMS_, std::bind(&WebServer::CloseExpired_, this, r, fd, gen));
+        return;
+    }
+    CloseConn_(r, client);
 }
 
 // 关闭客户端连接
-void WebServer::CloseConn_(HttpConn* client){
+void WebServer::CloseConn_(Reactor* r, HttpConn* client){
     assert(client);
+    if(r->uring) {
+        // io_uring模式下连接上总有一个recv或writev在途 shutdown让它完成 在完成事件中关闭
+        if(!client->IsClose()) shutdown(client->GetFd(), SHUT_RDWR);
+        return;
+    }
+    if(client->IsClose()) return;
     LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());
+    users_.Release(client->GetFd());    // 先使代数失效 本轮中该fd剩余的事件将被丢弃
+    r->epoller->DelFd(client->GetFd());
     client->Close();
 }
 
 // 处理监听套接字 accept新的套接字 并加入timer和epoller中
-void WebServer::DealListen_(){
+void WebServer::DealListen_(Reactor* r){
     struct sockaddr_in addr;
     socklen_t len = sizeof addr;
     do{
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
+        int fd = accept(r->listenFd, (struct sockaddr *)&addr, &len);
         if(fd <= 0) return;
-        else if(HttpConn::userCount >= MAX_FD){
+        else if(HttpConn::userCount >= MAX_FD || fd >= users_.Capacity()){
             SendError_(fd, "Server busy!");
             LOG_WARN("Clients is full!");
             return;
         }
-        AddClient_(fd, addr);
+        AddClient_(r, fd, addr);
     }while(listenEvent_ & EPOLLET);
 }
 
-// 处理读事件 将OnRead加入线程池的任务队列
-void WebServer::DealRead_(HttpConn* client) {
+// 处理读事件 单Reactor模式将OnRead加入线程池的任务队列 多Reactor模式直接在本线程处理
+void WebServer::DealRead_(Reactor* r, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
+    ExtentTime_(r, client);
+    if(threadpool_ && inlineSmall_) {
+        ReadInline_(r, client);
+    } else if(threadpool_) {
+        threadpool_->AddOp(POOL_READ, client->GetFd());
+    } else {
+        OnRead_(r, client);
+    }
+}
+
+// 处理写事件 单Reactor模式将OnWrite加入线程池的任务队列 多Reactor模式直接在本线程处理
+void WebServer::DealWrite_(Reactor* r, HttpConn* client) {
+    assert(client);
+    ExtentTime_(r, client);
+    if(threadpool_) {
+        threadpool_->AddOp(POOL_WRITE, client->GetFd());
+    } else {
+        OnWrite_(r, client);
+    }
 }
 
-// 处理写事件 将OnWrite加入线程池的任务队列
-void WebServer::DealWrite_(HttpConn* client) {
+// 常驻ET模式 连接空闲则占有后派发 正被处理则只记挂起标记 由占有者释放前再处理一轮
+void WebServer::DealEvent_(Reactor* r, HttpConn* client) {
     assert(client);
-    ExtentTime_(client);
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
+    ExtentTime_(r, client);
+    if(!users_.Acquire(client->GetFd())) return;
+    if(threadpool_ && inlineSmall_) {
+        OnEvent_(r, client, RUN_LOOP);
+    } else if(threadpool_) {
+        threadpool_->AddOp(POOL_EVENT, client->GetFd());
+    } else {
+        OnEvent_(r, client, RUN_INLINE);
+    }
+}
+
+/* 在事件循环线程上读取 静态的小请求就地处理并完成首次writev 省去线程池的加锁和唤醒
+   可能阻塞(访问数据库)的请求交给线程池处理 响应较大时交给线程池写 */
+void WebServer::ReadInline_(Reactor* r, HttpConn* client) {
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN){
+        CloseConn_(r, client);
+        return;
+    }
+    if(client->MayBlock()) {
+        ToBlocking_(r, client, POOL_PROCESS);
+        return;
+    }
+    int n = client->process();
+    if(!n) {
+        r->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, users_.Gen(client->GetFd()));
+        return;
+    }
+    r->reqCnt += n;
+    if(client->ToWriteBytes() > INLINE_WRITE_MAX) {
+        r->offloadCnt += n;
+        threadpool_->AddOp(POOL_WRITE, client->GetFd());
+        return;
+    }
+    r->inlineCnt += n;
+    OnWrite_(r, client, true);
 }
 
 // 定时事件处理
-void WebServer::ExtentTime_(HttpConn* client) {
+void WebServer::ExtentTime_(Reactor* r, HttpConn* client) {
     assert(client);
     if(timeoutMS_ > 0){
-        timer_->adjust(client->GetFd(), timeoutMS_);
+        r->timer->adjust(client->GetFd(), timeoutMS_);
     }
 }
 
-void WebServer::OnRead_(HttpConn* client) {
+/* 线程池任务只携带(操作码, fd) 不构造闭包 线程池只在单Reactor模式下存在 */
+void WebServer::OnPoolOp_(void* ctx, int op, uint32_t fd) {
+    WebServer* server = static_cast<WebServer*>(ctx);
+    Reactor* r = server->reactors_[0].get();
+    HttpConn* client = server->users_.At(fd);
+    switch(op) {
+    case POOL_READ:     server->OnRead_(r, client); break;
+    case POOL_WRITE:    server->OnWrite_(r, client); break;
+    case POOL_PROCESS:  server->OnProcess_(r, client); break;
+    case POOL_EVENT:    server->OnEvent_(r, client, RUN_IO); break;
+    case POOL_EVENT_BLOCKING: server->OnEvent_(r, client, RUN_BLOCKING); break;
+    default:            assert(false);
+    }
+}
+
+void WebServer::OnRead_(Reactor* r, HttpConn* client) {
     assert(client);
     int ret = -1;
     int readErrno = 0;
     ret = client->read(&readErrno);         // 读取客户端套接字的数据，读到httpconn的读缓冲区
     if(ret <= 0 && readErrno != EAGAIN){    // 读异常 关闭客户端
-        CloseConn_(client);
+        CloseConn_(r, client);
         return;
     }
     // 业务逻辑处理 先读后处理
-    OnProcess_(client);
+    DispatchRequest_(r, client);
+}
+
+void WebServer::DispatchRequest_(Reactor* r, HttpConn* client, bool onLoop) {
+    // 访问数据库的请求转到blocking通道处理 不占用io通道的线程
+    if((blockpool_ != threadpool_ || onLoop) && client->MayBlock()) {
+        ToBlocking_(r, client, POOL_PROCESS);
+        return;
+    }
+    OnProcess_(r, client);
 }
 
-void WebServer::OnWrite_(HttpConn* client) {
+void WebServer::OnWrite_(Reactor* r, HttpConn* client, bool onLoop) {
     assert(client);
     int ret = -1;
     int writeErrno = 0;
@@ -191,32 +502,134 @@ void WebServer::OnWrite_(HttpConn* client) {
     if(client->ToWriteBytes() == 0){    
         // 传输完成
         if(client->IsKeepAlive()) {
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN); // 继续监听读事件
-            return;
-        }
-    }else if(ret < 0){
-        if(writeErrno == EAGAIN){   // 缓冲区满
-            // 继续传输
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+            // 流水线: 读缓冲区中还有完整请求时直接处理 只剩不完整的请求时才继续监听读事件
+            DispatchRequest_(r, client, onLoop);
             return;
         }
+    }else if(ret > 0 || writeErrno == EAGAIN){
+        // 缓冲区满 或LT模式剩余不多时先返回 继续传输
+        r->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, users_.Gen(client->GetFd()));
+        return;
     }
-    CloseConn_(client);
+    CloseConn_(r, client);
 }
 
-void WebServer::OnProcess_(HttpConn* client) {
+void WebServer::OnProcess_(Reactor* r, HttpConn* client) {
     // 调用process()进行逻辑处理
-    if(client->process()){
+    if(int n = client->process()){
+        r->reqCnt += n;
+        (threadpool_ ? r->offloadCnt : r->inlineCnt) += n;
         // 根据返回的信息将fd重新设置为EPOLOUT（写）或EPOLLIN（读）
         // 读完事件告诉内核可以写
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);    // 响应成功，修改监听事件为写，等待OnWrite_()发送
+        r->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLOUT, users_.Gen(client->GetFd()));    // 响应成功，修改监听事件为写，等待OnWrite_()发送
     }else{
         // 写完事件告诉内核可以读
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+        r->epoller->ModFd(client->GetFd(), connEvent_ | EPOLLIN, users_.Gen(client->GetFd()));
     }
 }
 
-bool WebServer::InitSocket_() {
+/* 常驻ET模式的处理 先写完积压的响应 再读到EAGAIN并处理 不调用epoll_ctl
+   on == RUN_LOOP: 在事件循环线程上运行 遇到大响应时连同占有权一起交给io通道
+   可能阻塞的请求连同占有权一起交给blocking通道 */
+void WebServer::OnEvent_(Reactor* r, HttpConn* client, RUN_ON on) {
+    assert(client);
+    int fd = client->GetFd();
+    bool mayOffload = (on == RUN_LOOP);
+    bool toBlocking = mayOffload || (on == RUN_IO && blockpool_ != threadpool_);
+    bool more = false;          // 上一批响应已写完 读缓冲区中可能还有流水线请求
+    do {
+        // 上次没写完的响应 写不动时等EPOLLOUT边沿
+        if(client->ToWriteBytes() > 0) {
+            if(mayOffload) {
+                threadpool_->AddOp(POOL_EVENT, client->GetFd());
+                return;
+            }
+            if(!WriteEt_(r, client)) return;
+        }
+        if(client->ToWriteBytes() == 0) {
+            // 处理缓冲区中剩下的请求时不再读 上次已读到EAGAIN 之后到达的数据会带来新的边沿
+            if(!more) {
+                users_.SetState(fd, ConnSlab::CONN_READING);
+                int readErrno = 0;
+                ssize_t ret = client->read(&readErrno);
+                if(ret <= 0 && readErrno != EAGAIN) {
+                    CloseConn_(r, client);
+                    return;
+                }
+            }
+            more = false;
+            if(toBlocking && client->MayBlock()) {
+                ToBlocking_(r, client, POOL_EVENT_BLOCKING);
+                return;
+            }
+            users_.SetState(fd, ConnSlab::CONN_PROCESSING);
+            if(int n = client->process()) {
+                r->reqCnt += n;
+                if(mayOffload && client->ToWriteBytes() > INLINE_WRITE_MAX) {
+                    r->offloadCnt += n;
+                    threadpool_->AddOp(POOL_EVENT, client->GetFd());
+                    return;
+                }
+                (on == RUN_LOOP || on == RUN_INLINE ? r->inlineCnt : r->offloadCnt) += n;
+                if(!WriteEt_(r, client)) return;
+                more = client->ToWriteBytes() == 0 && client->HasBuffered();
+            }
+        }
+    } while(more || (client->ReadPaused() && client->ToWriteBytes() == 0) || !users_.TryIdle(fd));
+}
+
+// 交给blocking通道 排队已满时回复繁忙并关闭连接
+void WebServer::ToBlocking_(Reactor* r, HttpConn* client, POOL_OP op) {
+    if(!blockpool_->TryAddOp(op, client->GetFd())) {
+        LOG_WARN("Blocking lane is full!");
+        // 只由CloseConn_关闭 先close再关一次时fd号可能已被其他线程重新打开
+        SendInfo_(client->GetFd(), "Server busy!");
+        CloseConn_(r, client);
+    }
+}
+
+bool WebServer::WriteEt_(Reactor* r, HttpConn* client) {
+    users_.SetState(client->GetFd(), ConnSlab::CONN_WRITING);
+    int writeErrno = 0;
+    ssize_t ret = client->write(&writeErrno);
+    if(client->ToWriteBytes() == 0) {
+        if(client->IsKeepAlive()) return true;
+    } else if(ret < 0 && writeErrno == EAGAIN) {
+        return true;                        // 缓冲区满 等待EPOLLOUT
+    }
+    CloseConn_(r, client);
+    return false;
+}
+
+WebServer::Stats WebServer::GetStats() const {
+    Stats stats = {0, 0, 0, 0, threadpool_ ? threadpool_->StolenCount() : 0};
+    for(auto& r: reactors_) {
+        stats.requests += r->reqCnt;
+        stats.epollCtl += r->epoller->CtlCount();
+        stats.inlined += r->inlineCnt;
+        stats.offloaded += r->offloadCnt;
+    }
+    return stats;
+}
+
+vector<unsigned long long> WebServer::GetReactorRequests() const {
+    vector<unsigned long long> reqs;
+    for(auto& r: reactors_) {
+        reqs.push_back(r->reqCnt);
+    }
+    return reqs;
+}
+
+const char* WebServer::IoBackend() const {
+    return reactors_[0]->uring ? "io_uring" : "epoll";
+}
+
+ThreadPool::Telemetry WebServer::GetLaneTelemetry(const std::string& lane) const {
+    ThreadPool* pool = lanes_.Lane(lane);
+    return pool ? pool->GetTelemetry() : ThreadPool::Telemetry();
+}
+
+bool WebServer::InitSocket_(Reactor* r) {
     int ret;
     struct sockaddr_in addr;
     if(port_ > 65535 || port_ < 1024){
@@ -233,16 +646,16 @@ bool WebServer::InitSocket_() {
         optLinger.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);// 创建socket
-    if(listenFd_ < 0) {
+    r->listenFd = socket(AF_INET, SOCK_STREAM, 0);// 创建socket
+    if(r->listenFd < 0) {
         LOG_ERROR("Create socket error!", port_);
         return false;
     }
 
     // socket设置
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(r->listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
     if(ret < 0) {
-        close(listenFd_);
+        close(r->listenFd);
         LOG_ERROR("Init linger error!", port_);
         return false;
     }
@@ -250,34 +663,62 @@ bool WebServer::InitSocket_() {
     int optval = 1;
     // 端口复用
     // 只有最后一个套接字会正常接受数据 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(r->listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if (ret == -1){
         LOG_ERROR("set socket setsockopt error!");
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
+    if(reactors_.size() > 1) {
+        // 多Reactor 每个Reactor一个监听套接字 由内核在它们之间分发新连接
+        ret = setsockopt(r->listenFd, SOL_SOCKET, SO_REUSEPORT, (const void*)&optval, sizeof(int));
+        if (ret == -1){
+            LOG_ERROR("set SO_REUSEPORT error!");
+            close(r->listenFd);
+            return false;
+        }
+    }
     // 绑定
-    ret = bind(listenFd_, (struct sockaddr*)&addr, sizeof addr);
+    ret = bind(r->listenFd, (struct sockaddr*)&addr, sizeof addr);
     if(ret < 0){
         LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
     // 监听
-    ret = listen(listenFd_, 6);
+    ret = listen(r->listenFd, 6);
     if(ret < 0) {
         LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
+        close(r->listenFd);
         return false;
     }
-    ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+    // io_uring模式由多发accept接收连接 不注册到epoll
+    ret = r->uring ? 1 : r->epoller->AddFd(r->listenFd, listenEvent_ | EPOLLIN);
     if(ret == 0){
         LOG_ERROR("Add listen error!");
-        close(listenFd_);
+        close(r->listenFd);
+        return false;
+    }
+    SetFdNonblock(r->listenFd);
+    LOG_INFO("Server port:%d, Reactor[%d] listenFd:%d", port_, r->id, r->listenFd);
+    return true;
+}
+
+/* 为SO_REUSEPORT组挂上CBPF程序: 返回 当前CPU % Reactor数
+   内核用返回值作为组内下标(即监听套接字bind的顺序)选择接收连接的套接字
+   配合Loop_中的CPU绑定 收到SYN的CPU上的Reactor来处理该连接 */
+bool WebServer::AttachCpuSteer_() {
+    struct sock_filter code[] = {
+        { BPF_LD  | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU) },  // A = 当前CPU
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)reactors_.size() },          // A = A % n
+        { BPF_RET | BPF_A, 0, 0, 0 },                                               // return A
+    };
+    struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+    int ret = setsockopt(reactors_[0]->listenFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+    if(ret < 0) {
+        LOG_WARN("Attach reuseport cbpf error!");
         return false;
     }
-    SetFdNonblock(listenFd_);
-    LOG_INFO("Server port:%d", port_);
     return true;
 }
 
@@ -2,6 +2,8 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <vector>
+#include <thread>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
@@ -9,13 +11,18 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <pthread.h>     // pthread_setaffinity_np()
+#include <linux/filter.h>   // sock_filter CBPF
 
 #include "epoller.h"
+#include "iouring.h"
+#include "connslab.h"
 #include "../timer/heaptimer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
-#include "../pool/threadpool.h"
+#include "../pool/executor.h"
 #include "../http/httpconn.h"
+#include "../http/upload.h"
 
 class WebServer {
 public:
@@ -23,30 +30,109 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger,
         int sqlPort, const char* sqlUser, const char* sqlPwd,
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize
+        bool openLog, int logLevel, int logQueSize,
+        int reactorNum = 0, bool cpuSteer = false, bool ioUring = false,
+        bool inlineSmall = false, bool connAffine = false,
+        int blockingNum = 0, int maxThreadNum = 0,
+        const char* rootDir = nullptr           // 资源在其下的resources/ 为空时取工作目录
     );
 
     ~WebServer();
     void Start();
 
+    // 运行统计 各Reactor之和
+    struct Stats {
+        unsigned long long requests;    // 已生成的响应数
+        unsigned long long epollCtl;    // epoll_ctl调用次数
+        unsigned long long inlined;     // 在事件循环线程上处理完的请求数
+        unsigned long long offloaded;   // 由线程池处理或写出的请求数
+        unsigned long long stolen;      // 连接亲和模式下被非所属线程执行的任务数
+    };
+    Stats GetStats() const;
+    std::vector<unsigned long long> GetReactorRequests() const;    // 各Reactor已生成的响应数
+    const char* IoBackend() const;              // "io_uring"或"epoll" io_uring不可用时为退回后的epoll
+
+    // 线程池通道("io"/"blocking")的排队深度、等待和执行时间直方图 通道不存在时全为0
+    ThreadPool::Telemetry GetLaneTelemetry(const std::string& lane) const;
+
 private:
+    // 每个Reactor独占一个epoll循环、定时器、监听套接字和自己的那部分连接
+    struct Reactor {
+        int id;
+        int listenFd;
+        std::unique_ptr<Epoller> epoller;
+        std::unique_ptr<HeapTimer> timer;
+        std::unique_ptr<IoUring> uring;             // 非空时使用io_uring代替epoll
+        std::atomic<unsigned long long> reqCnt;     // 已生成的响应数
+        std::atomic<unsigned long long> inlineCnt;  // 在事件循环线程上处理的请求数
+        std::atomic<unsigned long long> offloadCnt; // 由线程池处理或写出的请求数
+    };
+
+    // io_uring的user_data 高32位为操作类型 低32位为fd
+    enum URING_OP {
+        URING_ACCEPT = 1,
+        URING_RECV,
+        URING_WRITE,
+        URING_CLOSE,
+    };
+
+    // 交给线程池的操作 与fd一起编码进任务字
+    enum POOL_OP {
+        POOL_READ = 1,
+        POOL_WRITE,
+        POOL_PROCESS,
+        POOL_EVENT,
+        POOL_EVENT_BLOCKING,
+    };
+
+    // OnEvent_的运行位置
+    enum RUN_ON {
+        RUN_INLINE,     // 多Reactor 没有线程池 全部就地完成
+        RUN_LOOP,       // 单Reactor的事件循环线程 可交给线程池
+        RUN_IO,         // io通道
+        RUN_BLOCKING,   // blocking通道
+    };
+
     void InitEventMode_(int trigMode);          // 设置触发模式
-    bool InitSocket_();                         // 初始化Socket
-    void AddClient_(int fd, sockaddr_in addr);  // 添加客户端连接
+    bool InitSocket_(Reactor* r);               // 初始化Socket
+    bool AttachCpuSteer_();                     // 按CPU分发新连接的CBPF程序
+    void Loop_(Reactor* r);                     // 事件循环
+    void LoopUring_(Reactor* r);                // io_uring完成事件循环
+    void AddClient_(Reactor* r, int fd, sockaddr_in addr);  // 添加客户端连接
 
-    void DealListen_();                         // 处理监听套接字
-    void DealWrite_(HttpConn* client);          // 处理写事件
-    void DealRead_(HttpConn* client);           // 处理读事件
+    void DealListen_(Reactor* r);                       // 处理监听套接字
+    void DealWrite_(Reactor* r, HttpConn* client);      // 处理写事件
+    void DealRead_(Reactor* r, HttpConn* client);       // 处理读事件
+    void DealEvent_(Reactor* r, HttpConn* client);      // 常驻ET模式 处理读写事件
+    void ReadInline_(Reactor* r, HttpConn* client);     // 在事件循环线程上读 按请求决定就地处理或交给线程池
 
-    void SendError_(int fd, const char* info);  // 发送错误信息
-    void ExtentTime_(HttpConn* client);         // 调整定时事件
-    void CloseConn_(HttpConn* client);          // 关闭客户端连接
+    void SendError_(int fd, const char* info);          // 发送错误信息并关闭fd
+    void SendInfo_(int fd, const char* info);           // 只发送 不关闭
+    void ExtentTime_(Reactor* r, HttpConn* client);     // 调整定时事件
+    void CloseConn_(Reactor* r, HttpConn* client);      // 关闭客户端连接
+    void CloseExpired_(Reactor* r, int fd, uint32_t gen);   // 超时关闭
 
-    void OnRead_(HttpConn* client);
-    void OnWrite_(HttpConn* clinet);
-    void OnProcess_(HttpConn* clinet);
+    static void OnPoolOp_(void* ctx, int op, uint32_t fd);  // 线程池的操作处理函数
+    void OnRead_(Reactor* r, HttpConn* client);
+    void OnWrite_(Reactor* r, HttpConn* clinet, bool onLoop = false);     // onLoop: 在事件循环线程上调用
+    void OnProcess_(Reactor* r, HttpConn* clinet);
+    // 处理读缓冲区中的请求 可能阻塞的交给blocking通道 在事件循环线程上时交给线程池
+    void DispatchRequest_(Reactor* r, HttpConn* client, bool onLoop = false);
+    void OnEvent_(Reactor* r, HttpConn* client, RUN_ON on);
+    void ToBlocking_(Reactor* r, HttpConn* client, POOL_OP op);   // 交给blocking通道
+    bool WriteEt_(Reactor* r, HttpConn* client);        // 返回false表示连接已关闭
+
+    void OnRecvUring_(Reactor* r, int fd, const struct io_uring_cqe& cqe);
+    void OnWriteUring_(Reactor* r, int fd, const struct io_uring_cqe& cqe);
+    void ProcessUring_(Reactor* r, HttpConn* client);
+    void CloseUring_(Reactor* r, HttpConn* client);
 
     static const int MAX_FD = 65536;            // 最大连接数
+    static const size_t INLINE_WRITE_MAX = 16384;   // 超过该长度的响应交给线程池写
+    static const size_t BLOCKING_QUEUE_MAX = 1024;  // blocking通道排队上限
+    static const unsigned URING_ENTRIES = 2048;     // io_uring SQ大小
+    static const unsigned URING_BUF_COUNT = 1024;   // recv缓冲区环 缓冲区个数
+    static const unsigned URING_BUF_SIZE = 4096;    // recv缓冲区环 单个缓冲区大小
 
     static int SetFdNonblock(int fd);           // 设置文件非阻塞
 
@@ -54,16 +140,24 @@ private:
     bool openLinger_;
     int timeoutMS_;
     bool isClose_;
-    int listenFd_;
+    bool cpuSteer_;         // 多Reactor模式下绑定CPU并用CBPF按CPU分发连接
+    bool persistent_;       // 常驻ET模式 连接只注册一次 不用EPOLLONESHOT
+    bool inlineSmall_;      // 小的静态请求直接在事件循环线程上读、处理、写 不经线程池
     char* srcDir_;
 
     uint32_t listenEvent_;  // 监听事件
     uint32_t connEvent_;    // 连接事件
 
-    std::unique_ptr<HeapTimer> timer_;
-    std::unique_ptr<ThreadPool> threadpool_;
-    std::unique_ptr<Epoller> epoller_;
-    std::unordered_map<int, HttpConn> users_;   // 客户端连接 fd conn
+    ConnSlab users_;        // 客户端连接 按fd索引 各Reactor的fd互不相同 共用一个
+
+    /* reactorNum == 0: 单Reactor + 线程池，读写交给threadpool_("io"通道)，
+                        访问数据库的请求交给blockpool_("blocking"通道 blockingNum为0时即threadpool_)
+       reactorNum >  0: one loop per thread，每个Reactor用SO_REUSEPORT监听同一端口，
+                        在自己的线程内完成读、解析、写 */
+    Executor lanes_;
+    ThreadPool* threadpool_;
+    ThreadPool* blockpool_;
+    std::vector<std::unique_ptr<Reactor>> reactors_;
 };
 
 #endif
\ No newline at end of file
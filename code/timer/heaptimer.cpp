@@ -10,12 +10,11 @@ void HeapTimer::SwapNode_(size_t i, size_t j) {
 
 void HeapTimer::siftUp_(size_t i){
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;     // 父节点
-    while(j >= 0){
+    while(i > 0){               // size_t恒>=0 以i到达堆顶为终止条件
+        size_t j = (i - 1) / 2; // 父节点
         if(heap_[j] < heap_[i]) break;
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -98,8 +97,8 @@ void HeapTimer::tick(){
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0){
             break;
         }
+        pop();          // 先出堆再回调 回调中可以重新add同一id
         node.cb();
-        pop();
     }
 }
 
@@ -5,7 +5,47 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/server/webserver.h"
 #include <features.h>
+#include <chrono>
+#include <queue>
+#include <algorithm>
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <regex>
+#include <fstream>
+#include <random>
+#include <sys/resource.h>
+#include <zlib.h>
+
+/* 统计堆分配次数 用于检验线程池提交路径不分配内存
+   只统计测试主线程和登记过的线程(t_countAlloc) 之前的测试留在后台的线程(日志任务、服务器)不计入 */
+static std::atomic<bool> g_countAlloc(false);
+static std::atomic<long> g_allocCnt(0);
+static const pthread_t g_mainThread = pthread_self();
+static thread_local bool t_countAlloc = false;
+
+void* operator new(size_t size) {
+    if(g_countAlloc.load(std::memory_order_relaxed) && (t_countAlloc || pthread_equal(pthread_self(), g_mainThread))) {
+        g_allocCnt++;
+    }
+    void* p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+// 替换后的operator new也用malloc 与free配对
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
@@ -50,7 +90,2505 @@ void TestThreadPool() {
     getchar();
 }
 
+/* 原实现: 单互斥量任务队列 + notify_all 作为线程池吞吐对比的基准 */
+class MutexQueuePool {
+public:
+    explicit MutexQueuePool(size_t threadCount): pool_(std::make_shared<Pool>()) {
+        for(size_t i = 0; i < threadCount; i++) {
+            std::thread([pool = pool_] {
+                std::unique_lock<std::mutex> locker(pool->mtx);
+                while(true) {
+                    if(!pool->tasks.empty()) {
+                        auto task = std::move(pool->tasks.front());
+                        pool->tasks.pop();
+                        locker.unlock();
+                        task();
+                        locker.lock();
+                    }
+                    else if(pool->isClosed) break;
+                    else pool->cond.wait(locker);
+                }
+            }).detach();
+        }
+    }
+    ~MutexQueuePool() {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            pool_->isClosed = true;
+        }
+        pool_->cond.notify_all();
+    }
+    template<typename T>
+    void AddTask(T&& task) {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mtx);
+            pool_->tasks.emplace(std::forward<T>(task));
+        }
+        pool_->cond.notify_all();
+    }
+private:
+    struct Pool {
+        std::mutex mtx;
+        std::condition_variable cond;
+        bool isClosed = false;
+        std::queue<std::function<void()>> tasks;
+    };
+    std::shared_ptr<Pool> pool_;
+};
+
+// 外部线程提交tasks个小任务 返回每秒完成的任务数
+template<typename P>
+double BenchPool(size_t threads, int tasks) {
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        P pool(threads);
+        for(int i = 0; i < tasks; i++) {
+            pool.AddTask([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+        }
+        while(done.load() < tasks) std::this_thread::yield();
+    }
+    return tasks / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 任务在工作线程内继续派生子任务 检验本地队列与窃取
+void SpawnTree(ThreadPool* pool, int depth, std::atomic<int>* leaves) {
+    if(depth == 0) {
+        (*leaves)++;
+        return;
+    }
+    pool->AddTask(std::bind(SpawnTree, pool, depth - 1, leaves));
+    pool->AddTask(std::bind(SpawnTree, pool, depth - 1, leaves));
+}
+
+void TestThreadPoolThroughput() {
+    const size_t threads[] = {1, 4, 16, 64};
+    const int TASKS = 200000;
+    for(size_t n: threads) {
+        double ws = BenchPool<ThreadPool>(n, TASKS);
+        double mq = BenchPool<MutexQueuePool>(n, TASKS);
+        printf("threads %2zu: work-stealing %.0f tasks/s, mutex queue %.0f tasks/s\n", n, ws, mq);
+
+        std::atomic<int> leaves(0);
+        {
+            ThreadPool pool(n);
+            pool.AddTask(std::bind(SpawnTree, &pool, 14, &leaves));
+            while(leaves.load() < (1 << 14)) std::this_thread::yield();
+        }
+        assert(leaves == (1 << 14));
+    }
+}
+
+struct AllocCtx {
+    std::atomic<int> done;
+    std::atomic<int> ops[4];        // 由多个工作线程累加
+};
+
+// 执行任务的工作线程也统计堆分配
+void CountTask(AllocCtx* ctx, int a, int b) {
+    t_countAlloc = true;
+    ctx->done.fetch_add(a - b + 1, std::memory_order_relaxed);
+}
+
+void CountOp(void* ctx, int op, uint32_t slot) {
+    t_countAlloc = true;
+    AllocCtx* c = static_cast<AllocCtx*>(ctx);
+    c->ops[op].fetch_add(1, std::memory_order_relaxed);
+    c->done.fetch_add(slot == 7 ? 1 : 0, std::memory_order_relaxed);
+}
+
+// 预热(任务节点块、队列扩容)之后 在途任务数不超过预热时的规模 提交闭包任务和(操作码, 连接槽)任务都不应分配堆内存
+void TestTaskAlloc() {
+    const int N = 100000, BATCH = 1000;
+    AllocCtx ctx;
+    ctx.done = 0;
+    ThreadPool pool(4);
+    pool.SetOpHandler(CountOp, &ctx);
+    for(int round = 0; round < 2; round++) {
+        ctx.done = 0;
+        for(auto& cnt: ctx.ops) cnt = 0;
+        g_allocCnt = 0;
+        g_countAlloc = (round == 1);
+        // 同时在途的任务数有上限(如服务器的连接数) 与预热轮相同
+        for(int i = 0; i < N; i++) {
+            if(i % 2) {
+                pool.AddTask(std::bind(CountTask, &ctx, i, i));
+            } else {
+                pool.AddOp(i % 4, 7);
+            }
+            if(i % BATCH == BATCH - 1) {
+                while(ctx.done.load() <= i) std::this_thread::yield();
+            }
+        }
+        g_countAlloc = false;
+        printf("round %d: %d tasks, %ld heap allocations\n", round, N, g_allocCnt.load());
+    }
+    assert(ctx.ops[0] + ctx.ops[2] == N / 2 && ctx.ops[1] == 0 && ctx.ops[3] == 0);
+    assert(g_allocCnt == 0);
+}
+
+// 遥测: 排队深度、等待/执行时间直方图 动态线程数: 排队持续变慢时增长 空闲超过冷却时间后收缩回下限
+void TestPoolTelemetry() {
+    {
+        ThreadPool pool(2);
+        std::atomic<int> done(0);
+        for(int i = 0; i < 200; i++) {
+            pool.AddTask([&done] { usleep(1000); done++; });
+        }
+        size_t depth = pool.GetTelemetry().queueDepth;
+        while(done < 200) usleep(1000);
+        ThreadPool::Telemetry t = pool.GetTelemetry();
+        printf("fixed: depth %zu, executed %llu, wait p50 %.0f us p99 %.0f us, run p50 %.0f us p99 %.0f us\n",
+                depth, t.executed, t.WaitUs(0.5), t.WaitUs(0.99), t.RunUs(0.5), t.RunUs(0.99));
+        assert(depth > 0 && t.executed == 200 && t.threads == 2 && t.grown == 0);
+        assert(t.RunUs(0.5) >= 1024 && t.WaitUs(0.99) > t.WaitUs(0.01));
+    }
+    {
+        ThreadPool pool(1, false, 8, 5, 300);
+        std::atomic<int> done(0);
+        for(int i = 0; i < 400; i++) {
+            pool.AddTask([&done] { usleep(2000); done++; });
+        }
+        size_t peak = 1;
+        auto start = std::chrono::steady_clock::now();
+        while(done < 400) {
+            peak = std::max(peak, pool.ThreadCount());
+            usleep(1000);
+        }
+        double busyMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for(int i = 0; i < 100 && pool.ThreadCount() > 1; i++) usleep(100 * 1000);
+        ThreadPool::Telemetry t = pool.GetTelemetry();
+        printf("dynamic: 400 x 2ms tasks in %.0f ms, peak threads %zu, grown %llu, retired %llu, now %zu threads\n",
+                busyMs, peak, t.grown, t.retired, t.threads);
+        assert(peak > 1 && t.grown > 0 && t.retired == t.grown && t.threads == 1);
+    }
+}
+
+/* 压测客户端: conns个线程各用一条keep-alive连接顺序发送reqs个请求 返回每秒完成的请求数 */
+static int ReadResponse(int fd, std::string& buf, std::string* head = nullptr, std::string* body = nullptr) {
+    size_t headEnd;
+    while((headEnd = buf.find("\r\n\r\n")) == std::string::npos) {
+        char tmp[4096];
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if(n <= 0) return -1;
+        buf.append(tmp, n);
+    }
+    size_t lenPos = buf.find("Content-length: ");
+    size_t total = headEnd + 4 + (lenPos < headEnd ? atoi(buf.c_str() + lenPos + 16) : 0);
+    while(buf.size() < total) {
+        char tmp[65536];
+        ssize_t n = read(fd, tmp, sizeof(tmp));
+        if(n <= 0) return -1;
+        buf.append(tmp, n);
+    }
+    int code = atoi(buf.c_str() + 9);
+    if(head) head->assign(buf, 0, headEnd + 4);
+    if(body) body->assign(buf, headEnd + 4, total - headEnd - 4);
+    buf.erase(0, total);
+    return code;
+}
+
+double BenchKeepAlive(int port, const char* path, int conns, int reqs, std::vector<double>* latMs = nullptr) {
+    std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    std::atomic<int> done(0);
+    std::mutex latMtx;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int c = 0; c < conns; c++) {
+        threads.emplace_back([&] {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr = {0};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) { close(fd); return; }
+            std::string buf;
+            std::vector<double> lat;
+            for(int i = 0; i < reqs; i++) {
+                auto t0 = std::chrono::steady_clock::now();
+                if(write(fd, req.data(), req.size()) != (ssize_t)req.size()) break;
+                if(ReadResponse(fd, buf) < 0) break;
+                lat.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+                done++;
+            }
+            if(latMs) {
+                std::lock_guard<std::mutex> locker(latMtx);
+                latMs->insert(latMs->end(), lat.begin(), lat.end());
+            }
+            close(fd);
+        });
+    }
+    for(auto& t: threads) t.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return done / sec;
+}
+
+/* 含resources/的项目根目录的绝对路径 在项目根目录或test/下运行都可以
+   不切换工作目录 其他测试(如日志)的相对路径不受影响 */
+static const std::string& RootDir() {
+    static const std::string root = [] {
+        char* dir = realpath(access("./resources", F_OK) == 0 ? "." : "..", nullptr);
+        std::string ret = dir ? dir : "";
+        free(dir);
+        return ret;
+    }();
+    return root;
+}
+
+static std::string ResourcePath(const std::string& name) {
+    return RootDir() + "/resources" + name;
+}
+
+// 在后台线程启动服务器 资源目录为RootDir()下的resources/
+WebServer* StartServer(int port, int trigMode, int reactorNum = 0, bool inlineSmall = false, bool connAffine = false,
+                       int blockingNum = 0, bool ioUring = false) {
+    WebServer* server = new WebServer(port, trigMode, 60000, false,
+                            3306, "root", "qwer", "yourdb", 1, 4, false, 1, 0,
+                            reactorNum, false, ioUring, inlineSmall, connAffine, blockingNum, 0, RootDir().c_str());
+    std::thread([server] { server->Start(); }).detach();
+    usleep(100 * 1000);
+    return server;
+}
+
+// 对比EPOLLONESHOT模式(3)与常驻ET模式(4)每个请求的epoll_ctl次数
+void TestEpollCtl() {
+    const int modes[] = {3, 4};
+    for(int i = 0; i < 2; i++) {
+        int port = 9100 + i;
+        WebServer* server = StartServer(port, modes[i]);
+        double qps = BenchKeepAlive(port, "/index.html", 16, 2000);
+        WebServer::Stats stats = server->GetStats();
+        printf("trigMode %d: %.0f req/s, %llu requests, %llu epoll_ctl, %.3f epoll_ctl/request\n",
+                modes[i], qps, stats.requests, stats.epollCtl, (double)stats.epollCtl / stats.requests);
+    }
+}
+
+// 小请求就地处理与全部交给线程池对比 大文件(jquery.js 85KB)始终交给线程池写
+void TestInlineDispatch() {
+    const int modes[] = {3, 4};
+    for(int i = 0; i < 4; i++) {
+        int port = 9110 + i;
+        bool inlineSmall = i % 2;
+        WebServer* server = StartServer(port, modes[i / 2], 0, inlineSmall);
+        double small = BenchKeepAlive(port, "/index.html", 16, 2000);
+        double large = BenchKeepAlive(port, "/js/jquery.js", 4, 500);
+        WebServer::Stats stats = server->GetStats();
+        printf("trigMode %d inline %d: small %.0f req/s, large %.0f req/s, inlined %llu, offloaded %llu\n",
+                modes[i / 2], inlineSmall, small, large, stats.inlined, stats.offloaded);
+        assert(stats.inlined + stats.offloaded == stats.requests);
+        assert(!inlineSmall || (stats.inlined == 32000 && stats.offloaded == 2000));
+    }
+}
+
+/* 对进程内已有的每个线程各开一个缓存未命中计数器 在服务器启动后、压测线程创建前调用
+   只统计服务器线程(及空闲的测试主线程) 硬件计数器不可用时返回空 */
+std::vector<int> OpenCacheMissCounters() {
+    std::vector<int> fds;
+    DIR* dir = opendir("/proc/self/task");
+    if(!dir) return fds;
+    struct dirent* ent;
+    while((ent = readdir(dir))) {
+        if(ent->d_name[0] == '.') continue;
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.exclude_kernel = 1;
+        int fd = syscall(__NR_perf_event_open, &attr, atoi(ent->d_name), -1, -1, 0);
+        if(fd < 0) {
+            for(int f: fds) close(f);
+            fds.clear();
+            break;
+        }
+        fds.push_back(fd);
+    }
+    closedir(dir);
+    return fds;
+}
+
+long long ReadCacheMisses(std::vector<int>& fds) {
+    long long total = 0;
+    for(int fd: fds) {
+        long long val = 0;
+        if(read(fd, &val, sizeof(val)) == sizeof(val)) total += val;
+        close(fd);
+    }
+    fds.clear();
+    return total;
+}
+
+// keep-alive压测 对比连接亲和调度与任意线程调度 的吞吐、被窃取的任务数和服务器线程的缓存未命中
+void TestConnAffinity() {
+    for(int i = 0; i < 4; i++) {
+        int port = 9120 + i;
+        bool affine = i % 2;
+        int trigMode = i < 2 ? 3 : 4;
+        WebServer* server = StartServer(port, trigMode, 0, false, affine);
+        std::vector<int> counters = OpenCacheMissCounters();
+        bool hasCounters = !counters.empty();
+        double qps = BenchKeepAlive(port, "/index.html", 32, 1000);
+        long long misses = ReadCacheMisses(counters);
+        WebServer::Stats stats = server->GetStats();
+        if(hasCounters) {
+            printf("trigMode %d affine %d: %.0f req/s, stolen %llu, %.1f cache-misses/request\n",
+                    trigMode, affine, qps, stats.stolen, (double)misses / stats.requests);
+        } else {
+            printf("trigMode %d affine %d: %.0f req/s, stolen %llu, cache-misses n/a\n",
+                    trigMode, affine, qps, stats.stolen);
+        }
+        assert(stats.requests == 32000);
+        assert(affine || stats.stolen == 0);
+    }
+}
+
+// 模拟慢数据库 每次验证耗时200ms
+bool SlowVerify(const std::string&, const std::string&, bool) {
+    usleep(200 * 1000);
+    return true;
+}
+
+// 不断发送登录请求 每次新建连接
+void PostLoginLoop(int port, std::atomic<bool>* stop) {
+    const char body[] = "username=test&password=test";
+    char req[512];
+    snprintf(req, sizeof(req), "POST /login HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n%s",
+             strlen(body), body);
+    while(!*stop) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && write(fd, req, strlen(req)) > 0) {
+            std::string buf;
+            ReadResponse(fd, buf);
+        }
+        close(fd);
+    }
+}
+
+// 数据库变慢时 静态GET的p99不应受影响: 对比所有请求共用线程池与登录请求走独立的blocking通道
+void TestBlockingLane() {
+    HttpRequest::SetUserVerifier(SlowVerify);
+    double p99[2];
+    for(int i = 0; i < 2; i++) {
+        int port = 9130 + i;
+        int blockingNum = i ? 2 : 0;
+        StartServer(port, 3, 0, false, false, blockingNum);
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> posters;
+        for(int j = 0; j < 8; j++) {
+            posters.emplace_back(PostLoginLoop, port, &stop);
+        }
+        usleep(100 * 1000);
+        std::vector<double> lat;
+        double qps = BenchKeepAlive(port, "/index.html", 8, 200, &lat);
+        stop = true;
+        for(auto& t: posters) t.join();
+        std::sort(lat.begin(), lat.end());
+        p99[i] = lat[lat.size() * 99 / 100];
+        printf("blocking lane %d: static %.0f req/s, p50 %.2f ms, p99 %.2f ms\n",
+                blockingNum, qps, lat[lat.size() / 2], p99[i]);
+    }
+    HttpRequest::SetUserVerifier(nullptr);
+    assert(p99[1] < 50 && p99[1] < p99[0]);
+}
+
+/* 原来的正则实现 作为解析器基准 每行复制成string 请求行和每个头部都构造一次regex */
+struct RegexRequest {
+    std::string method, path, version;
+    std::unordered_map<std::string, std::string> header;
+
+    void Parse(Buffer& buff) {
+        const char CRLF[] = "\r\n";
+        bool inHeaders = false;
+        while(buff.ReadableBytes()) {
+            const char* lineEnd = std::search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
+            std::string line(buff.Peek(), lineEnd);
+            std::smatch subMatch;
+            if(!inHeaders) {
+                std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+                if(!std::regex_match(line, subMatch, patten)) return;
+                method = subMatch[1];
+                path = subMatch[2];
+                version = subMatch[3];
+                inHeaders = true;
+            } else {
+                std::regex patten("^([^:]*): ?(.*)$");
+                if(!std::regex_match(line, subMatch, patten)) break;
+                header[subMatch[1]] = subMatch[2];
+            }
+            if(lineEnd == buff.BeginWrite()) break;
+            buff.RetrieveUntil(lineEnd + 2);
+        }
+        buff.Retrieve(buff.ReadableBytes());
+    }
+};
+
+// 两个连续的请求在任意位置被切开 分两次到达 都应解析出相同结果并且恰好取走各自的字节
+void TestHttpParser() {
+    const std::string req1 = "POST /submit HTTP/1.1\r\nHost: localhost\r\nContent-Type: text/plain\r\n"
+                             "Content-Length: 11\r\nConnection:  keep-alive \r\n\r\nhello world";
+    const std::string req2 = "GET / HTTP/1.0\r\nHost: localhost\r\n\r\n";
+    const std::string stream = req1 + req2;
+    for(size_t cut = 0; cut <= stream.size(); cut++) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(stream.data(), cut);
+        std::vector<HttpRequest::HTTP_CODE> results;
+        HttpRequest::HTTP_CODE ret;
+        while((ret = request.parse(buff)) == HttpRequest::GET_REQUEST) {
+            if(results.empty()) {
+                assert(request.method() == "POST" && request.path() == "/submit" && request.version() == "1.1");
+                assert(request.HeaderCount() == 4 && request.GetHeader("content-type") == "text/plain");
+                assert(request.IsKeepAlive());
+            } else {
+                assert(request.method() == "GET" && request.path() == "/index.html" && !request.IsKeepAlive());
+            }
+            results.push_back(ret);
+        }
+        assert(ret == HttpRequest::NO_REQUEST);
+        assert(results.size() == (cut >= stream.size() ? 2u : cut >= req1.size() ? 1u : 0u));
+        buff.Append(stream.data() + cut, stream.size() - cut);
+        while(request.parse(buff) == HttpRequest::GET_REQUEST) {
+            results.push_back(HttpRequest::GET_REQUEST);
+        }
+        assert(results.size() == 2 && buff.ReadableBytes() == 0);
+    }
+
+    // 常用头部按完美哈希落到固定槽位 其余头部和重复的常用头部放在数组中
+    for(int id = 0; id < HttpRequest::HDR_COUNT; id++) {
+        std::string name = HttpRequest::HeaderName((HttpRequest::HEADER)id);
+        std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+        assert(HttpRequest::LookupHeader(name.c_str()) == id);
+        name.back() = '_';
+        assert(HttpRequest::LookupHeader(name.c_str()) == HttpRequest::HDR_COUNT);
+    }
+    {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(std::string("GET / HTTP/1.1\r\nHOST: a\r\naccept: x\r\nAccept: y\r\nX-Custom: z\r\n\r\n"));
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.HeaderCount() == 4);
+        assert(request.GetHeader(HttpRequest::HDR_HOST) == "a" && request.GetHeader(HttpRequest::HDR_ACCEPT) == "x");
+        assert(request.GetHeader("x-custom") == "z" && request.GetHeader(HttpRequest::HDR_RANGE).empty());
+    }
+
+    const char* bad[] = {"GARBAGE\r\n\r\n", "GET / HTTP/1.1\r\nNoColon\r\n\r\n", "GET  / HTTP/1.1\r\n\r\n",
+                         "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",
+                         "GET / HTTP/1.1\r\nContent-Length: 0\r\ncontent-length: 0\r\n\r\n"};
+    for(const char* req: bad) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(req, strlen(req));
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST && buff.ReadableBytes() == 0);
+    }
+    Buffer buff;
+    HttpRequest request;
+    std::string huge = "GET / HTTP/1.1\r\nX-Pad: " + std::string(HttpRequest::MAX_HEAD_BYTES, 'a');
+    buff.Append(huge);
+    assert(request.parse(buff) == HttpRequest::BAD_REQUEST);
+
+    // 基准: 典型浏览器GET请求
+    const std::string req = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:1316\r\nConnection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\nAccept-Language: en-US,en;q=0.9\r\n"
+        "Cache-Control: max-age=0\r\nUpgrade-Insecure-Requests: 1\r\n\r\n";
+    // 预热后解析不再分配堆内存 调试日志会分配 计数期间关掉
+    const int N = 200000, REGEX_N = 5000;
+    int logLevel = Log::Instance()->GetLevel();
+    Log::Instance()->SetLevel(3);
+    buff.Append(req);
+    request.parse(buff);
+    g_allocCnt = 0;
+    g_countAlloc = true;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        buff.Append(req);
+        HttpRequest::HTTP_CODE ret = request.parse(buff);
+        assert(ret == HttpRequest::GET_REQUEST);
+        (void)ret;
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long allocs = g_allocCnt.exchange(0);
+    RegexRequest regexRequest;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < REGEX_N; i++) {
+        buff.Append(req);
+        regexRequest.Parse(buff);
+    }
+    double regexSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    g_countAlloc = false;
+    long regexAllocs = g_allocCnt;
+    Log::Instance()->SetLevel(logLevel);
+    assert(regexRequest.header.size() == request.HeaderCount() && request.GetHeader(HttpRequest::HDR_USER_AGENT).size() > 0);
+    printf("http parser (%zu B request): state machine %.0f req/s %.2f ns/B %.1f allocs/req, "
+           "regex %.0f req/s %.2f ns/B %.1f allocs/req\n",
+            req.size(), N / sec, sec * 1e9 / N / req.size(), (double)allocs / N,
+            REGEX_N / regexSec, regexSec * 1e9 / REGEX_N / req.size(), (double)regexAllocs / REGEX_N);
+    assert(allocs == 0);
+}
+
+// 各SIMD实现与标量实现逐字节对比 再在不同大小的浏览器请求头上对比解析速度
+void TestCharScan() {
+    const CharScan::ISA best = CharScan::Isa();
+    unsigned seed = 12345;
+    char data[300];
+    for(int round = 0; round < 2000; round++) {
+        int len = rand_r(&seed) % 260;
+        for(int i = 0; i < len; i++) {
+            // 多数为可见字符 少量控制字符和高位字符
+            int r = rand_r(&seed) % 100;
+            data[i] = r < 90 ? 0x21 + rand_r(&seed) % 94 : r < 95 ? rand_r(&seed) % 0x21 : 0x7f + rand_r(&seed) % 0x81;
+        }
+        int off = rand_r(&seed) % 33;
+        if(off > len) off = len;
+        for(int set = 0; set < CharScan::SET_COUNT; set++) {
+            CharScan::SetIsa(CharScan::ISA_SCALAR);
+            const char* expect = CharScan::Find(data + off, data + len, (CharScan::CHAR_SET)set);
+            for(int isa = CharScan::ISA_SSE42; isa <= best; isa++) {
+                CharScan::SetIsa((CharScan::ISA)isa);
+                assert(CharScan::Find(data + off, data + len, (CharScan::CHAR_SET)set) == expect);
+            }
+        }
+    }
+
+    std::string head = "GET /index.html HTTP/1.1\r\nHost: 127.0.0.1:1316\r\nConnection: keep-alive\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"120\", \"Not?A_Brand\";v=\"8\"\r\nsec-ch-ua-mobile: ?0\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\nUpgrade-Insecure-Requests: 1\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+        "Sec-Fetch-Site: none\r\nSec-Fetch-Mode: navigate\r\nSec-Fetch-Dest: document\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\nAccept-Language: en-US,en;q=0.9\r\n";
+    const std::string cookie = "Cookie: _ga=GA1.1.1234567890.1700000000; session=" + std::string(420, 'x') + "\r\n";
+    const char* names[] = {"scalar", "sse4.2", "avx2"};
+    for(int cookies = 0; cookies < 3; cookies++) {
+        std::string req = head;
+        for(int i = 0; i < cookies; i++) req += cookie;
+        req += "\r\n";
+        printf("http head %4zu B:", req.size());
+        for(int isa = CharScan::ISA_SCALAR; isa <= best; isa++) {
+            CharScan::SetIsa((CharScan::ISA)isa);
+            Buffer buff;
+            HttpRequest request;
+            const int N = 100000;
+            auto start = std::chrono::steady_clock::now();
+            for(int i = 0; i < N; i++) {
+                buff.Append(req);
+                HttpRequest::HTTP_CODE ret = request.parse(buff);
+                assert(ret == HttpRequest::GET_REQUEST);
+                (void)ret;
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            assert(request.HeaderCount() == 13u + cookies);
+            printf(" %s %.0f req/s %.2f ns/B,", names[isa], N / sec, sec * 1e9 / N / req.size());
+        }
+        printf("\n");
+    }
+    CharScan::SetIsa(best);
+}
+
+static int ConnectLoopback(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 流水线压测: 每条连接一次写入depth个请求 再依次读完depth个响应 返回每秒完成的请求数
+   与wrk --pipeline一样不带Connection头部 HTTP/1.1默认保持连接 */
+double BenchPipeline(int port, const char* path, int conns, int reqs, int depth) {
+    std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    std::string batch;
+    for(int i = 0; i < depth; i++) batch += req;
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int c = 0; c < conns; c++) {
+        threads.emplace_back([&] {
+            int fd = ConnectLoopback(port);
+            if(fd < 0) return;
+            std::string buf;
+            for(int i = 0; i < reqs; i += depth) {
+                if(write(fd, batch.data(), batch.size()) != (ssize_t)batch.size()) break;
+                int j = 0;
+                for(; j < depth && ReadResponse(fd, buf) == 200; j++) done++;
+                if(j < depth) break;
+            }
+            close(fd);
+        });
+    }
+    for(auto& t: threads) t.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return done / sec;
+}
+
+/* 一次写入超过MAX_PIPELINE个请求 最后一个请求分两次到达 响应须按请求顺序全部返回
+   不保持连接的请求之后的请求不再处理 */
+void TestPipelining() {
+    struct Mode { int trigMode, reactorNum; bool inlineSmall, ioUring; };
+    const Mode modes[] = {{3, 0, false, false}, {4, 0, false, false}, {3, 0, true, false},
+                          {4, 0, true, false}, {4, 1, false, true}};
+    const char* paths[] = {"/index.html", "/nope.html", "/css/style.css"};
+    const int codes[] = {200, 404, 200};
+    for(int m = 0; m < 5; m++) {
+        int port = 9140 + m;
+        StartServer(port, modes[m].trigMode, modes[m].reactorNum, modes[m].inlineSmall, false, 0, modes[m].ioUring);
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        std::string batch;
+        const int N = 3 * HttpConn::MAX_PIPELINE;
+        for(int i = 0; i < N; i++) {
+            batch += std::string("GET ") + paths[i % 3] + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+        }
+        std::string last = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+        batch += last.substr(0, 20);
+        assert(write(fd, batch.data(), batch.size()) == (ssize_t)batch.size());
+        std::string buf;
+        for(int i = 0; i < N; i++) {
+            assert(ReadResponse(fd, buf) == codes[i % 3]);
+        }
+        usleep(20 * 1000);
+        assert(buf.empty());
+        assert(write(fd, last.data() + 20, last.size() - 20) == (ssize_t)last.size() - 20);
+        assert(ReadResponse(fd, buf) == 200);
+
+        std::string closing = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n" + last;
+        assert(write(fd, closing.data(), closing.size()) == (ssize_t)closing.size());
+        assert(ReadResponse(fd, buf) == 200);
+        assert(ReadResponse(fd, buf) < 0 && buf.empty());
+        close(fd);
+
+        // 不带Connection头部的HTTP/1.1请求默认保持连接 Connection是token列表 HTTP/1.0须明确带keep-alive
+        fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        std::string plain = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        std::string mixed = plain + plain + plain
+                          + "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n"
+                          + "GET / HTTP/1.1\r\nConnection: TE, Close\r\n\r\n" + plain;
+        assert(write(fd, mixed.data(), mixed.size()) == (ssize_t)mixed.size());
+        for(int i = 0; i < 5; i++) {
+            assert(ReadResponse(fd, buf) == 200);
+        }
+        assert(ReadResponse(fd, buf) < 0 && buf.empty());
+        close(fd);
+        fd = ConnectLoopback(port);
+        std::string old10 = "GET / HTTP/1.0\r\n\r\n" + plain;
+        assert(write(fd, old10.data(), old10.size()) == (ssize_t)old10.size());
+        assert(ReadResponse(fd, buf) == 200);
+        assert(ReadResponse(fd, buf) < 0 && buf.empty());
+        close(fd);
+
+        double single = BenchPipeline(port, "/index.html", 8, 2000, 1);
+        double piped = BenchPipeline(port, "/index.html", 8, 2000, 16);
+        printf("pipelining trigMode %d reactors %d inline %d io_uring %d: depth 1 %.0f req/s, depth 16 %.0f req/s\n",
+                modes[m].trigMode, modes[m].reactorNum, modes[m].inlineSmall, modes[m].ioUring, single, piped);
+    }
+}
+
+// 把请求体写进计数器的流式接收者 只接收路径为/stream的请求
+struct CountSink: public HttpRequest::BodySink {
+    static size_t bytes;
+    static int ended;
+    bool OnData(const char*, size_t len) override {
+        bytes += len;
+        return true;
+    }
+    bool OnEnd() override {
+        ended++;
+        return true;
+    }
+};
+size_t CountSink::bytes = 0;
+int CountSink::ended = 0;
+
+std::unique_ptr<HttpRequest::BodySink> MakeCountSink(const HttpRequest& request) {
+    if(request.path() != "/stream") return nullptr;
+    return std::unique_ptr<HttpRequest::BodySink>(new CountSink());
+}
+
+// 按Content-Length和chunked分帧的请求体 在任意位置切开都能续解析 之后的流水线请求不受影响
+void TestRequestBody() {
+    const std::string next = "GET / HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    const std::string reqs[] = {
+        "POST /submit HTTP/1.1\r\nContent-Type: text/plain\r\nContent-Length: 12\r\n\r\nhello\r\nworld",
+        "POST /submit HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+            "5\r\nhello\r\n7;ext=1\r\n\r\nworld\r\n0\r\nX-Trailer: 1\r\n\r\n",
+    };
+    for(const std::string& req: reqs) {
+        const std::string stream = req + next;
+        for(size_t cut = 0; cut <= stream.size(); cut++) {
+            Buffer buff;
+            HttpRequest request;
+            buff.Append(stream.data(), cut);
+            HttpRequest::HTTP_CODE ret = request.parse(buff);
+            if(ret == HttpRequest::NO_REQUEST) {
+                assert(cut < req.size());
+                buff.Append(stream.data() + cut, stream.size() - cut);
+                ret = request.parse(buff);
+            } else {
+                buff.Append(stream.data() + cut, stream.size() - cut);
+            }
+            assert(ret == HttpRequest::GET_REQUEST && request.body() == "hello\r\nworld");
+            assert(request.method() == "POST" && request.path() == "/submit" && request.BodyBytes() == 12);
+            assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.path() == "/index.html");
+            assert(request.body().empty() && buff.ReadableBytes() == 0);
+        }
+    }
+
+    const char* bad[] = {
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n0\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nabc\r\n0\r\n\r\n",
+    };
+    for(const char* req: bad) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(req, strlen(req));
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST && buff.ReadableBytes() == 0);
+    }
+
+    // 内存中的请求体超过上限: Content-Length在头部结束时就拒绝 chunked在累计超过时拒绝
+    HttpRequest::SetMaxBodySize(8);
+    const char* large[] = {
+        "POST / HTTP/1.1\r\nContent-Length: 9\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n5\r\nworld\r\n",
+    };
+    for(const char* req: large) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(req, strlen(req));
+        assert(request.parse(buff) == HttpRequest::TOO_LARGE_REQUEST);
+    }
+    HttpRequest::SetMaxBodySize(HttpRequest::DEFAULT_MAX_BODY);
+
+    // 流式接收: 4MB的chunked请求体分64KB到达 超过内存上限也能接收 读缓冲区不随请求体增长
+    HttpRequest::SetBodySinkFactory(MakeCountSink);
+    {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(std::string("POST /stream HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"));
+        assert(request.parse(buff) == HttpRequest::NO_REQUEST && request.GetBodySink());
+        const std::string chunk = "10000\r\n" + std::string(0x10000, 'x') + "\r\n";
+        size_t maxBuffered = 0;
+        for(int i = 0; i < 64; i++) {
+            buff.Append(chunk);
+            assert(request.parse(buff) == HttpRequest::NO_REQUEST);
+            maxBuffered = std::max(maxBuffered, buff.ReadableBytes());
+        }
+        buff.Append(std::string("0\r\n\r\n"));
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST);
+        assert(CountSink::bytes == 64 * 0x10000 && CountSink::ended == 1 && request.body().empty());
+        assert(maxBuffered == 0 && buff.buffer_.size() < 2 * chunk.size());
+    }
+    HttpRequest::SetBodySinkFactory(nullptr);
+
+    // 经过服务器: 请求体正确分帧后流水线中的下一个请求照常处理 超过上限回复413并关闭连接
+    int port = 9150;
+    StartServer(port, 4);
+    int fd = ConnectLoopback(port);
+    assert(fd >= 0);
+    std::string body = reqs[1];
+    body.replace(body.find("HTTP/1.1\r\n") + 10, 0, "Connection: keep-alive\r\n");
+    body += next;
+    assert(write(fd, body.data(), body.size()) == (ssize_t)body.size());
+    std::string buf;
+    assert(ReadResponse(fd, buf) == 404 && ReadResponse(fd, buf) == 200);
+    std::string huge = "POST /submit HTTP/1.1\r\nContent-Length: 2000000\r\nConnection: keep-alive\r\n\r\n";
+    assert(write(fd, huge.data(), huge.size()) == (ssize_t)huge.size());
+    assert(ReadResponse(fd, buf) == 413 && ReadResponse(fd, buf) < 0);
+    close(fd);
+}
+
+static std::atomic<int> g_verifyCnt(0);
+
+bool CountVerify(const std::string&, const std::string&, bool) {
+    g_verifyCnt++;
+    return true;
+}
+
+/* 登录表单的头部和请求体分两次到达 头部已从读缓冲区取走 请求体仍须交给blocking通道
+   每种模式下blocking通道恰好执行两次: 处理头部 和收到请求体后验证用户 */
+void TestSplitFormPost() {
+    struct Mode { int trigMode; bool inlineSmall; };
+    const Mode modes[] = {{3, false}, {4, false}, {3, true}, {4, true}};
+    const char body[] = "username=test&password=test";
+    char head[512];
+    snprintf(head, sizeof(head), "POST /login HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n", strlen(body));
+    HttpRequest::SetUserVerifier(CountVerify);
+    for(int m = 0; m < 4; m++) {
+        int port = 9230 + m;
+        WebServer* server = StartServer(port, modes[m].trigMode, 0, modes[m].inlineSmall, false, 1);
+        g_verifyCnt = 0;
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        assert(write(fd, head, strlen(head)) == (ssize_t)strlen(head));
+        usleep(50 * 1000);
+        assert(write(fd, body, strlen(body)) == (ssize_t)strlen(body));
+        std::string buf;
+        assert(ReadResponse(fd, buf) == 200);
+        close(fd);
+        unsigned long long executed = 0;
+        for(int i = 0; i < 100 && executed < 2; i++) {
+            executed = server->GetLaneTelemetry("blocking").executed;
+            usleep(1000);
+        }
+        printf("split form post trigMode %d inline %d: blocking lane executed %llu, verified %d\n",
+                modes[m].trigMode, modes[m].inlineSmall, executed, g_verifyCnt.load());
+        assert(executed == 2 && g_verifyCnt == 1);
+    }
+    HttpRequest::SetUserVerifier(nullptr);
+}
+
+// 短连接请求一次 响应之后应为EOF 返回状态码
+static int GetOnce(int port, const char* path) {
+    int fd = ConnectLoopback(port);
+    if(fd < 0) return -1;
+    std::string req = std::string("GET ") + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    std::string buf;
+    int code = write(fd, req.data(), req.size()) == (ssize_t)req.size() ? ReadResponse(fd, buf) : -1;
+    char c;
+    if(code > 0 && (!buf.empty() || read(fd, &c, 1) != 0)) code = -1;
+    close(fd);
+    return code;
+}
+
+/* 多Reactor: 各Reactor用SO_REUSEPORT监听同一端口 短连接由内核按四元组分散到各Reactor 全部就地处理
+   端口已被未设SO_REUSEPORT的套接字占用时初始化失败 不与占用者分担连接 */
+void TestMultiReactor() {
+    const int REACTORS = 4, SHORT = 64, CONNS = 16, REQS = 500;
+    WebServer* server = StartServer(9240, 3, REACTORS);
+    for(int i = 0; i < SHORT; i++) {
+        assert(GetOnce(9240, "/index.html") == 200);
+    }
+    double qps = BenchKeepAlive(9240, "/index.html", CONNS, REQS);
+    std::vector<unsigned long long> reqs = server->GetReactorRequests();
+    WebServer::Stats stats = server->GetStats();
+    unsigned long long total = 0;
+    int busy = 0;
+    std::string dist;
+    for(unsigned long long n: reqs) {
+        total += n;
+        busy += n > 0;
+        dist += " " + std::to_string(n);
+    }
+    printf("multi-reactor %d: keep-alive %.0f req/s, requests per reactor%s\n", REACTORS, qps, dist.c_str());
+    assert(reqs.size() == REACTORS && total == SHORT + CONNS * REQS && stats.requests == total);
+    assert(busy >= 2 && stats.offloaded == 0);
+
+    int blocker = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(9241);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    assert(bind(blocker, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(blocker, 64) == 0);
+    WebServer* failed = StartServer(9241, 3, REACTORS);
+    std::vector<int> fds;
+    for(int i = 0; i < 16; i++) {
+        fds.push_back(ConnectLoopback(9241));
+        assert(fds.back() >= 0);
+    }
+    usleep(50 * 1000);
+    fcntl(blocker, F_SETFL, O_NONBLOCK);
+    int accepted = 0, fd;
+    while((fd = accept(blocker, nullptr, nullptr)) >= 0) {
+        accepted++;
+        close(fd);
+    }
+    printf("multi-reactor %d on a taken port: blocker accepted %d of 16, server requests %llu\n",
+            REACTORS, accepted, failed->GetStats().requests);
+    assert(accepted == 16 && failed->GetStats().requests == 0);
+    for(int f: fds) close(f);
+    close(blocker);
+}
+
+/* io_uring后端: 多发accept、缓冲区环recv和writev 短连接、keep-alive和流水线都要正确
+   io_uring_setup失败(内核过旧或被禁用)时退回epoll 多Reactor中任一环失败则全部退回 */
+void TestIoUring() {
+    IoUring probe;
+    const char* native = probe.Init(8, 8, 4096) ? "io_uring" : "epoll";
+    struct Mode { int reactorNum, failAfter; const char* backend; };
+    const Mode modes[] = {{1, -1, native}, {2, -1, native}, {1, 0, "epoll"}, {2, 1, "epoll"}};
+    const int SHORT = 32, CONNS = 4, REQS = 800, DEPTH = 8;
+    for(int m = 0; m < 4; m++) {
+        int port = 9242 + m;
+        IoUring::FailInitAfter(modes[m].failAfter);
+        WebServer* server = StartServer(port, 4, modes[m].reactorNum, false, false, 0, true);
+        IoUring::FailInitAfter(-1);
+        for(int i = 0; i < SHORT; i++) {
+            assert(GetOnce(port, "/index.html") == 200);
+        }
+        double qps = BenchKeepAlive(port, "/index.html", CONNS, REQS);
+        double pipe = BenchPipeline(port, "/index.html", CONNS, REQS, DEPTH);
+        WebServer::Stats stats = server->GetStats();
+        printf("io_uring reactors %d init fails after %d: backend %s, keep-alive %.0f req/s, pipeline %.0f req/s\n",
+                modes[m].reactorNum, modes[m].failAfter, server->IoBackend(), qps, pipe);
+        assert(strcmp(server->IoBackend(), modes[m].backend) == 0);
+        assert(stats.requests == SHORT + 2 * CONNS * REQS);
+    }
+}
+
+/* 连接槽: 关闭和重新打开都使代数变化 旧代数的事件和定时器找不到新连接 HttpConn对象复用
+   占有期间的事件置PENDING 由占有者再处理一轮 容量不超过RLIMIT_NOFILE
+   服务器上fd超出容量的连接收到"Server busy!"后关闭 其余连接不受影响 */
+void TestConnSlab() {
+    ConnSlab slab(64);
+    uint32_t gen, reopened;
+    HttpConn* conn = slab.Open(5, &gen);
+    assert(slab.Capacity() == 64 && conn && gen != 0);
+    assert(slab.Get(5, gen) == conn && slab.At(5) == conn && slab.Gen(5) == gen);
+    assert(!slab.Get(5, gen + 1) && !slab.Get(-1, gen) && !slab.Get(64, gen));
+    slab.Release(5);
+    assert(!slab.Get(5, gen));
+    assert(slab.Open(5, &reopened) == conn && reopened != gen && !slab.Get(5, gen) && slab.Get(5, reopened) == conn);
+
+    assert(slab.Acquire(5) && !slab.Acquire(5) && !slab.Acquire(5));
+    slab.SetState(5, ConnSlab::CONN_WRITING);
+    assert(!slab.TryIdle(5) && slab.TryIdle(5) && slab.Acquire(5));
+    slab.Release(5);
+    assert(slab.Open(5, &gen) == conn && slab.Acquire(5));     // 占有中关闭的连接重新打开后为IDLE
+
+    // 以较小的RLIMIT_NOFILE构造服务器 之后恢复 使accept得到超出槽容量的fd
+    struct rlimit lim, low;
+    assert(getrlimit(RLIMIT_NOFILE, &lim) == 0);
+    int maxFd = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    assert(dir);
+    struct dirent* ent;
+    while((ent = readdir(dir))) {
+        maxFd = std::max(maxFd, atoi(ent->d_name));
+    }
+    closedir(dir);
+    low = lim;
+    low.rlim_cur = maxFd + 24;
+    assert(setrlimit(RLIMIT_NOFILE, &low) == 0);
+    assert(ConnSlab(65536).Capacity() == maxFd + 24);
+    StartServer(9246, 3);
+    assert(setrlimit(RLIMIT_NOFILE, &lim) == 0);
+
+    const std::string req = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+    std::vector<int> fds;
+    int served = 0;
+    std::string busy;
+    while(busy.empty() && fds.size() < 64) {
+        int fd = ConnectLoopback(9246);
+        assert(fd >= 0);
+        fds.push_back(fd);
+        std::string buf;
+        if(write(fd, req.data(), req.size()) == (ssize_t)req.size() && ReadResponse(fd, buf) == 200) {
+            served++;
+            continue;
+        }
+        busy = buf;
+    }
+    for(size_t i = 0; i + 1 < fds.size(); i++) {      // 容量内的连接仍可用
+        std::string buf;
+        assert(write(fds[i], req.data(), req.size()) == (ssize_t)req.size() && ReadResponse(fds[i], buf) == 200);
+    }
+    for(int fd: fds) close(fd);
+    usleep(50 * 1000);
+    printf("conn slab capacity %d: %d connections served, next got \"%s\"\n", maxFd + 24, served, busy.c_str());
+    assert(served > 0 && busy == "Server busy!");
+    assert(GetOnce(9246, "/index.html") == 200);
+}
+
+// RFC 7541 附录C.3/C.4的三个连续的请求头部块 分别不用和用Huffman 动态表在块之间共享
+void TestHpack() {
+    const char* blocks[2][3] = {
+        {"828684410f7777772e6578616d706c652e636f6d",
+         "828684be58086e6f2d6361636865",
+         "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565"},
+        {"828684418cf1e3c2e5f23a6ba0ab90f4ff",
+         "828684be5886a8eb10649cbf",
+         "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf"},
+    };
+    const size_t tableSizes[3] = {57, 110, 164};
+    for(int h = 0; h < 2; h++) {
+        HpackDecoder decoder;
+        for(int i = 0; i < 3; i++) {
+            std::string bytes;
+            for(const char* p = blocks[h][i]; *p; p += 2) {
+                bytes.push_back(static_cast<char>(std::stoi(std::string(p, 2), nullptr, 16)));
+            }
+            HpackDecoder::HeaderList headers;
+            assert(decoder.Decode(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(), headers));
+            assert(decoder.TableSize() == tableSizes[i]);
+            assert(headers[0] == std::make_pair(std::string(":method"), std::string("GET")));
+            assert(headers[1].second == (i < 2 ? "http" : "https"));
+            assert(headers[2].second == (i < 2 ? "/" : "/index.html"));
+            assert(headers[3] == std::make_pair(std::string(":authority"), std::string("www.example.com")));
+            if(i == 1) assert(headers[4] == std::make_pair(std::string("cache-control"), std::string("no-cache")));
+            if(i == 2) assert(headers[4] == std::make_pair(std::string("custom-key"), std::string("custom-value")));
+        }
+    }
+
+    // 编码的响应头能被解码 静态表中没有的状态码用字面量
+    Buffer block;
+    HpackEncoder::EncodeStatus(block, 404);
+    HpackEncoder::EncodeStatus(block, 413);
+    HpackEncoder::EncodeField(block, HpackEncoder::IDX_CONTENT_LENGTH, std::to_string(1 << 20));
+    HpackEncoder::EncodeField(block, 0, "x-long", std::string(300, 'v').data(), 300);
+    HpackDecoder decoder;
+    HpackDecoder::HeaderList headers;
+    assert(decoder.Decode(reinterpret_cast<const uint8_t*>(block.Peek()), block.ReadableBytes(), headers));
+    assert(headers.size() == 4 && headers[0].second == "404" && headers[1].second == "413");
+    assert(headers[2].first == "content-length" && headers[2].second == "1048576");
+    assert(headers[3].first == "x-long" && headers[3].second == std::string(300, 'v'));
+
+    // Huffman的填充须是不足8位的全1 索引超出动态表为错误
+    std::string out;
+    const uint8_t padOk[] = {0x07};             // '0'(00000) + 111
+    const uint8_t padBad[] = {0x00};            // '0' + 000
+    const uint8_t padLong[] = {0x07, 0xff};     // 多出一个字节的填充
+    assert(HpackDecoder::HuffmanDecode(padOk, 1, out) && out == "0");
+    assert(!HpackDecoder::HuffmanDecode(padBad, 1, out) && !HpackDecoder::HuffmanDecode(padLong, 2, out));
+    const uint8_t badIndex[] = {0xbe};
+    assert(!HpackDecoder().Decode(badIndex, 1, headers));
+}
+
+/* HTTP/2测试客户端: 按窗口检查收到的每个DATA帧 消费了一半窗口就用WINDOW_UPDATE归还 */
+struct H2Frame {
+    uint8_t type, flags;
+    uint32_t id;
+    std::string payload;
+};
+
+struct H2Result {
+    int status;
+    size_t contentLength;
+    std::string body;
+};
+
+static std::string H2U32(uint32_t v) {
+    const char bytes[4] = {char(v >> 24), char(v >> 16), char(v >> 8), char(v)};
+    return std::string(bytes, 4);
+}
+
+static std::string H2FrameBytes(uint8_t type, uint8_t flags, uint32_t id, const std::string& payload) {
+    uint32_t len = payload.size();
+    const char head[5] = {char(len >> 16), char(len >> 8), char(len), char(type), char(flags)};
+    return std::string(head, 5) + H2U32(id) + payload;
+}
+
+static std::string H2Request(uint32_t id, const char* method, const char* path) {
+    Buffer block;
+    HpackEncoder::EncodeField(block, HpackEncoder::IDX_METHOD_GET, method);
+    HpackEncoder::EncodeInt(block, HpackEncoder::IDX_SCHEME_HTTP, 7, 0x80);
+    HpackEncoder::EncodeField(block, HpackEncoder::IDX_PATH, path);
+    HpackEncoder::EncodeField(block, HpackEncoder::IDX_AUTHORITY, "localhost");
+    return H2FrameBytes(Http2Conn::FRAME_HEADERS, Http2Conn::FLAG_END_STREAM | Http2Conn::FLAG_END_HEADERS,
+                        id, block.RetrieveAllToStr());
+}
+
+struct H2Client {
+    // 客户端序言 流的初始窗口为window 连接窗口也扩大到window
+    H2Client(int fd, uint32_t window): fd(fd), window(window), connWindow(window), connWin(window), connUnacked(0) {
+        std::string settings = std::string("\x00\x04", 2) + H2U32(window);
+        preface = std::string("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n") + H2FrameBytes(Http2Conn::FRAME_SETTINGS, 0, 0, settings);
+        if(window > Http2Conn::DEFAULT_WINDOW) {
+            preface += H2FrameBytes(Http2Conn::FRAME_WINDOW_UPDATE, 0, 0, H2U32(window - Http2Conn::DEFAULT_WINDOW));
+        } else {
+            connWindow = connWin = Http2Conn::DEFAULT_WINDOW;
+        }
+    }
+
+    bool Send(const std::string& data) {
+        return write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    }
+
+    bool Read(H2Frame& f) {
+        while(buf.size() < 9 || buf.size() < 9 + (size_t)((uint8_t)buf[0] << 16 | (uint8_t)buf[1] << 8 | (uint8_t)buf[2])) {
+            char tmp[65536];
+            ssize_t n = read(fd, tmp, sizeof(tmp));
+            if(n <= 0) return false;
+            buf.append(tmp, n);
+        }
+        size_t len = (uint8_t)buf[0] << 16 | (uint8_t)buf[1] << 8 | (uint8_t)buf[2];
+        f.type = buf[3];
+        f.flags = buf[4];
+        f.id = ((uint8_t)buf[5] << 24 | (uint8_t)buf[6] << 16 | (uint8_t)buf[7] << 8 | (uint8_t)buf[8]) & 0x7fffffff;
+        f.payload = buf.substr(9, len);
+        buf.erase(0, 9 + len);
+        return true;
+    }
+
+    // 读到streams中的流全部结束 order记录DATA帧所属流的顺序
+    bool Fetch(std::map<uint32_t, H2Result>& streams, std::vector<uint32_t>* order = nullptr) {
+        std::map<uint32_t, int64_t> win;
+        std::map<uint32_t, uint32_t> unacked;
+        for(auto& it: streams) win[it.first] = window;
+        size_t open = streams.size();
+        H2Frame f;
+        while(open > 0 && Read(f)) {
+            if(f.type == Http2Conn::FRAME_RST_STREAM || f.type == Http2Conn::FRAME_GOAWAY) return false;
+            if(f.type != Http2Conn::FRAME_HEADERS && f.type != Http2Conn::FRAME_DATA) continue;
+            if(!streams.count(f.id)) return false;
+            H2Result& r = streams[f.id];
+            if(f.type == Http2Conn::FRAME_HEADERS) {
+                HpackDecoder::HeaderList headers;
+                if(!decoder.Decode(reinterpret_cast<const uint8_t*>(f.payload.data()), f.payload.size(), headers)) return false;
+                for(auto& h: headers) {
+                    if(h.first == ":status") r.status = atoi(h.second.c_str());
+                    if(h.first == "content-length") r.contentLength = atol(h.second.c_str());
+                }
+            } else {
+                int64_t n = f.payload.size();
+                if(n > win[f.id] || n > connWin) return false;
+                win[f.id] -= n;
+                connWin -= n;
+                r.body += f.payload;
+                if(order) order->push_back(f.id);
+                std::string updates;
+                unacked[f.id] += n;
+                connUnacked += n;
+                if(!(f.flags & Http2Conn::FLAG_END_STREAM) && unacked[f.id] >= window / 2) {
+                    updates += H2FrameBytes(Http2Conn::FRAME_WINDOW_UPDATE, 0, f.id, H2U32(unacked[f.id]));
+                    win[f.id] += unacked[f.id];
+                    unacked[f.id] = 0;
+                }
+                if(connUnacked >= connWindow / 2) {
+                    updates += H2FrameBytes(Http2Conn::FRAME_WINDOW_UPDATE, 0, 0, H2U32(connUnacked));
+                    connWin += connUnacked;
+                    connUnacked = 0;
+                }
+                if(!updates.empty() && !Send(updates)) return false;
+            }
+            if(f.flags & Http2Conn::FLAG_END_STREAM) open--;
+        }
+        return open == 0;
+    }
+
+    int fd;
+    uint32_t window, connWindow;
+    int64_t connWin;
+    uint32_t connUnacked;
+    std::string preface;
+    std::string buf;
+    HpackDecoder decoder;
+};
+
+static std::string ReadWholeFile(const std::string& path) {
+    std::string data;
+    int fd = open(path.c_str(), O_RDONLY);
+    char tmp[65536];
+    ssize_t n;
+    while(fd >= 0 && (n = read(fd, tmp, sizeof(tmp))) > 0) data.append(tmp, n);
+    if(fd >= 0) close(fd);
+    return data;
+}
+
+/* HTTP/2压测: 每条连接同时保持depth个流 返回每秒完成的请求数 */
+double BenchH2(int port, const char* path, int conns, int reqs, int depth) {
+    std::atomic<int> done(0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int c = 0; c < conns; c++) {
+        threads.emplace_back([&] {
+            int fd = ConnectLoopback(port);
+            if(fd < 0) return;
+            H2Client client(fd, 1 << 24);
+            bool ok = client.Send(client.preface);
+            uint32_t id = 1;
+            for(int i = 0; ok && i < reqs; i += depth) {
+                std::string batch;
+                std::map<uint32_t, H2Result> streams;
+                for(int j = 0; j < depth; j++, id += 2) {
+                    batch += H2Request(id, "GET", path);
+                    streams[id] = H2Result();
+                }
+                ok = client.Send(batch) && client.Fetch(streams);
+                if(ok) done += depth;
+            }
+            close(fd);
+        });
+    }
+    for(auto& t: threads) t.join();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return done / sec;
+}
+
+/* 一条连接上同时请求多个文件: 响应与文件一致 DATA帧不超出流和连接的窗口 两个大文件的DATA帧交替发出
+   再检查PING、协议错误时的GOAWAY、Upgrade: h2c 最后与HTTP/1.1流水线对比吞吐 */
+void TestHttp2() {
+    struct Mode { int trigMode, reactorNum; bool ioUring; };
+    const Mode modes[] = {{3, 0, false}, {4, 0, false}, {4, 1, true}};
+    const char* paths[] = {"/css/bootstrap.min.css", "/fonts/FontAwesome.otf", "/index.html", "/nope.html"};
+    const uint32_t WINDOW = 16384;
+    for(int m = 0; m < 3; m++) {
+        int port = 9160 + m;
+        StartServer(port, modes[m].trigMode, modes[m].reactorNum, false, false, 0, modes[m].ioUring);
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        H2Client client(fd, WINDOW);
+        std::string out = client.preface;
+        std::map<uint32_t, H2Result> streams;
+        for(int i = 0; i < 4; i++) {
+            out += H2Request(2 * i + 1, "GET", paths[i]);
+            streams[2 * i + 1] = H2Result();
+        }
+        out += H2Request(9, "HEAD", "/index.html");
+        streams[9] = H2Result();
+        assert(client.Send(out));
+        std::vector<uint32_t> order;
+        assert(client.Fetch(streams, &order));
+        for(int i = 0; i < 3; i++) {
+            std::string file = ReadWholeFile(ResourcePath(paths[i]));
+            H2Result& r = streams[2 * i + 1];
+            assert(r.status == 200 && r.contentLength == file.size() && r.body == file);
+        }
+        assert(streams[7].status == 404 && streams[7].contentLength == streams[7].body.size());
+        assert(streams[9].status == 200 && streams[9].body.empty() && streams[9].contentLength == streams[5].body.size());
+        size_t firstOf3 = std::find(order.begin(), order.end(), 3u) - order.begin();
+        size_t lastOf1 = order.rend() - std::find(order.rbegin(), order.rend(), 1u) - 1;
+        assert(firstOf3 < lastOf1);
+
+        H2Frame f;
+        assert(client.Send(H2FrameBytes(Http2Conn::FRAME_PING, 0, 0, "12345678")));
+        while(client.Read(f) && f.type != Http2Conn::FRAME_PING) {}
+        assert(f.type == Http2Conn::FRAME_PING && f.flags == Http2Conn::FLAG_ACK && f.payload == "12345678");
+
+        // 流0上的DATA是连接错误: 回GOAWAY(PROTOCOL_ERROR)后关闭
+        assert(client.Send(H2FrameBytes(Http2Conn::FRAME_DATA, 0, 0, "x")));
+        while(client.Read(f) && f.type != Http2Conn::FRAME_GOAWAY) {}
+        assert(f.type == Http2Conn::FRAME_GOAWAY && f.payload.substr(4) == H2U32(Http2Conn::ERR_PROTOCOL));
+        assert(!client.Read(f));
+        close(fd);
+
+        // 升级: 客户端序言紧跟在请求之后到达 请求作为流1得到响应 之后照常开新流
+        fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        H2Client upgraded(fd, WINDOW);
+        std::string up = "GET /index.html HTTP/1.1\r\nHost: localhost\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+                         "Upgrade: h2c\r\nHTTP2-Settings: AAQAAEAA\r\n\r\n";
+        assert(upgraded.Send(up + upgraded.preface));
+        size_t headEnd;
+        while((headEnd = upgraded.buf.find("\r\n\r\n")) == std::string::npos) {
+            char tmp[4096];
+            ssize_t n = read(fd, tmp, sizeof(tmp));
+            assert(n > 0);
+            upgraded.buf.append(tmp, n);
+        }
+        assert(upgraded.buf.compare(0, 12, "HTTP/1.1 101") == 0);
+        upgraded.buf.erase(0, headEnd + 4);
+        std::map<uint32_t, H2Result> first = {{1, H2Result()}};
+        assert(upgraded.Fetch(first) && first[1].status == 200 && first[1].body == streams[5].body);
+        std::map<uint32_t, H2Result> next = {{3, H2Result()}};
+        assert(upgraded.Send(H2Request(3, "GET", paths[1])) && upgraded.Fetch(next));
+        assert(next[3].status == 200 && next[3].body == streams[3].body);
+        close(fd);
+
+        double h2 = BenchH2(port, "/index.html", 8, 2000, 16);
+        double h1 = BenchPipeline(port, "/index.html", 8, 2000, 16);
+        printf("h2c trigMode %d reactors %d io_uring %d: 16 streams %.0f req/s, HTTP/1.1 depth 16 %.0f req/s\n",
+                modes[m].trigMode, modes[m].reactorNum, modes[m].ioUring, h2, h1);
+    }
+}
+
+// 记录被调用的路由 不改写路径
+class RecordHandler: public RouteHandler {
+public:
+    explicit RecordHandler(int id): id(id) {}
+    void Handle(HttpRequest&, const RouteMatch&) const override {}
+    int id;
+};
+
+// 基准的对照: 逐条模式按段比较 取第一个匹配的
+static bool LinearMatch(const std::vector<std::string>& patterns, const std::string& path) {
+    for(const std::string& pat: patterns) {
+        size_t i = 0, j = 0;
+        while(i < pat.size()) {
+            if(pat[i] == '*') return true;
+            if(pat[i] == ':') {
+                size_t segEnd = path.find('/', j);
+                if(segEnd == j) break;
+                j = segEnd == std::string::npos ? path.size() : segEnd;
+                i = pat.find('/', i);
+                if(i == std::string::npos) i = pat.size();
+            } else if(j < path.size() && pat[i] == path[j]) {
+                i++, j++;
+            } else {
+                break;
+            }
+        }
+        if(i == pat.size() && j == path.size()) return true;
+    }
+    return false;
+}
+
+void TestRouter() {
+    Router router;
+    const char* patterns[] = {"/", "/user", "/user/:id", "/user/:id/posts", "/user/new", "/static/*",
+                              "/static/img/*", "/files/:dir/*", "/users"};
+    for(int i = 0; i < (int)(sizeof(patterns) / sizeof(patterns[0])); i++) {
+        assert(router.Add(patterns[i], std::make_shared<RecordHandler>(i)));
+    }
+    const char* bad[] = {"", "user", "/a:id", "/:", "/:a:b", "/a*/b", "/*/x"};
+    for(const char* pat: bad) {
+        assert(!router.Add(pat, std::make_shared<RecordHandler>(-1)));
+    }
+    auto matchId = [&](const char* path, RouteMatch& m) {
+        if(!router.Match(StrView(path, strlen(path)), m)) return -1;
+        return static_cast<const RecordHandler&>(m.Handler()).id;
+    };
+    RouteMatch m;
+    assert(matchId("/", m) == 0 && matchId("/user", m) == 1 && matchId("/users", m) == 8);
+    assert(matchId("/user/42", m) == 2 && m.paramCnt == 1 && m.Param(StrView("id", 2)) == "42");
+    assert(m.Param(StrView("x", 1)).empty());
+    assert(matchId("/user/new", m) == 4 && m.paramCnt == 0);           // 静态优先于参数
+    assert(matchId("/user/ne", m) == 2 && m.Param(StrView("id", 2)) == "ne");
+    assert(matchId("/user/7/posts", m) == 3 && m.params[0] == "7");
+    assert(matchId("/user/new/posts", m) == 3 && m.params[0] == "new"); // 静态分支走不通时回到参数
+    assert(matchId("/user/", m) == -1 && matchId("/user/7/x", m) == -1 && matchId("/nothing", m) == -1);
+    assert(matchId("/static/css/a.css", m) == 5 && m.rest == "css/a.css");
+    assert(matchId("/static/img/a.png", m) == 6 && m.rest == "a.png");  // 取最长的前缀
+    assert(matchId("/static/", m) == 5 && m.rest.empty());
+    assert(matchId("/files/docs/a/b.txt", m) == 7 && m.params[0] == "docs" && m.rest == "a/b.txt");
+    assert(router.Add("/user/:uid", std::make_shared<RecordHandler>(100)) && router.RouteCount() == 9);
+    assert(matchId("/user/42", m) == 100 && m.Param(StrView("uid", 3)) == "42");
+
+    // 默认路由: 页面改写、表单页 其余为静态文件
+    struct { const char* req; const char* path; } cases[] = {
+        {"GET / HTTP/1.1\r\n\r\n", "/index.html"},
+        {"GET /picture HTTP/1.1\r\n\r\n", "/picture.html"},
+        {"GET /login HTTP/1.1\r\n\r\n", "/login.html"},
+        {"GET /register.html HTTP/1.1\r\n\r\n", "/register.html"},
+        {"GET /images/a.png?v=3 HTTP/1.1\r\n\r\n", "/images/a.png"},
+        {"GET /index?x=1 HTTP/1.1\r\n\r\n", "/index.html"},
+        {"POST /login HTTP/1.1\r\nContent-Length: 3\r\n\r\na=b", "/login.html"},
+    };
+    for(auto& c: cases) {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(c.req, strlen(c.req));
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.path() == c.path);
+    }
+    // 登录/注册由表单处理者验证用户 不是静态页面
+    for(const char* path: {"/login", "/login.html", "/register", "/register.html"}) {
+        RouteMatch match;
+        assert(HttpRequest::DefaultRouter().Match(StrView(path, strlen(path)), match));
+        assert(dynamic_cast<const UserFormHandler*>(&match.Handler()));
+    }
+    {
+        const char login[] = "POST /login HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                             "Content-Length: 27\r\n\r\nusername=test&password=test";
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(login, strlen(login));
+        HttpRequest::SetUserVerifier(CountVerify);
+        g_verifyCnt = 0;
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.path() == "/welcome.html" && g_verifyCnt == 1);
+        HttpRequest::SetUserVerifier(nullptr);
+    }
+
+    // 基准: 几千条静态、参数、前缀路由混合 与逐条比较的线性表对比
+    const int GROUPS = 1250, N = 1000000;
+    Router big;
+    std::vector<std::string> list;
+    auto handler = std::make_shared<RecordHandler>(0);
+    for(int i = 0; i < GROUPS; i++) {
+        std::string base = "/api/v" + std::to_string(i % 4) + "/res" + std::to_string(i);
+        std::string pats[] = {base, base + "/:id", base + "/:id/detail", "/assets/pkg" + std::to_string(i) + "/*"};
+        for(auto& pat: pats) {
+            assert(big.Add(pat, handler));
+            list.push_back(pat);
+        }
+    }
+    assert(big.RouteCount() == 4 * GROUPS);
+    std::vector<std::string> paths;
+    for(int i = 0; i < 64; i++) {
+        int k = (i * 7919) % GROUPS;
+        std::string base = "/api/v" + std::to_string(k % 4) + "/res" + std::to_string(k);
+        std::string cand[] = {base, base + "/123", base + "/abc/detail", "/assets/pkg" + std::to_string(k) + "/js/app.js"};
+        paths.push_back(cand[i % 4]);
+    }
+    int logLevel = Log::Instance()->GetLevel();
+    Log::Instance()->SetLevel(3);
+    long hits = 0;
+    g_allocCnt = 0;
+    g_countAlloc = true;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        const std::string& path = paths[i & 63];
+        hits += big.Match(StrView(path.data(), path.size()), m);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    g_countAlloc = false;
+    long allocs = g_allocCnt.exchange(0);
+    const int LINEAR_N = N / 1000;
+    long linearHits = 0;
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < LINEAR_N; i++) {
+        linearHits += LinearMatch(list, paths[i & 63]);
+    }
+    double linearSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Log::Instance()->SetLevel(logLevel);
+    printf("router (%zu routes): radix trie %.0f ns/lookup %.1f allocs/lookup, linear scan %.0f ns/lookup\n",
+           big.RouteCount(), sec * 1e9 / N, (double)allocs / N, linearSec * 1e9 / LINEAR_N);
+    assert(hits == N && linearHits == LINEAR_N && allocs == 0);
+}
+
+/* 原来的表单解码 作为基准: 逐字节处理 每个键值substr复制 "%XX"并未真正解码 */
+static void LegacyFormDecode(std::string body, std::unordered_map<std::string, std::string>& post) {
+    auto hex = [](char ch) {
+        if(ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+        if(ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+        if(ch >= '0' && ch <= '9') return ch - '0';
+        return (int)ch;
+    };
+    std::string key, value;
+    int n = body.size(), i = 0, j = 0;
+    for(; i < n; i++) {
+        switch(body[i]) {
+        case '=': key = body.substr(j, i - j); j = i + 1; break;
+        case '+': body[i] = ' '; break;
+        case '%': {
+            int num = hex(body[i + 1]) * 16 + hex(body[i + 2]);
+            body[i + 2] = num % 10 + '0';
+            body[i + 1] = num / 10 + '0';
+            i += 2;
+            break;
+        }
+        case '&': value = body.substr(j, i - j); j = i + 1; post[key] = value; break;
+        default: break;
+        }
+    }
+    if(post.count(key) == 0 && j < i) post[key] = body.substr(j, i - j);
+}
+
+static std::string FormPost(const std::string& body) {
+    return "POST /form HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: "
+           + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+void TestFormDecode() {
+    struct { const char* in; const char* out; } cases[] = {
+        {"a+b%20c", "a b c"}, {"%E4%BD%A0%e5%a5%bd", "\xe4\xbd\xa0\xe5\xa5\xbd"}, {"100%", "100%"},
+        {"%4", "%4"}, {"%zz%41", "%zzA"}, {"%%41", "%A"}, {"%2B+", "+ "}, {"", ""},
+        {"plain-text-without-any-escapes-longer-than-32-bytes", "plain-text-without-any-escapes-longer-than-32-bytes"},
+    };
+    const CharScan::ISA best = CharScan::Isa();
+    for(int isa = CharScan::ISA_SCALAR; isa <= best; isa++) {
+        CharScan::SetIsa((CharScan::ISA)isa);
+        for(auto& c: cases) {
+            std::string buf = c.in;
+            size_t n = HttpRequest::UrlDecode(&buf[0], buf.size(), &buf[0]);      // 就地解码
+            assert(buf.substr(0, n) == c.out);
+        }
+        char out[8];
+        assert(HttpRequest::UrlDecode("a+b", 3, out, false) == 3 && memcmp(out, "a+b", 3) == 0);
+    }
+    CharScan::SetIsa(best);
+
+    Buffer buff;
+    HttpRequest request;
+    buff.Append(FormPost("user%20name=a%26b&&pass=x%3Dy=z&flag&user+name=second&=v"));
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.FormCount() == 5);
+    assert(request.GetForm(StrView("user name", 9)) == "a&b" && request.GetPost("user name") == "a&b");
+    assert(request.GetForm(StrView("pass", 4)) == "x=y=z");
+    assert(request.GetFormField(2).first == "flag" && request.GetFormField(2).second.empty());
+    assert(request.GetFormField(4).first.empty() && request.GetFormField(4).second == "v");
+    assert(request.GetPost("missing").empty());
+    buff.Append(std::string("GET / HTTP/1.1\r\n\r\n"));
+    assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.FormCount() == 0);
+
+    // 基准: 几十KB的表单 键值中夹杂少量转义 与原实现对比
+    int logLevel = Log::Instance()->GetLevel();
+    Log::Instance()->SetLevel(3);
+    std::string body;
+    for(int i = 0; body.size() < 48 * 1024; i++) {
+        if(i) body += '&';
+        body += "field" + std::to_string(i) + "=" + std::string(100 + i % 50, 'v') + "+with%20escapes%2C+ok";
+    }
+    const std::string req = FormPost(body);
+    const int N = 2000;
+    buff.Append(req);
+    request.parse(buff);
+    size_t fields = request.FormCount();
+    assert(request.GetForm(StrView("field7", 6)).ToString() == std::string(107, 'v') + " with escapes, ok");
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        std::unordered_map<std::string, std::string> post;
+        LegacyFormDecode(body, post);
+        assert(post.size() == fields);
+    }
+    double legacySec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("form decode (%zu B, %zu fields): legacy %.0f MB/s,", body.size(), fields, N * body.size() / legacySec / 1e6);
+    const char* names[] = {"scalar", "sse4.2", "avx2"};
+    for(int isa = CharScan::ISA_SCALAR; isa <= best; isa++) {
+        CharScan::SetIsa((CharScan::ISA)isa);
+        std::string decoded(body.size(), 0);
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; i++) {
+            HttpRequest::UrlDecode(body.data(), body.size(), &decoded[0]);
+        }
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // 整个请求经解析器: 解析、复制请求体、按字段解码 预热后不分配内存
+        g_allocCnt = 0;
+        g_countAlloc = true;
+        auto reqStart = std::chrono::steady_clock::now();
+        for(int i = 0; i < N; i++) {
+            buff.Append(req);
+            HttpRequest::HTTP_CODE ret = request.parse(buff);
+            assert(ret == HttpRequest::GET_REQUEST && request.FormCount() == fields);
+            (void)ret;
+        }
+        double reqSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - reqStart).count();
+        g_countAlloc = false;
+        printf(" %s decode %.0f MB/s request %.0f MB/s %.1f allocs/req,", names[isa], N * body.size() / sec / 1e6,
+               N * req.size() / reqSec / 1e6, (double)g_allocCnt / N);
+        assert(g_allocCnt == 0);
+    }
+    printf("\n");
+    CharScan::SetIsa(best);
+    Log::Instance()->SetLevel(logLevel);
+}
+
+// 记录解析出的各部分
+struct PartRecorder: public MultipartParser::Handler {
+    std::vector<MultipartParser::Part> parts;
+    std::vector<std::string> data;
+    int ended = 0;
+    bool OnPartBegin(const MultipartParser::Part& part) override {
+        parts.push_back(part);
+        data.emplace_back();
+        return true;
+    }
+    bool OnPartData(const char* p, size_t len) override {
+        data.back().append(p, len);
+        return true;
+    }
+    bool OnPartEnd() override { ended++; return true; }
+};
+
+static std::string MultipartRequest(const std::string& boundary, const std::string& body, bool expect = false) {
+    return "POST /upload HTTP/1.1\r\nConnection: keep-alive\r\nContent-Type: multipart/form-data; boundary=" + boundary
+           + "\r\nContent-Length: " + std::to_string(body.size()) + (expect ? "\r\nExpect: 100-continue" : "") + "\r\n\r\n";
+}
+
+static std::vector<std::string> ListDir(const std::string& dir) {
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    while(struct dirent* e = d ? readdir(d) : nullptr) {
+        if(strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) names.push_back(e->d_name);
+    }
+    if(d) closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static void RemoveDir(const std::string& dir) {
+    for(auto& name: ListDir(dir)) unlink((dir + name).c_str());
+    rmdir(dir.c_str());
+}
+
+// 请求体消费得很慢的接收者 模拟磁盘跟不上
+struct SlowSink: public HttpRequest::BodySink {
+    static std::atomic<size_t> bytes;
+    bool OnData(const char*, size_t len) override {
+        usleep(20 * 1000);
+        bytes += len;
+        return true;
+    }
+};
+std::atomic<size_t> SlowSink::bytes(0);
+
+static std::unique_ptr<HttpRequest::BodySink> MakeSlowSink(const HttpRequest&) {
+    return std::unique_ptr<HttpRequest::BodySink>(new SlowSink());
+}
+
+static long RssKb() {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while(std::getline(in, line)) {
+        if(line.compare(0, 6, "VmRSS:") == 0) return atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+/* multipart解析在任意切分下结果相同 上传的文件流式写入磁盘 经服务器上传大文件时内存不随文件增长
+   请求体消费不动时停止读套接字 客户端的写被TCP流控挡住 */
+void TestUpload() {
+    std::string b = "xYz-12";
+    std::string bin;
+    for(int i = 0; i < 3000; i++) bin += static_cast<char>(i * 7 + i / 256);
+    std::string trap = "a\r\n--xYz-1\r\n--xYz-\r\n--xY\r\n\r\n--\r";          // 像分隔符的开头
+    std::string body = "preamble\r\n--" + b + "\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\nhello world\r\n--" + b + " \t\r\n"
+        "content-disposition: form-data; name=\"file\"; filename=\"C:\\dir\\my photo.jpg\"\r\n"
+        "Content-Type: image/jpeg\r\n\r\n" + trap + bin + trap + "\r\n--" + b + "\r\n"
+        "Content-Disposition: form-data; name=\"none\"; filename=\"\"\r\n\r\n\r\n--" + b + "--\r\nepilogue";
+    const std::string file = trap + bin + trap;
+    std::vector<size_t> cuts;
+    for(size_t cut = 0; cut <= body.size(); cut++) cuts.push_back(cut);
+    for(size_t cut: cuts) {
+        PartRecorder rec;
+        MultipartParser parser(b, &rec);
+        assert(parser.Feed(body.data(), cut) && parser.Feed(body.data() + cut, body.size() - cut));
+        assert(parser.Finished() && rec.parts.size() == 3 && rec.ended == 3);
+        assert(rec.parts[0].name == "title" && !rec.parts[0].hasFilename && rec.data[0] == "hello world");
+        assert(rec.parts[1].filename == "C:\\dir\\my photo.jpg" && rec.parts[1].contentType == "image/jpeg");
+        assert(rec.data[1] == file && rec.parts[2].hasFilename && rec.parts[2].filename.empty() && rec.data[2].empty());
+    }
+    {
+        PartRecorder rec;
+        MultipartParser parser(b, &rec);
+        for(char ch: body) assert(parser.Feed(&ch, 1));
+        assert(parser.Finished() && rec.data[1] == file);
+    }
+    const std::string bad[] = {
+        "--" + b + "\r\nContent-Type: text/plain\r\n\r\nx\r\n--" + b + "--",       // 没有Content-Disposition
+        "--" + b + "\r\nContent-Disposition: attachment\r\n\r\nx\r\n--" + b + "--",
+        "--" + b + "x\r\n",
+        "--" + b + "\r\n" + std::string(MultipartParser::MAX_PART_HEADER + 10, 'h'),
+    };
+    for(auto& in: bad) {
+        PartRecorder rec;
+        MultipartParser parser(b, &rec);
+        assert(!parser.Feed(in.data(), in.size()));
+    }
+    {
+        PartRecorder rec;
+        MultipartParser parser(b, &rec);
+        assert(parser.Feed(body.data(), body.size() - 20) && !parser.Finished());
+    }
+    std::string boundary;
+    assert(MultipartParser::GetBoundary("multipart/form-data; boundary=abc", boundary) && boundary == "abc");
+    assert(MultipartParser::GetBoundary("Multipart/Form-Data; charset=utf-8; BOUNDARY=\"a b;c\"", boundary) && boundary == "a b;c");
+    assert(!MultipartParser::GetBoundary("text/plain; boundary=abc", boundary));
+    assert(!MultipartParser::GetBoundary("multipart/form-data", boundary));
+    const std::string longBoundary = "multipart/form-data; boundary=" + std::string(71, 'a');
+    assert(!MultipartParser::GetBoundary(StrView(longBoundary.data(), longBoundary.size()), boundary));
+    assert(UploadSink::SafeName("../../etc/passwd") == "passwd" && UploadSink::SafeName(".bashrc") == "_bashrc");
+    assert(UploadSink::SafeName("a<b>?.png") == "a_b__.png" && UploadSink::SafeName("dir/") == "upload");
+
+    // 经HttpRequest: 同名文件不覆盖 没收完的上传不留下文件
+    const std::string dir = "/tmp/webserver-upload-" + std::to_string(getpid()) + "/";
+    RemoveDir(dir);
+    UploadHandler::SetDefaultDir(dir);
+    const std::string req = MultipartRequest(b, body) + body;
+    for(int i = 0; i < 2; i++) {
+        Buffer buff;
+        HttpRequest request;
+        size_t cut = req.find("\r\n\r\n") + 100;
+        buff.Append(req.data(), cut);
+        assert(request.parse(buff) == HttpRequest::NO_REQUEST && request.GetBodySink());
+        buff.Append(req.data() + cut, req.size() - cut);
+        assert(request.parse(buff) == HttpRequest::GET_REQUEST && request.path() == "/upload.html");
+    }
+    assert(ListDir(dir) == std::vector<std::string>({"my_photo-1.jpg", "my_photo.jpg"}));
+    assert(ReadWholeFile(dir + "my_photo.jpg") == file && ReadWholeFile(dir + "my_photo-1.jpg") == file);
+    {
+        Buffer buff;
+        HttpRequest request;
+        buff.Append(req.data(), req.size() - 100);
+        assert(request.parse(buff) == HttpRequest::NO_REQUEST && ListDir(dir).size() == 3);    // 临时文件
+        buff.Append(std::string(100, '-'));
+        assert(request.parse(buff) == HttpRequest::BAD_REQUEST);
+        assert(ListDir(dir).size() == 2);
+    }
+    RemoveDir(dir);
+
+    // 经服务器: Expect: 100-continue 先回100 128MB的文件分256KB写入
+    const size_t FILE_SIZE = 128 << 20, PIECE = 256 << 10;
+    std::string piece(PIECE, 0);
+    for(size_t i = 0; i < PIECE; i++) piece[i] = static_cast<char>(i * 131 + (i >> 9));
+    const std::string head = "--" + b + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"big.bin\"\r\n\r\n";
+    const std::string tail = "\r\n--" + b + "--\r\n";
+    struct Mode { int trigMode, reactorNum; bool ioUring; };
+    const Mode modes[] = {{0, 0, false}, {3, 0, false}, {4, 0, false}, {4, 1, true}};
+    for(int m = 0; m < 4; m++) {
+        int port = 9170 + m;
+        StartServer(port, modes[m].trigMode, modes[m].reactorNum, false, false, 0, modes[m].ioUring);
+        UploadHandler::SetDefaultDir(dir);
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        std::string buf, start = MultipartRequest(b, std::string(head.size() + FILE_SIZE + tail.size(), 0), true);
+        assert(write(fd, start.data(), start.size()) == (ssize_t)start.size());
+        assert(ReadResponse(fd, buf) == 100);
+        long rss0 = RssKb(), rssMax = rss0;
+        auto t0 = std::chrono::steady_clock::now();
+        assert(write(fd, head.data(), head.size()) == (ssize_t)head.size());
+        for(size_t sent = 0; sent < FILE_SIZE; sent += PIECE) {
+            for(size_t off = 0; off < PIECE; ) {
+                ssize_t n = write(fd, piece.data() + off, PIECE - off);
+                assert(n > 0);
+                off += n;
+            }
+            if((sent / PIECE) % 64 == 0) rssMax = std::max(rssMax, RssKb());
+        }
+        assert(write(fd, tail.data(), tail.size()) == (ssize_t)tail.size());
+        assert(ReadResponse(fd, buf) == 200);
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        close(fd);
+        struct stat st;
+        assert(stat((dir + "big.bin").c_str(), &st) == 0 && (size_t)st.st_size == FILE_SIZE);
+        std::string saved = ReadWholeFile(dir + "big.bin");
+        for(size_t off = 0; off < FILE_SIZE; off += PIECE) assert(memcmp(saved.data() + off, piece.data(), PIECE) == 0);
+        saved.clear();
+        saved.shrink_to_fit();
+        RemoveDir(dir);
+        printf("upload trigMode %d reactors %d io_uring %d: %zu MB in %.2f s, %.0f MB/s, rss +%ld KB\n",
+               modes[m].trigMode, modes[m].reactorNum, modes[m].ioUring, FILE_SIZE >> 20, sec, (FILE_SIZE >> 20) / sec,
+               rssMax - rss0);
+        assert(rssMax - rss0 < 32 * 1024);
+    }
+
+    // 接收者每次阻塞20ms: 服务器不再读 客户端非阻塞写很快写不动 能写入的只有套接字缓冲区和读缓冲区上限
+    HttpRequest::SetBodySinkFactory(MakeSlowSink);
+    for(int m = 1; m < 3; m++) {
+        int port = 9170 + m;
+        int fd = ConnectLoopback(port);
+        std::string start = "POST /slow HTTP/1.1\r\nContent-Length: 1073741824\r\n\r\n";
+        assert(write(fd, start.data(), start.size()) == (ssize_t)start.size());
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        size_t written = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        while(std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(500)) {
+            ssize_t n = write(fd, piece.data(), PIECE);
+            if(n > 0) written += n;
+            else usleep(1000);
+        }
+        size_t consumed = SlowSink::bytes.exchange(0);
+        printf("slow sink trigMode %d: client wrote %zu KB in 500 ms, server consumed %zu KB\n",
+               modes[m].trigMode, written >> 10, consumed >> 10);
+        assert(written < (48 << 20) && consumed < written);
+        close(fd);
+        // 服务器还在消化已读入的数据 等它停下 不计入下一轮
+        size_t last;
+        do {
+            last = SlowSink::bytes.load();
+            usleep(50 * 1000);
+        } while(SlowSink::bytes.load() != last);
+        SlowSink::bytes = 0;
+    }
+    HttpRequest::SetBodySinkFactory(nullptr);
+}
+
+// 响应头中字段的值 没有时为空
+static std::string HeaderValue(const std::string& head, const std::string& name) {
+    size_t pos = head.find("\r\n" + name + ": ");
+    if(pos == std::string::npos) return std::string();
+    pos += name.size() + 4;
+    return head.substr(pos, head.find("\r\n", pos) - pos);
+}
+
+/* 随机范围: 单个范围206只传那一段 多个范围为multipart/byteranges 各段与文件一致 重叠的合并
+   不可满足416 语法不对或If-Range不匹配时返回整个文件 多个范围请求流水线发送 */
+void TestRange() {
+    const size_t FILE_SIZE = 8 << 20;
+    const std::string name = "/range-test-" + std::to_string(getpid()) + ".mp4";
+    std::mt19937 rng(20);
+    std::string file(FILE_SIZE, 0);
+    for(size_t i = 0; i < FILE_SIZE; i++) file[i] = static_cast<char>(rng());
+    struct Mode { int trigMode, reactorNum; bool ioUring; };
+    const Mode modes[] = {{0, 0, false}, {3, 0, false}, {4, 0, false}, {4, 1, true}};
+    for(int m = 0; m < 4; m++) {
+        int port = 9180 + m;
+        StartServer(port, modes[m].trigMode, modes[m].reactorNum, false, false, 0, modes[m].ioUring);
+        if(m == 0) {
+            std::ofstream(ResourcePath(name), std::ios::binary) << file;
+        }
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        auto get = [&](const std::string& extra, std::string& head, std::string& body) {
+            std::string req = "GET " + name + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n" + extra + "\r\n";
+            assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+            std::string buf;
+            int code = ReadResponse(fd, buf, &head, &body);
+            assert(buf.empty());
+            return code;
+        };
+        std::string head, body;
+        assert(get("", head, body) == 200 && body == file);
+        assert(HeaderValue(head, "Accept-Ranges") == "bytes" && HeaderValue(head, "Content-type") == "video/mp4");
+
+        // 单个范围 传输的只有响应头和那一段
+        size_t transferred = 0, requested = 0;
+        for(int i = 0; i < 200; i++) {
+            size_t a = rng() % FILE_SIZE, b = rng() % FILE_SIZE;
+            if(a > b) std::swap(a, b);
+            if(i % 10 == 0) b = a + rng() % 64;
+            b = std::min(b, FILE_SIZE - 1);
+            assert(get("Range: bytes=" + std::to_string(a) + "-" + std::to_string(b) + "\r\n", head, body) == 206);
+            assert(HeaderValue(head, "Content-Range") == "bytes " + std::to_string(a) + "-" + std::to_string(b) + "/" + std::to_string(FILE_SIZE));
+            assert(body.size() == b - a + 1 && memcmp(body.data(), file.data() + a, body.size()) == 0);
+            transferred += head.size() + body.size();
+            requested += b - a + 1;
+        }
+        assert(transferred < requested + 200 * 512);
+        assert(get("Range: bytes=-1000\r\n", head, body) == 206 && body == file.substr(FILE_SIZE - 1000));
+        assert(get("Range: bytes=8388000-\r\n", head, body) == 206 && body == file.substr(8388000));
+        assert(get("Range: bytes=100-99999999999999999999999\r\n", head, body) == 206 && body == file.substr(100));
+        assert(get("Range: bytes=-99999999\r\n", head, body) == 206 && body == file);
+
+        // 多个范围
+        for(int i = 0; i < 50; i++) {
+            int cnt = 2 + rng() % 5;
+            std::string spec = "bytes=";
+            std::vector<std::pair<size_t, size_t>> want;
+            for(int j = 0; j < cnt; j++) {
+                size_t a = rng() % FILE_SIZE, len = 1 + rng() % 200000;
+                size_t b = std::min(a + len - 1, FILE_SIZE - 1);
+                spec += (j ? ", " : "") + std::to_string(a) + "-" + std::to_string(b);
+                want.emplace_back(a, b);
+            }
+            std::sort(want.begin(), want.end());
+            std::vector<std::pair<size_t, size_t>> merged;
+            for(auto& r: want) {
+                if(!merged.empty() && r.first <= merged.back().second + 1) merged.back().second = std::max(merged.back().second, r.second);
+                else merged.push_back(r);
+            }
+            int code = get("Range: " + spec + "\r\n", head, body);
+            if(merged.size() == 1) {
+                assert(code == 206 && body == file.substr(merged[0].first, merged[0].second - merged[0].first + 1));
+                continue;
+            }
+            std::string type = HeaderValue(head, "Content-type");
+            assert(code == 206 && type.find("multipart/byteranges; boundary=") == 0);
+            std::string delim = "\r\n--" + type.substr(type.find('=') + 1);
+            size_t pos = 0;
+            for(auto& r: merged) {
+                assert(body.compare(pos, delim.size(), delim) == 0);
+                size_t partHead = body.find("\r\n\r\n", pos + delim.size());
+                std::string h = body.substr(pos + delim.size(), partHead + 4 - pos - delim.size());
+                assert(HeaderValue(h, "Content-Type") == "video/mp4");
+                assert(HeaderValue(h, "Content-Range") == "bytes " + std::to_string(r.first) + "-" + std::to_string(r.second) + "/" + std::to_string(FILE_SIZE));
+                size_t len = r.second - r.first + 1;
+                assert(body.compare(partHead + 4, len, file, r.first, len) == 0);
+                pos = partHead + 4 + len;
+            }
+            assert(body.substr(pos) == delim + "--\r\n");
+        }
+
+        // 不可满足 语法不对 If-Range
+        assert(get("Range: bytes=" + std::to_string(FILE_SIZE) + "-\r\n", head, body) == 416);
+        assert(HeaderValue(head, "Content-Range") == "bytes */" + std::to_string(FILE_SIZE));
+        assert(HeaderValue(head, "Content-type").empty() && HeaderValue(head, "Content-length") == "0" && body.empty());
+        assert(get("Range: bytes=10-5\r\n", head, body) == 200 && body.size() == FILE_SIZE);
+        assert(get("Range: items=0-5\r\n", head, body) == 200 && body.size() == FILE_SIZE);
+        struct stat st;
+        assert(stat(ResourcePath(name).c_str(), &st) == 0);
+        char date[64], old[64];
+        time_t older = st.st_mtime - 10;
+        strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&st.st_mtime));
+        strftime(old, sizeof(old), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&older));
+        assert(get("Range: bytes=0-9\r\nIf-Range: " + std::string(date) + "\r\n", head, body) == 206 && body.size() == 10);
+        assert(get("Range: bytes=0-9\r\nIf-Range: " + std::string(old) + "\r\n", head, body) == 200 && body.size() == FILE_SIZE);
+        assert(get("Range: bytes=0-9\r\nIf-Range: \"abc\"\r\n", head, body) == 200 && body.size() == FILE_SIZE);
+
+        // 流水线: 多个范围的响应占用多项iov 一批处理不下时留到下一批
+        std::string batch;
+        std::string many = "Range: bytes=";
+        for(int j = 0; j < HttpResponse::MAX_RANGES; j++) many += (j ? "," : "") + std::to_string(j * 1000) + "-" + std::to_string(j * 1000 + 9);
+        const int N = 2 * HttpConn::MAX_PIPELINE;
+        for(int i = 0; i < N; i++) {
+            batch += "GET " + name + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                     + (i % 2 ? many : "Range: bytes=" + std::to_string(i) + "-" + std::to_string(i + 99)) + "\r\n\r\n";
+        }
+        assert(write(fd, batch.data(), batch.size()) == (ssize_t)batch.size());
+        std::string buf;
+        for(int i = 0; i < N; i++) {
+            assert(ReadResponse(fd, buf, &head, &body) == 206);
+            if(i % 2 == 0) assert(body == file.substr(i, 100));
+            else assert(HeaderValue(head, "Content-type").find("multipart/byteranges") == 0 && body.find(file.substr(15000, 10)) != std::string::npos);
+        }
+        close(fd);
+        printf("range trigMode %d reactors %d io_uring %d: 200 single ranges, %zu KB requested, %zu KB transferred (whole file %zu KB)\n",
+               modes[m].trigMode, modes[m].reactorNum, modes[m].ioUring, requested >> 10, transferred >> 10, (200 * FILE_SIZE) >> 10);
+    }
+    unlink(ResourcePath(name).c_str());
+}
+
+static void WriteFile(const std::string& path, const std::string& data) {
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+}
+
+/* 文件缓存: 命中返回同一条目 不存在/目录/不可读 空文件 修改后重新加载 按字节数LRU淘汰 被淘汰的条目在放下前仍可用
+   多线程在容量很小(不断淘汰)时并发读取 最后经服务器对比有无缓存的吞吐 */
+void TestFileCache() {
+    FileCache* cache = FileCache::Instance();
+    const std::string dir = "/tmp/webserver-cache-" + std::to_string(getpid()) + "/";
+    mkdir(dir.c_str(), 0755);
+    std::string small(1000, 'a'), big(40000, 'b');
+    WriteFile(dir + "a.txt", small);
+    WriteFile(dir + "b.html", big);
+    WriteFile(dir + "empty.txt", "");
+    WriteFile(dir + "secret.txt", "x");
+    chmod((dir + "secret.txt").c_str(), 0600);
+    cache->Clear();
+    FileCache::Stats s0 = cache->GetStats();
+    FileCache::FilePtr a, a2, b, f;
+    assert(cache->Get(dir + "a.txt", a) == 200 && cache->Get(dir + "a.txt", a2) == 200 && a == a2);
+    assert(!a->mapped && a->size == small.size() && memcmp(a->data, small.data(), a->size) == 0);
+    assert(a->contentType == "text/plain" && a->contentLength == "1000");
+    assert(cache->Get(dir + "b.html", b) == 200 && b->mapped && b->contentType == "text/html");
+    assert(std::string(b->data, b->size) == big);
+    assert(cache->Get(dir + "empty.txt", f) == 200 && f->size == 0 && f->contentLength == "0");
+    assert(cache->Get(dir + "nope.txt", f) == 404 && !f);
+    assert(cache->Get(dir, f) == 404);
+    assert(cache->Get(dir + "secret.txt", f) == 403);
+    FileCache::Stats s1 = cache->GetStats();
+    assert(s1.hits - s0.hits == 1 && s1.misses - s0.misses == 3 && s1.files == 3 && s1.bytes == 41000);
+
+    // 修改后 过了确认间隔才重新加载 旧条目在放下前不变
+    WriteFile(dir + "a.txt", std::string(2000, 'c'));
+    assert(cache->Get(dir + "a.txt", f) == 200 && f == a);
+    usleep((FileCache::REVALIDATE_MS + 100) * 1000);
+    assert(cache->Get(dir + "a.txt", f) == 200 && f != a && f->size == 2000 && f->data[0] == 'c');
+    assert(cache->Get(dir + "b.html", f) == 200 && f == b);       // 没变 确认后继续使用
+    assert(std::string(a->data, a->size) == small);
+
+    // LRU: 容量100000 单个文件上限25000
+    cache->Clear();
+    cache->SetCapacity(100000);
+    std::vector<FileCache::FilePtr> held(6);
+    for(int i = 0; i < 6; i++) WriteFile(dir + "f" + std::to_string(i), std::string(20000, '0' + i));
+    for(int i = 0; i < 4; i++) assert(cache->Get(dir + "f" + std::to_string(i), held[i]) == 200);
+    assert(cache->Get(dir + "f0", f) == 200 && f == held[0]);
+    assert(cache->Get(dir + "f4", held[4]) == 200 && cache->GetStats().bytes == 100000);
+    unsigned long long evicted = cache->GetStats().evictions;
+    assert(cache->Get(dir + "f5", held[5]) == 200);
+    FileCache::Stats s2 = cache->GetStats();
+    assert(s2.evictions == evicted + 1 && s2.files == 5 && s2.bytes == 100000);
+    assert(cache->Get(dir + "f0", f) == 200 && f == held[0]);
+    assert(cache->Get(dir + "f1", f) == 200 && f != held[1]);        // f1最久未用 已被淘汰
+    assert(held[1]->data[0] == '1' && held[1]->data[19999] == '1');
+    WriteFile(dir + "large", std::string(30000, 'L'));
+    FileCache::FilePtr l1, l2;
+    assert(cache->Get(dir + "large", l1) == 200 && cache->Get(dir + "large", l2) == 200 && l1 != l2);
+
+    // 并发: 20个文件 大小不一 容量只够放下一部分
+    const int FILES = 20, THREADS = 8, ROUNDS = 20000;
+    for(int i = 0; i < FILES; i++) WriteFile(dir + "m" + std::to_string(i), std::string(1000 * (i + 1), 'A' + i));
+    std::vector<std::thread> threads;
+    std::atomic<int> bad(0);
+    for(int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            FileCache::FilePtr file;
+            for(int i = 0; i < ROUNDS; i++) {
+                int k = rng() % FILES;
+                if(cache->Get(dir + "m" + std::to_string(k), file) != 200 || file->size != 1000u * (k + 1)
+                   || file->data[0] != 'A' + k || file->data[file->size - 1] != 'A' + k) bad++;
+            }
+        });
+    }
+    for(auto& th: threads) th.join();
+    FileCache::Stats s3 = cache->GetStats();
+    printf("file cache concurrent: %d gets, hit ratio %.2f, %llu evictions, %zu files %zu bytes resident\n",
+           THREADS * ROUNDS, s3.HitRatio(), s3.evictions - s2.evictions, s3.files, s3.bytes);
+    assert(bad == 0 && s3.bytes <= 100000 && s3.evictions > s2.evictions);
+
+    // 经服务器 有缓存与每次stat/open/读或映射对比
+    cache->SetCapacity(FileCache::DEFAULT_CAPACITY);
+    cache->Clear();
+    StartServer(9190, 3);
+    const char* paths[] = {"/index.html", "/css/bootstrap.min.css"};
+    for(const char* path: paths) {
+        cache->SetCapacity(0);
+        double off = BenchKeepAlive(9190, path, 8, 3000);
+        cache->SetCapacity(FileCache::DEFAULT_CAPACITY);
+        FileCache::Stats before = cache->GetStats();
+        double on = BenchKeepAlive(9190, path, 8, 3000);
+        FileCache::Stats after = cache->GetStats();
+        double ratio = (double)(after.hits - before.hits) / (after.hits - before.hits + after.misses - before.misses);
+        printf("file cache %s: without %.0f req/s, with %.0f req/s, hit ratio %.4f, %zu KB resident\n",
+               path, off, on, ratio, after.bytes >> 10);
+        assert(ratio > 0.99);
+    }
+    cache->Clear();
+    RemoveDir(dir);
+}
+
+/* 下载大文件: 读到响应头后只计数丢弃 返回读到的字节数 失败返回-1 */
+static long long DrainResponse(int fd, char* tmp, size_t cap) {
+    std::string head;
+    size_t headEnd;
+    long long got = 0;
+    while((headEnd = head.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = read(fd, tmp, 4096);
+        if(n <= 0) return -1;
+        head.append(tmp, n);
+    }
+    size_t lenPos = head.find("Content-length: ");
+    long long total = headEnd + 4 + (lenPos < headEnd ? atoll(head.c_str() + lenPos + 16) : 0);
+    got = head.size();
+    while(got < total) {
+        ssize_t n = read(fd, tmp, std::min<long long>(cap, total - got));
+        if(n <= 0) return -1;
+        got += n;
+    }
+    return got;
+}
+
+static double CpuSec(int who = RUSAGE_SELF) {
+    struct rusage ru;
+    getrusage(who, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/* sendfile: 缓存中保持打开的大文件整体和范围都经sendfile发送 接收很慢时多次EAGAIN后续传
+   io_uring仍用writev 最后对比sendfile与mmap+writev下载大文件的吞吐和每GB的CPU时间 */
+void TestSendfile() {
+    const size_t FILE_SIZE = 32 << 20;
+    const std::string name = "/sendfile-test-" + std::to_string(getpid()) + ".bin";
+    std::mt19937 rng(22);
+    std::string file(FILE_SIZE, 0);
+    for(size_t i = 0; i < FILE_SIZE; i++) file[i] = static_cast<char>(rng());
+    struct Mode { int trigMode, reactorNum; bool ioUring; };
+    const Mode modes[] = {{0, 0, false}, {3, 0, false}, {4, 0, false}, {4, 1, true}};
+    for(int m = 0; m < 4; m++) {
+        int port = 9200 + m;
+        StartServer(port, modes[m].trigMode, modes[m].reactorNum, false, false, 0, modes[m].ioUring);
+        if(m == 0) {
+            std::ofstream(ResourcePath(name), std::ios::binary) << file;
+            FileCache::FilePtr f;
+            assert(FileCache::Instance()->Get(ResourcePath(name), f) == 200 && f->fd >= 0);
+        }
+        int fd = ConnectLoopback(port);
+        assert(fd >= 0);
+        std::string head, body, buf;
+        auto get = [&](const std::string& extra) {
+            std::string req = "GET " + name + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n" + extra + "\r\n";
+            assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+            int code = ReadResponse(fd, buf, &head, &body);
+            assert(buf.empty());
+            return code;
+        };
+        assert(get("") == 200 && body == file);
+        assert(get("Range: bytes=1000-1999999\r\n") == 206 && body == file.substr(1000, 1999000));
+        assert(get("Range: bytes=0-9,5000000-5000099,-50\r\n") == 206);
+        assert(body.find(file.substr(0, 10)) != std::string::npos && body.find(file.substr(5000000, 100)) != std::string::npos
+               && body.find(file.substr(FILE_SIZE - 50)) != std::string::npos);
+
+        // 流水线: 一批中的多个sendfile项和文本项交替
+        std::string batch;
+        for(int i = 0; i < 6; i++) {
+            batch += "GET " + std::string(i % 2 ? "/index.html" : name.c_str()) + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n"
+                     + (i % 2 ? "" : "Range: bytes=" + std::to_string(i * 100000) + "-" + std::to_string(i * 100000 + 99999) + "\r\n") + "\r\n";
+        }
+        assert(write(fd, batch.data(), batch.size()) == (ssize_t)batch.size());
+        for(int i = 0; i < 6; i++) {
+            int code = ReadResponse(fd, buf, &head, &body);
+            if(i % 2 == 0) assert(code == 206 && body == file.substr(i * 100000, 100000));
+            else assert(code == 200 && body.find("</html>") != std::string::npos);
+        }
+        close(fd);
+
+        // 接收缓冲区很小 读得慢 服务器反复遇到EAGAIN 从记下的偏移续传
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int rcv = 4096;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcv, sizeof(rcv));
+        struct sockaddr_in addr = {0};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        std::string req = "GET " + name + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nRange: bytes=123-3000122\r\n\r\n";
+        assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+        std::string slow;
+        char tmp[8192];
+        int reads = 0;
+        while(slow.find("\r\n\r\n") == std::string::npos || slow.size() < slow.find("\r\n\r\n") + 4 + 3000000) {
+            ssize_t n = read(fd, tmp, sizeof(tmp));
+            assert(n > 0);
+            slow.append(tmp, n);
+            if(++reads % 16 == 0) usleep(1000);
+        }
+        assert(slow.compare(slow.find("\r\n\r\n") + 4, std::string::npos, file, 123, 3000000) == 0);
+        close(fd);
+        printf("sendfile trigMode %d reactors %d io_uring %d: whole file, ranges, pipelined and slow reader (%d reads) ok\n",
+               modes[m].trigMode, modes[m].reactorNum, modes[m].ioUring, reads);
+    }
+
+    // 吞吐和CPU: 4条连接各下载N次 服务器的CPU为整个进程减去客户端线程 两种方式交替测几轮
+    const int CONNS = 4, N = 16;
+    for(int round = 0; round < 6; round++) {
+        int useSendfile = round % 2;
+        HttpConn::sendfileMin = useSendfile ? FileCache::SENDFILE_MIN : SIZE_MAX;
+        std::atomic<long long> bytes(0);
+        std::atomic<long long> clientUs(0);
+        double cpu0 = CpuSec();
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int c = 0; c < CONNS; c++) {
+            threads.emplace_back([&] {
+                int fd = ConnectLoopback(9201);
+                std::vector<char> tmp(256 << 10);
+                std::string req = "GET " + name + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+                for(int i = 0; i < N; i++) {
+                    assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+                    long long got = DrainResponse(fd, tmp.data(), tmp.size());
+                    assert(got > (long long)FILE_SIZE);
+                    bytes += got;
+                }
+                close(fd);
+                clientUs += (long long)(CpuSec(RUSAGE_THREAD) * 1e6);
+            });
+        }
+        for(auto& t: threads) t.join();
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double gb = bytes / double(1 << 30);
+        printf("sendfile %s: %.2f GB in %.2f s, %.0f MB/s, server %.3f CPU s per GB\n",
+               useSendfile ? "on " : "off", gb, sec, bytes / sec / (1 << 20), (CpuSec() - cpu0 - clientUs / 1e6) / gb);
+    }
+    HttpConn::sendfileMin = FileCache::SENDFILE_MIN;
+    unlink(ResourcePath(name).c_str());
+}
+
+static std::string Gunzip(const std::string& data) {
+    z_stream zs = {};
+    assert(inflateInit2(&zs, 15 + 16) == Z_OK);
+    std::string out;
+    char tmp[65536];
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = data.size();
+    int ret;
+    do {
+        zs.next_out = reinterpret_cast<Bytef*>(tmp);
+        zs.avail_out = sizeof(tmp);
+        ret = inflate(&zs, Z_NO_FLUSH);
+        out.append(tmp, sizeof(tmp) - zs.avail_out);
+    } while(ret == Z_OK);
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END ? out : "";
+}
+
+/* 压缩: Accept-Encoding的解析 磁盘上的.br .gz优先 没有时第一次请求发送原文件并在后台压缩 之后发送gzip
+   范围请求和不可压缩的类型不压缩 原文件修改后作废 最后统计几个静态文件压缩前后的字节数 */
+void TestCompress() {
+    using CC = CompressCache;
+    assert(CC::Accepted("gzip, deflate, br") == (CC::GZIP | CC::BR));
+    assert(CC::Accepted("gzip;q=0.8, br;q=0") == CC::GZIP);
+    assert(CC::Accepted("br;q=0.000") == 0 && CC::Accepted("identity") == 0 && CC::Accepted("") == 0);
+    assert(CC::Accepted("*") == (CC::GZIP | CC::BR) && CC::Accepted("*, gzip;q=0") == CC::BR);
+    assert(CC::Accepted("GZIP ; q=1") == CC::GZIP && CC::Accepted("x-gzip,*;q=0") == CC::GZIP);
+    assert(CC::Compressible("text/css") && CC::Compressible("application/xhtml+xml") && !CC::Compressible("image/png"));
+
+    const std::string dir = "/compress-test-" + std::to_string(getpid());
+    const std::string root = ResourcePath(dir);
+    StartServer(9210, 3);
+    mkdir(root.c_str(), 0755);
+    std::string page;
+    for(int i = 0; i < 2000; i++) page += "<p>line " + std::to_string(i % 37) + " of a very compressible page</p>\n";
+    WriteFile(root + "/page.html", page);
+    WriteFile(root + "/pre.css", std::string(5000, 'c'));
+    WriteFile(root + "/pre.css.gz", "precompressed gzip");
+    WriteFile(root + "/pre.css.br", "precompressed brotli");
+    WriteFile(root + "/pic.png", std::string(5000, 'p'));
+    std::string noise(5000, 0);
+    std::mt19937 rng(23);
+    for(char& ch: noise) ch = static_cast<char>(rng());
+    WriteFile(root + "/noise.txt", noise);
+
+    int fd = ConnectLoopback(9210);
+    assert(fd >= 0);
+    std::string head, body, buf;
+    auto get = [&](const std::string& path, const std::string& extra) {
+        std::string req = "GET " + dir + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n" + extra + "\r\n";
+        assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+        int code = ReadResponse(fd, buf, &head, &body);
+        assert(buf.empty());
+        return code;
+    };
+    // 等后台压缩完成
+    auto waitGzip = [&](const std::string& path) {
+        for(int i = 0; i < 200; i++) {
+            assert(get(path, "Accept-Encoding: gzip, deflate\r\n") == 200);
+            if(HeaderValue(head, "Content-Encoding") == "gzip") return;
+            usleep(10 * 1000);
+        }
+        assert(false);
+    };
+
+    assert(get("/page.html", "Accept-Encoding: gzip, deflate\r\n") == 200 && body == page);
+    assert(HeaderValue(head, "Content-Encoding").empty() && HeaderValue(head, "Vary") == "Accept-Encoding");
+    waitGzip("/page.html");
+    assert(Gunzip(body) == page && body.size() < page.size() / 10);
+    assert(HeaderValue(head, "Content-type") == "text/html" && HeaderValue(head, "Accept-Ranges").empty());
+    assert(get("/page.html", "") == 200 && body == page && HeaderValue(head, "Vary") == "Accept-Encoding");
+    assert(get("/page.html", "Accept-Encoding: gzip;q=0, br\r\n") == 200 && body == page);
+    assert(get("/page.html", "Accept-Encoding: gzip\r\nRange: bytes=0-9\r\n") == 206 && body == page.substr(0, 10));
+    assert(HeaderValue(head, "Content-Encoding").empty() && HeaderValue(head, "Vary") == "Accept-Encoding");
+
+    // 预压缩的文件
+    assert(get("/pre.css", "Accept-Encoding: gzip, br\r\n") == 200 && body == "precompressed brotli");
+    assert(HeaderValue(head, "Content-Encoding") == "br" && HeaderValue(head, "Content-type") == "text/css");
+    assert(get("/pre.css", "Accept-Encoding: gzip\r\n") == 200 && body == "precompressed gzip");
+    assert(HeaderValue(head, "Content-Encoding") == "gzip" && HeaderValue(head, "Content-type") == "text/css");
+    assert(get("/pre.css", "") == 200 && body == std::string(5000, 'c'));
+
+    // 不可压缩的类型 压缩后省不了多少的文件
+    assert(get("/pic.png", "Accept-Encoding: gzip\r\n") == 200 && body.size() == 5000);
+    assert(HeaderValue(head, "Content-Encoding").empty() && HeaderValue(head, "Vary").empty());
+    CC::Stats s0 = CC::Instance()->GetStats();
+    for(int i = 0; i < 20 && CC::Instance()->GetStats().skipped == s0.skipped; i++) {
+        assert(get("/noise.txt", "Accept-Encoding: gzip\r\n") == 200 && body == noise);
+        usleep(10 * 1000);
+    }
+    assert(CC::Instance()->GetStats().skipped == s0.skipped + 1);
+    assert(get("/noise.txt", "Accept-Encoding: gzip\r\n") == 200 && body == noise && HeaderValue(head, "Content-Encoding").empty());
+
+    // 原文件修改后 文件缓存重新加载时压缩结果作废
+    std::string page2 = page + "<p>changed</p>\n";
+    WriteFile(root + "/page.html", page2);
+    usleep((FileCache::REVALIDATE_MS + 100) * 1000);
+    waitGzip("/page.html");
+    assert(Gunzip(body) == page2);
+
+    // 节省的字节数
+    const char* assets[] = {"/css/bootstrap.min.css", "/css/font-awesome.min.css", "/js/jquery.js", "/js/bootstrap.min.js", "/index.html"};
+    size_t plain = 0, gzip = 0;
+    for(const char* asset: assets) {
+        std::string req = std::string("GET ") + asset + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n";
+        assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+        assert(ReadResponse(fd, buf, &head, &body) == 200);
+        plain += head.size() + body.size();
+        std::string path = asset;
+        for(int i = 0; i < 200; i++) {
+            req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\nAccept-Encoding: gzip, br\r\n\r\n";
+            assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+            assert(ReadResponse(fd, buf, &head, &body) == 200);
+            if(!HeaderValue(head, "Content-Encoding").empty()) break;
+            usleep(10 * 1000);
+        }
+        assert(HeaderValue(head, "Content-Encoding") == "gzip");
+        gzip += head.size() + body.size();
+    }
+    CC::Stats s = CC::Instance()->GetStats();
+    printf("compress: static assets %zu KB -> %zu KB with gzip (%.1f%%), cache %zu entries %zu KB, %llu compressed %llu skipped\n",
+           plain >> 10, gzip >> 10, 100.0 * gzip / plain, s.entries, s.bytes >> 10, s.compressed, s.skipped);
+    close(fd);
+    RemoveDir(root + "/");
+}
+
+/* 条件请求: ETag、Last-Modified和按前缀的Cache-Control If-None-Match(含弱比较、列表、*)优先于If-Modified-Since
+   304没有响应体 压缩版本有自己的标签 If-Range按标签强比较 文件修改后旧标签失效 最后对比首次访问与再次访问的字节数 */
+void TestConditional() {
+    const std::string dir = "/cond-test-" + std::to_string(getpid());
+    const std::string root = ResourcePath(dir);
+    StartServer(9220, 3);
+    mkdir(root.c_str(), 0755);
+    std::string text;
+    for(int i = 0; i < 500; i++) text += "conditional get line " + std::to_string(i % 13) + "\n";
+    WriteFile(root + "/a.txt", text);
+
+    int fd = ConnectLoopback(9220);
+    assert(fd >= 0);
+    std::string head, body, buf;
+    auto get = [&](const std::string& path, const std::string& extra) {
+        std::string req = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n" + extra + "\r\n";
+        assert(write(fd, req.data(), req.size()) == (ssize_t)req.size());
+        int code = ReadResponse(fd, buf, &head, &body);
+        assert(buf.empty());
+        return code;
+    };
+
+    assert(get("/css/bootstrap.min.css", "") == 200 && HeaderValue(head, "Cache-Control") == "public, max-age=86400");
+    assert(get("/index.html", "") == 200 && HeaderValue(head, "Cache-Control") == "no-cache");
+    const std::string path = dir + "/a.txt";
+    assert(get(path, "") == 200 && body == text);
+    std::string etag = HeaderValue(head, "ETag"), lastModified = HeaderValue(head, "Last-Modified");
+    assert(etag.size() > 2 && etag.front() == '"' && etag.back() == '"' && !lastModified.empty());
+
+    assert(get(path, "If-None-Match: " + etag + "\r\n") == 304 && body.empty());
+    assert(HeaderValue(head, "ETag") == etag && HeaderValue(head, "Content-type").empty() && HeaderValue(head, "Content-length").empty());
+    assert(get(path, "If-None-Match: W/" + etag + "\r\n") == 304);
+    assert(get(path, "If-None-Match: \"x\", " + etag + "\r\n") == 304);
+    assert(get(path, "If-None-Match: *\r\n") == 304);
+    assert(get(path, "If-None-Match: \"x\"\r\n") == 200 && body == text);
+    assert(get(path, "If-None-Match: \"x\"\r\nIf-Modified-Since: " + lastModified + "\r\n") == 200);
+    assert(get(path, "If-Modified-Since: " + lastModified + "\r\n") == 304);
+    assert(get(path, "If-Modified-Since: Sat, 01 Jan 2000 00:00:00 GMT\r\n") == 200);
+    assert(get(path, "If-Modified-Since: yesterday\r\n") == 200);
+    assert(get("/nope.html", "If-None-Match: *\r\n") == 404);
+
+    // 范围
+    assert(get(path, "Range: bytes=0-9\r\nIf-Range: " + etag + "\r\n") == 206 && body == text.substr(0, 10));
+    assert(get(path, "Range: bytes=0-9\r\nIf-Range: W/" + etag + "\r\n") == 200);
+    assert(get(path, "Range: bytes=0-9\r\nIf-None-Match: " + etag + "\r\n") == 304);
+
+    // 压缩版本的标签不同
+    std::string gzEtag;
+    for(int i = 0; i < 200 && gzEtag.empty(); i++) {
+        assert(get(path, "Accept-Encoding: gzip\r\n") == 200);
+        if(HeaderValue(head, "Content-Encoding") == "gzip") gzEtag = HeaderValue(head, "ETag");
+        else usleep(10 * 1000);
+    }
+    assert(!gzEtag.empty() && gzEtag != etag);
+    assert(get(path, "Accept-Encoding: gzip\r\nIf-None-Match: " + gzEtag + "\r\n") == 304);
+    assert(HeaderValue(head, "Vary") == "Accept-Encoding" && HeaderValue(head, "Content-Encoding").empty());
+    assert(get(path, "If-None-Match: " + gzEtag + "\r\n") == 200 && body == text);
+
+    // 修改后旧标签失效
+    WriteFile(root + "/a.txt", text + "changed\n");
+    usleep((FileCache::REVALIDATE_MS + 100) * 1000);
+    assert(get(path, "If-None-Match: " + etag + "\r\n") == 200 && body == text + "changed\n");
+    assert(HeaderValue(head, "ETag") != etag);
+
+    // 再次访问一组页面和静态文件: 带上次的ETag 都是304
+    const char* assets[] = {"/index.html", "/css/bootstrap.min.css", "/css/font-awesome.min.css", "/css/animate.css",
+                            "/js/jquery.js", "/js/bootstrap.min.js", "/images/profile-image.jpg"};
+    size_t first = 0, repeat = 0;
+    std::vector<std::string> etags;
+    for(const char* asset: assets) {
+        assert(get(asset, "") == 200);
+        first += head.size() + body.size();
+        etags.push_back(HeaderValue(head, "ETag"));
+    }
+    for(size_t i = 0; i < etags.size(); i++) {
+        assert(get(assets[i], "If-None-Match: " + etags[i] + "\r\n") == 304);
+        repeat += head.size() + body.size();
+    }
+    printf("conditional: first visit %zu bytes, repeat visit %zu bytes (%.2f%%)\n", first, repeat, 100.0 * repeat / first);
+    assert(repeat < first / 20);
+    close(fd);
+    RemoveDir(root + "/");
+}
+
+// 改为模板前的做法: 每个头部用std::string拼接
+static void LegacyHead(Buffer& buff, int code, const std::string& status, const std::string& path, bool keepAlive, size_t len) {
+    buff.Append("HTTP/1.1 " + std::to_string(code) + " " + status + "\r\n");
+    buff.Append("Connection: ");
+    if(keepAlive) {
+        buff.Append("keep-alive\r\n");
+        buff.Append("keep-alive: max=6, timeout=120\r\n");
+    } else {
+        buff.Append("close\r\n");
+    }
+    std::string type = path.substr(path.find_last_of('.')) == ".html" ? "text/html" : "text/plain";
+    buff.Append("Content-type: " + type + "\r\n");
+    buff.Append("Content-length: " + std::to_string(len) + "\r\n\r\n");
+}
+
+/* 响应头模板: 预热后各类响应(200、压缩、单个和多个范围、304、404、非keep-alive)生成响应时不分配堆内存
+   对比逐个头部用std::string拼接的做法 */
+void TestResponseAlloc() {
+    const std::string srcDir = ResourcePath("/");
+    int logLevel = Log::Instance()->GetLevel();
+    Log::Instance()->SetLevel(3);
+    HttpResponse response;
+    Buffer buff(1024);
+    std::string etag;
+    struct Case {
+        std::string path;
+        bool keepAlive;
+        const char* acceptEncoding;
+        const char* range;
+        bool conditional;
+        int code;
+    };
+    Case cases[] = {
+        {"/index.html", true, "", "", false, 200},
+        {"/css/bootstrap.min.css", true, "gzip, deflate, br", "", false, 200},
+        {"/js/jquery.js", true, "", "bytes=100-199", false, 206},
+        {"/js/jquery.js", true, "", "bytes=0-9,1000-1099,-50", false, 206},
+        {"/css/animate.css", true, "", "", true, 304},
+        {"/nope.html", true, "", "", false, 404},
+        {"/index.html", false, "", "", false, 200},
+    };
+    auto make = [&](Case& c) {
+        response.Init(srcDir, c.path, c.keepAlive, 200);
+        response.SetAcceptEncoding(c.acceptEncoding);
+        response.SetRange(c.range, StrView());
+        response.SetConditional(c.conditional ? StrView(etag.data(), etag.size()) : StrView(), StrView());
+        buff.RetrieveAll();
+        response.MakeResponse(buff);
+        response.ReleaseFile();
+        return response.Code();
+    };
+    // 预热: 文件进入缓存 bootstrap.min.css压缩完成
+    make(cases[4]);
+    std::string head(buff.Peek(), buff.ReadableBytes());
+    etag = HeaderValue(head, "ETag");
+    for(int i = 0; i < 200; i++) {
+        make(cases[1]);
+        head.assign(buff.Peek(), buff.ReadableBytes());
+        if(HeaderValue(head, "Content-Encoding") == "gzip") break;
+        usleep(10 * 1000);
+    }
+    assert(HeaderValue(head, "Content-Encoding") == "gzip" && HeaderValue(head, "Content-type") == "text/css");
+    for(Case& c: cases) {
+        assert(make(c) == c.code);
+        head.assign(buff.Peek(), buff.ReadableBytes());
+        assert(head.compare(0, 12, "HTTP/1.1 " + std::to_string(c.code)) == 0 && HeaderValue(head, "Date").size() == 29);
+        assert(HeaderValue(head, "Connection") == (c.keepAlive ? "keep-alive" : "close"));
+    }
+
+    const int N = 100000;
+    g_allocCnt = 0;
+    g_countAlloc = true;
+    for(int i = 0; i < N; i++) {
+        make(cases[i % 7]);
+    }
+    g_countAlloc = false;
+    long allocs = g_allocCnt.exchange(0);
+
+    // 时间: 200 keep-alive的完整响应(含文件缓存查找) 与只拼接响应行和头部对比
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        make(cases[0]);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    const std::string status = "OK", path = "/index.html";
+    start = std::chrono::steady_clock::now();
+    for(int i = 0; i < N; i++) {
+        buff.RetrieveAll();
+        LegacyHead(buff, 200, status, path, true, 3233);
+    }
+    double legacySec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    g_allocCnt = 0;
+    g_countAlloc = true;
+    for(int i = 0; i < N; i++) {
+        buff.RetrieveAll();
+        LegacyHead(buff, 200, status, path, true, 3233);
+    }
+    g_countAlloc = false;
+    long legacyAllocs = g_allocCnt.exchange(0);
+    Log::Instance()->SetLevel(logLevel);
+    printf("response headers: templates %.2f allocs/response over 7 kinds, 200 response %.0f ns incl. file cache lookup; "
+           "string concatenation %.2f allocs/response, %.0f ns for headers alone\n",
+           (double)allocs / N, sec * 1e9 / N, (double)legacyAllocs / N, legacySec * 1e9 / N);
+    assert(allocs == 0);
+}
+
 int main() {
     TestLog();
     TestThreadPool();
-}
\ No newline at end of file
+    TestThreadPoolThroughput();
+    TestTaskAlloc();
+    TestPoolTelemetry();
+    TestEpollCtl();
+    TestInlineDispatch();
+    TestConnAffinity();
+    TestBlockingLane();
+    TestHttpParser();
+    TestCharScan();
+    TestPipelining();
+    TestRequestBody();
+    TestSplitFormPost();
+    TestMultiReactor();
+    TestIoUring();
+    TestConnSlab();
+    TestHpack();
+    TestHttp2();
+    TestRouter();
+    TestFormDecode();
+    TestUpload();
+    TestRange();
+    TestFileCache();
+    TestSendfile();
+    TestCompress();
+    TestConditional();
+    TestResponseAlloc();
+}